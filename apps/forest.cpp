@@ -0,0 +1,318 @@
+#include <iostream>
+#include <chrono>
+#include <yocto/yocto_sampling.h>
+#include <yocto/yocto_cli.h>
+#include <yocto/yocto_shape.h>
+#include <yocto/yocto_scene.h>
+#include <yocto/yocto_sceneio.h>
+#include <yocto/yocto_bvh.h>
+#include <yocto/yocto_math.h>
+#include <yocto/yocto_geometry.h>
+#include <yocto/branch.h>
+
+using namespace yocto;
+using std::cout;
+using std::endl;
+
+// poisson-disk samples in a square of the given size centered at the origin,
+// with Bridson's algorithm. A background grid with cells of size
+// spacing / sqrt(2) holds at most one sample per cell, so that neighbors are
+// found by checking the 5x5 cells around a candidate.
+vector<vec2f> sample_poisson_disk(float size, float spacing, int count, rng_state &rng)
+{
+    const int attempts = 30;
+    float cell = spacing / sqrt(2.0f);
+    int cells = max(1, (int)ceil(size / cell));
+    vector<int> grid(cells * cells, -1);
+    vector<vec2f> samples;
+    vector<int> active;
+
+    auto grid_index = [&](vec2f p) {
+        int i = clamp((int)((p.x + size / 2) / cell), 0, cells - 1);
+        int j = clamp((int)((p.y + size / 2) / cell), 0, cells - 1);
+        return vec2i{i, j};
+    };
+    auto is_free = [&](vec2f p) {
+        if (p.x < -size / 2 || p.x >= size / 2 || p.y < -size / 2 || p.y >= size / 2)
+            return false;
+        auto ij = grid_index(p);
+        for (int j = max(ij.y - 2, 0); j <= min(ij.y + 2, cells - 1); j++)
+            for (int i = max(ij.x - 2, 0); i <= min(ij.x + 2, cells - 1); i++)
+                if (grid[j * cells + i] >= 0 && distance(samples[grid[j * cells + i]], p) < spacing)
+                    return false;
+        return true;
+    };
+    auto add_sample = [&](vec2f p) {
+        auto ij = grid_index(p);
+        grid[ij.y * cells + ij.x] = (int)samples.size();
+        active.push_back((int)samples.size());
+        samples.push_back(p);
+    };
+
+    add_sample((rand2f(rng) - 0.5f) * size);
+    while (!active.empty() && (int)samples.size() < count)
+    {
+        int slot = rand1i(rng, (int)active.size());
+        vec2f center = samples[active[slot]];
+        bool found = false;
+        for (int attempt = 0; attempt < attempts && !found; attempt++)
+        {
+            // candidates in the annulus between spacing and twice spacing
+            float radius = spacing * sqrt(1 + 3 * rand1f(rng));
+            float angle = 2 * pif * rand1f(rng);
+            vec2f candidate = center + radius * vec2f{cos(angle), sin(angle)};
+            if (is_free(candidate))
+            {
+                add_sample(candidate);
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            active[slot] = active.back();
+            active.pop_back();
+        }
+    }
+    return samples;
+}
+
+// bakes the instances in one shape per material, as done when merging
+// tree copies in a single mesh
+scene_data bake_instances(const scene_data &scene)
+{
+    scene_data baked;
+    baked.cameras = scene.cameras;
+    baked.materials = scene.materials;
+    baked.textures = scene.textures;
+    baked.environments = scene.environments;
+    baked.shapes.resize(scene.materials.size());
+    for (auto &instance : scene.instances)
+    {
+        shape_data copy = scene.shapes[instance.shape];
+        for (auto &position : copy.positions)
+            position = transform_point(instance.frame, position);
+        for (auto &normal : copy.normals)
+            normal = transform_normal(instance.frame, normal);
+        // instances are scaled uniformly, so radii scale as any axis
+        float scale = length(instance.frame.x);
+        for (auto &radius : copy.radius)
+            radius *= scale;
+        merge_shape_inplace(baked.shapes[instance.material], copy);
+        baked.shapes[instance.material].capsules = copy.capsules;
+    }
+    for (int material : range(baked.shapes.size()))
+        if (!baked.shapes[material].positions.empty())
+            baked.instances.push_back({identity3x4f, material, material});
+    return baked;
+}
+
+// prints memory and bvh build time of a scene
+void print_scene_stats(const string &name, const scene_data &scene)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto bvh = make_scene_bvh(scene, false, false);
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    cout << name << ": instances " << scene.instances.size() << ", scene " << compute_memory(scene).bytes / (1 << 20)
+         << " MB, bvh " << compute_memory(bvh).bytes / (1 << 20) << " MB, bvh build " << elapsed << " s" << endl;
+}
+
+void run(const vector<string> &args)
+{
+    uint64_t seed = time(0);
+    vector<string> trees = {"tree.ply"};
+    vector<string> leaves = {};
+    string leaf_texture = "";
+    string terrain = "";
+    string output = "forest.json";
+    float size = 100;
+    int count = 1000;
+    float spacing = 1;
+    float scale_jitter = 0.2f;
+    bool capsules = false;
+    int benchmark = 0;
+    int lods = 0;
+
+    auto cli = make_cli("forest", "scatter instances of tree models over a terrain or a square area");
+    add_option(cli, "trees", trees, "tree models used as prototypes");
+    add_option(cli, "leaves", leaves, "leaves models of the prototypes, in the same order");
+    add_option(cli, "leaf_texture", leaf_texture, "alpha mask of the leaves, if they are cards");
+    add_option(cli, "terrain", terrain, "terrain model to place trees on, instead of a square area");
+    add_option(cli, "output", output, "the filename of the resulting scene");
+    add_option(cli, "size", size, "side of the square area");
+    add_option(cli, "count", count, "number of trees");
+    add_option(cli, "spacing", spacing, "minimum distance between trees");
+    add_option(cli, "scale_jitter", scale_jitter, "random variation of the tree scale");
+    add_option(cli, "capsules", capsules, "set if the tree models are lines-with-radius, rendered as capsules");
+    add_option(cli, "seed", seed, "rng seed (defaults time)");
+    add_option(cli, "benchmark", benchmark, "compare instanced and baked geometry for this number of trees");
+    add_option(cli, "lods", lods, "number of coarser levels of detail of the models, loaded from <model>_lodN");
+    parse_cli(cli, args);
+
+    if (!leaves.empty() && leaves.size() != trees.size())
+        throw std::invalid_argument{"leaves models should match tree models"};
+
+    rng_state rng = make_rng(seed);
+    scene_data scene;
+
+    // materials
+    material_data bark;
+    bark.color = {0.25f, 0.15f, 0.08f};
+    bark.roughness = 1;
+    scene.materials.push_back(bark);
+    scene.material_names.push_back("bark");
+    material_data foliage;
+    foliage.color = {0.15f, 0.4f, 0.08f};
+    foliage.roughness = 1;
+    if (leaf_texture != "")
+    {
+        foliage.color_tex = (int)scene.textures.size();
+        scene.textures.push_back(load_texture(leaf_texture));
+        scene.texture_names.push_back(path_basename(leaf_texture));
+    }
+    scene.materials.push_back(foliage);
+    scene.material_names.push_back("foliage");
+
+    // prototypes are stored once and shared by all instances
+    vector<vector<int>> prototypes;
+    for (int i : range(trees.size()))
+    {
+        vector<int> parts;
+        parts.push_back((int)scene.shapes.size());
+        scene.shapes.push_back(load_shape(trees[i]));
+        scene.shapes.back().capsules = capsules;
+        scene.shape_names.push_back("tree" + std::to_string(i + 1));
+        if (!leaves.empty())
+        {
+            parts.push_back((int)scene.shapes.size());
+            scene.shapes.push_back(load_shape(leaves[i]));
+            scene.shape_names.push_back("leaves" + std::to_string(i + 1));
+        }
+        prototypes.push_back(parts);
+
+        // levels of detail are named after the prototype shapes, so that
+        // renderers can find and switch them
+        for (int level = 1; level <= lods; level++)
+        {
+            string suffix = "_lod" + std::to_string(level);
+            scene.shapes.push_back(load_shape(lod_filename(trees[i], level)));
+            scene.shapes.back().capsules = capsules;
+            scene.shape_names.push_back("tree" + std::to_string(i + 1) + suffix);
+            if (!leaves.empty())
+            {
+                scene.shapes.push_back(load_shape(lod_filename(leaves[i], level)));
+                scene.shape_names.push_back("leaves" + std::to_string(i + 1) + suffix);
+            }
+        }
+    }
+
+    // area to scatter in, either the terrain extents or a flat square
+    shape_bvh terrain_bvh;
+    bbox3f terrain_bounds = {{-size / 2, 0, -size / 2}, {size / 2, 0, size / 2}};
+    int terrain_shape = (int)scene.shapes.size();
+    if (terrain != "")
+    {
+        scene.shapes.push_back(load_shape(terrain));
+        terrain_bvh = make_shape_bvh(scene.shapes[terrain_shape]);
+        terrain_bounds = invalidb3f;
+        for (auto &p : scene.shapes[terrain_shape].positions)
+            terrain_bounds = merge(terrain_bounds, p);
+        size = max(terrain_bounds.max.x - terrain_bounds.min.x, terrain_bounds.max.z - terrain_bounds.min.z);
+    }
+    else
+    {
+        shape_data ground;
+        ground.quads = {{0, 1, 2, 3}};
+        ground.positions = {{-size / 2, 0, size / 2}, {size / 2, 0, size / 2}, {size / 2, 0, -size / 2}, {-size / 2, 0, -size / 2}};
+        ground.normals = {{0, 1, 0}, {0, 1, 0}, {0, 1, 0}, {0, 1, 0}};
+        ground.texcoords = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+        scene.shapes.push_back(ground);
+    }
+    scene.shape_names.push_back("terrain");
+    material_data ground;
+    ground.color = {0.3f, 0.25f, 0.18f};
+    ground.roughness = 1;
+    scene.materials.push_back(ground);
+    scene.material_names.push_back("ground");
+    scene.instances.push_back({identity3x4f, terrain_shape, (int)scene.materials.size() - 1});
+    scene.instance_names.push_back("terrain");
+    auto center = (terrain_bounds.min + terrain_bounds.max) / 2;
+
+    // scatter trees
+    auto start = std::chrono::steady_clock::now();
+    vector<vec2f> samples = sample_poisson_disk(size, spacing, count, rng);
+    int placed = 0;
+    for (vec2f sample : samples)
+    {
+        vec3f position = {center.x + sample.x, terrain_bounds.min.y, center.z + sample.y};
+        if (terrain != "")
+        {
+            // drop the tree on the terrain from above
+            auto &ground = scene.shapes[terrain_shape];
+            ray3f ray = {{position.x, terrain_bounds.max.y + 1, position.z}, {0, -1, 0}};
+            auto intersection = intersect_shape_bvh(terrain_bvh, ground, ray);
+            if (!intersection.hit)
+                continue;
+            position = eval_position(ground, intersection.element, intersection.uv);
+        }
+        int prototype = rand1i(rng, (int)prototypes.size());
+        float angle = 2 * pif * rand1f(rng);
+        float scale = 1 + scale_jitter * (2 * rand1f(rng) - 1);
+        frame3f frame = translation_frame(position) * rotation_frame({0, 1, 0}, angle) * scaling_frame({scale, scale, scale});
+        for (int part : range(prototypes[prototype].size()))
+        {
+            scene.instances.push_back({frame, prototypes[prototype][part], part});
+            scene.instance_names.push_back("tree" + std::to_string(placed + 1) + (part == 0 ? "" : "_leaves"));
+        }
+        placed++;
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    cout << "placed " << placed << " trees of " << count << " in " << elapsed << " s" << endl;
+
+    // camera looking at the forest from above its border
+    camera_data camera;
+    camera.aspect = 16.0f / 9.0f;
+    vec3f target = {center.x, terrain_bounds.min.y, center.z};
+    vec3f eye = target + vec3f{0, size * 0.3f, size * 0.7f};
+    camera.frame = lookat_frame(eye, target, {0, 1, 0});
+    camera.focus = distance(eye, target);
+    scene.cameras.push_back(camera);
+    scene.camera_names.push_back("default");
+    scene.environments.push_back({identity3x4f, {1, 1, 1}});
+    scene.environment_names.push_back("sky");
+
+    // memory and bvh build time of instanced and baked geometry
+    if (benchmark > 0)
+    {
+        scene_data subset = scene;
+        int parts = (int)prototypes[0].size();
+        subset.instances.resize(min(subset.instances.size(), (size_t)(1 + benchmark * parts)));
+        subset.instance_names.clear();
+        print_scene_stats("instanced", subset);
+        print_scene_stats("baked", bake_instances(subset));
+        if (lods > 0)
+        {
+            scene_data selected = subset;
+            select_shape_lods(selected, find_shape_lods(selected), selected.cameras[0], 1280, 64);
+            print_scene_stats("baked, lods for 64 pixels", bake_instances(selected));
+        }
+        if (benchmark < placed)
+            print_scene_stats("instanced, all trees", scene);
+    }
+
+    make_scene_directories(output, scene);
+    save_scene(output, scene);
+}
+
+int main(int argc, const char *argv[])
+{
+    try
+    {
+        run({argv, argv + argc});
+        return 0;
+    }
+    catch (const std::exception &error)
+    {
+        print_error(error.what());
+        return 1;
+    }
+}
@@ -2,138 +2,258 @@
 #include <set>
 #include <tuple>
 #include <cassert>
+#include <algorithm>
 #include <yocto/yocto_sampling.h>
 #include <yocto/yocto_cli.h>
 #include <yocto/yocto_shape.h>
 #include <yocto/yocto_sceneio.h>
 #include <yocto/yocto_math.h>
 #include <yocto/yocto_geometry.h>
+#include <yocto/yocto_image.h>
 #include <yocto/branch.h>
 #include <yocto/truncated_cone.h>
+#include <yocto/tree_profile.h>
 
 using namespace yocto;
 using std::cout;
 using std::endl;
 using std::tie;
 
-double calc_branch_radius(vector<branch> &branches, branch &curr, double leaf_radius, double inverted_growth)
+// lines shape with per-vertex radius, to be rendered as tapered capsules
+shape_data make_capsules(vector<branch> &branches)
 {
-    if (curr.children.empty())
-    {
-        curr.high_base_radius = leaf_radius;
-        return leaf_radius;
-    }
-    double sum = 0;
-    if (curr.children.size() == 1)
-        return curr.high_base_radius = calc_branch_radius(branches, branches[curr.children[0]], leaf_radius, inverted_growth);
-    for (int child : curr.children)
+    auto shape = shape_from_branches(branches);
+    shape.radius.reserve(shape.positions.size());
+    for (branch &b : branches)
+        shape.radius.push_back(b.high_base_radius);
+    shape.radius.push_back(branches[0].high_base_radius);
+    return shape;
+}
+
+// saves the capsules as a shape, that renderers draw as ribbons, or as a
+// scene that marks them as capsules, for .json filenames
+void save_capsules(const string &filename, vector<branch> &branches)
+{
+    shape_data shape = make_capsules(branches);
+    if (path_extension(filename) != ".json")
     {
-        calc_branch_radius(branches, branches[child], leaf_radius, inverted_growth);
-        sum += pow(branches[child].high_base_radius, inverted_growth);
+        save_shape(filename, shape);
+        return;
     }
-    curr.high_base_radius = pow(sum, 1 / inverted_growth);
-    return curr.high_base_radius;
+    shape.capsules = true;
+    scene_data scene = make_shape_scene(shape, true);
+    scene.shape_names[0] = path_basename(filename); // so that lods do not share it
+    scene.materials[0] = {};
+    scene.materials[0].color = {0.25f, 0.15f, 0.08f};
+    scene.materials[0].roughness = 1;
+    scene.material_names[0] = "bark";
+    make_scene_directories(filename, scene);
+    save_scene(filename, scene);
 }
 
-// generates the tree model given the parameters and the sampled points
-vector<branch> generate_tree(string input, float branch_length, float kill_range, float attraction_range, rng_state rng, float random_factor, float leaf_radius, float inverted_growth, int iterations)
-{
-    shape_data sampling = load_shape(input);
-    vector<vec3f> points = sampling.positions; // vector of the attractors
-    vector<int> leaves = {0}; // vector of indexes of the leave branches
-    vector<branch> branches = {branch{{0, 0, 0}, {0, branch_length, 0}, -1}};
-    int iteration = 1;
-    for (; iteration <= iterations; iteration++)
-    {
-        kill_points(points, branches, kill_range);
-        // reset all attractors before recalculating them
-        if (points.empty())
-            break;
-        if (choose_attractors(points, branches, attraction_range))
-        {
-            grow_towards_attractors(branches, branch_length, rng, random_factor);
-            leaves = recalc_leaves(branches);
-            points.pop_back(); // stupid way to avoid "stuck" branches
-        }
-        else
+shape_data make_leaves(vector<branch> branches, string leaf_model, float leaf_scale, string leaves_output, int cone_steps, string output) {
+    shape_data leaf = load_shape(leaf_model);
+    for (auto &p : leaf.positions)
+    {
+        p.y *= leaf_scale;
+        p.x *= leaf_scale;
+    }
+    shape_data leaves{};
+    for (branch &b : branches)
+    {
+        if (b.children.empty())
         {
-            cout << "forward \n";
-            grow_forward(branches, leaves, branch_length, rng, random_factor);
+            shape_data leaf_copy = leaf;
+            vec3f direction = b.direction() * leaf_scale * 2;
+            auto frame = frame_fromz(b.end + direction / 2, -direction);
+            for (auto &position : leaf_copy.positions)
+                position = transform_point(frame, position * vec3f{1, 1, leaf_scale});
+            merge_shape_inplace(leaves, leaf_copy);
         }
-        cout << "iteration #" << iteration << " remaining points : " << points.size() << " branches : " << branches.size() << endl;
     }
-    cout << "exited at " << iteration - 1 << " iterations" << endl;
-    return branches;
+    return leaves;
 }
 
-
-shape_data lines_to_trunc_cones(const vector<branch> &branches, int steps)
+// leaf cards: one textured quad per leaf, spanning the leaf model silhouette.
+// The silhouette is rasterized in a shared alpha mask, so that the renderer
+// can cut out the leaf shape instead of tracing its triangles.
+pair<shape_data, image_data> make_leaf_cards(vector<branch> branches, string leaf_model, float leaf_scale, int texture_size)
 {
-    auto shape = shape_data{};
-    for (int i : range(branches.size()))
+    shape_data leaf = load_shape(leaf_model);
+    for (auto &p : leaf.positions)
     {
-        const branch &b = branches[i];
-        float low_base_radius;
-
-        if (i == 0)
-            low_base_radius = b.high_base_radius;
-        else
-            low_base_radius = branches[b.parent_ind].high_base_radius;
-
-        auto cylinder = make_truncated_cone(low_base_radius, b.high_base_radius, 1, steps);
-        auto frame = frame_fromz((b.start + b.end) / 2,
-                                 b.start - b.end);
-        auto length = distance(b.start, b.end);
-        for (auto &position : cylinder.positions)
-            position = transform_point(frame, position * vec3f{1, 1, length / 2});
-        for (auto &normal : cylinder.normals)
-            normal = transform_direction(frame, normal);
-        merge_shape_inplace(shape, cylinder);
+        p.y *= leaf_scale;
+        p.x *= leaf_scale;
     }
 
-    return shape;
-}
+    // project the leaf on the plane of its two largest extents
+    auto bbox = invalidb3f;
+    for (auto &p : leaf.positions)
+        bbox = merge(bbox, p);
+    auto extents = bbox.max - bbox.min;
+    int flat = extents.x <= min(extents.y, extents.z) ? 0 : (extents.y <= extents.z ? 1 : 2);
+    int ua = flat == 0 ? 1 : 0, va = flat == 2 ? 1 : 2;
+    auto project = [&](vec3f p) {
+        return vec2f{(p[ua] - bbox.min[ua]) / extents[ua], (p[va] - bbox.min[va]) / extents[va]};
+    };
 
-shape_data make_sphere_mesh( vector<branch> branches, int sphere_steps) {
-    shape_data acc{};
-    shape_data csph = quads_to_triangles(make_sphere(sphere_steps, 1));
+    // rasterize the silhouette in the alpha mask
+    auto mask = make_image(texture_size, texture_size, false);
+    for (auto &t : quads_to_triangles(leaf.quads))
+        leaf.triangles.push_back(t);
+    for (auto &t : leaf.triangles)
+    {
+        auto p0 = project(leaf.positions[t.x]) * texture_size;
+        auto p1 = project(leaf.positions[t.y]) * texture_size;
+        auto p2 = project(leaf.positions[t.z]) * texture_size;
+        auto area = cross(p1 - p0, p2 - p0);
+        if (area == 0)
+            continue;
+        auto imin = clamp((int)min(p0.x, min(p1.x, p2.x)), 0, texture_size - 1);
+        auto imax = clamp((int)max(p0.x, max(p1.x, p2.x)), 0, texture_size - 1);
+        auto jmin = clamp((int)min(p0.y, min(p1.y, p2.y)), 0, texture_size - 1);
+        auto jmax = clamp((int)max(p0.y, max(p1.y, p2.y)), 0, texture_size - 1);
+        for (int j = jmin; j <= jmax; j++)
+        {
+            for (int i = imin; i <= imax; i++)
+            {
+                auto q = vec2f{i + 0.5f, j + 0.5f};
+                auto w0 = cross(p1 - q, p2 - q) / area;
+                auto w1 = cross(p2 - q, p0 - q) / area;
+                if (w0 < 0 || w1 < 0 || w0 + w1 > 1)
+                    continue;
+                mask.pixels[j * texture_size + i] = {1, 1, 1, 1};
+            }
+        }
+    }
 
-    for (branch &b : branches)
+    // lines are drawn with the default line radius of scenes, in world units
+    auto world_extents = extents * vec3f{1, 1, leaf_scale};
+    auto texel_size = max(world_extents[ua], world_extents[va]) / texture_size;
+    for (auto &l : leaf.lines)
     {
-        shape_data sph = {csph.points, csph.lines, csph.triangles, csph.quads, csph.positions};
-        for (vec3f &p2 : sph.positions)
+        // stamp pixels along the segment
+        auto p0 = project(leaf.positions[l.x]) * texture_size;
+        auto p1 = project(leaf.positions[l.y]) * texture_size;
+        auto width = max(1.0f, 0.001f / texel_size);
+        auto steps = max(1, (int)ceil(length(p1 - p0)));
+        for (int step = 0; step <= steps; step++)
         {
-            p2 *= b.high_base_radius;
-            p2 += b.end;
+            auto c = lerp(p0, p1, (float)step / steps);
+            for (int j = max(0, (int)(c.y - width)); j <= min(texture_size - 1, (int)(c.y + width)); j++)
+                for (int i = max(0, (int)(c.x - width)); i <= min(texture_size - 1, (int)(c.x + width)); i++)
+                    if (distance(vec2f{i + 0.5f, j + 0.5f}, c) <= width)
+                        mask.pixels[j * texture_size + i] = {1, 1, 1, 1};
         }
-        merge_shape_inplace(acc, sph);
     }
-    return acc;
-}
 
-shape_data make_leaves(vector<branch> branches, string leaf_model, float leaf_scale, string leaves_output, int cone_steps, string output) {
-    shape_data leaf = load_shape(leaf_model);
-    for (auto &p : leaf.positions)
+    // card spanning the silhouette, in the leaf model frame
+    shape_data card{};
+    card.quads = {{0, 1, 2, 3}};
+    card.texcoords = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+    for (auto uv : card.texcoords)
     {
-        p.y *= leaf_scale;
-        p.x *= leaf_scale;
+        auto p = (bbox.min + bbox.max) / 2;
+        p[ua] = bbox.min[ua] + uv.x * extents[ua];
+        p[va] = bbox.min[va] + uv.y * extents[va];
+        card.positions.push_back(p);
     }
-    shape_data leaves{};
+
+    // place cards as in make_leaves
+    shape_data cards{};
     for (branch &b : branches)
     {
         if (b.children.empty())
         {
-            shape_data leaf_copy = leaf;
+            shape_data card_copy = card;
             vec3f direction = b.direction() * leaf_scale * 2;
             auto frame = frame_fromz(b.end + direction / 2, -direction);
-            for (auto &position : leaf_copy.positions)
+            for (auto &position : card_copy.positions)
                 position = transform_point(frame, position * vec3f{1, 1, leaf_scale});
-            merge_shape_inplace(leaves, leaf_copy);
+            merge_shape_inplace(cards, card_copy);
         }
     }
-    return leaves;
+    return {cards, mask};
 }
 
+// keeps the branches at least min_radius thick, and maps every branch to its
+// nearest kept ancestor. Children are never thicker than their parents, so the
+// kept branches are still a connected tree rooted at the trunk.
+vector<branch> prune_branches(const vector<branch> &branches, double min_radius, vector<int> &mapping)
+{
+    vector<branch> pruned;
+    mapping.assign(branches.size(), -1);
+    for (int i : range(branches.size()))
+    {
+        const branch &b = branches[i];
+        if (i != 0 && b.high_base_radius < min_radius)
+        {
+            mapping[i] = mapping[b.parent_ind];
+            continue;
+        }
+        branch kept = {b.start, b.end, i == 0 ? -1 : mapping[b.parent_ind], b.high_base_radius};
+        mapping[i] = pruned.size();
+        if (kept.parent_ind >= 0)
+            pruned[kept.parent_ind].children.push_back(mapping[i]);
+        pruned.push_back(kept);
+    }
+    return pruned;
+}
+
+// leaf clusters: the leaves of the pruned twigs are gathered on the kept branch
+// they grow from, and replaced by two crossed cards through the cluster. The
+// cards tile the leaf mask at the leaf size, and are only as large as needed
+// to show about as many leaves as the cluster, so that coverage is kept.
+shape_data make_leaf_clusters(const vector<branch> &branches, const vector<int> &mapping, float leaf_size)
+{
+    int count = *std::max_element(mapping.begin(), mapping.end()) + 1;
+    vector<vec3f> centers(count, {0, 0, 0}), directions(count, {0, 0, 0});
+    vector<float> radius(count, 0);
+    vector<int> leaves(count, 0);
+    auto leaf_center = [&](const branch &b) {
+        return b.end + normalize(b.end - b.start) * leaf_size / 2;
+    };
+    for (int i : range(branches.size()))
+    {
+        if (!branches[i].children.empty())
+            continue;
+        int c = mapping[i];
+        centers[c] += leaf_center(branches[i]);
+        directions[c] += normalize(branches[i].end - branches[i].start);
+        leaves[c]++;
+    }
+    for (int c : range(count))
+        if (leaves[c] > 0)
+            centers[c] /= leaves[c];
+    for (int i : range(branches.size()))
+        if (branches[i].children.empty())
+            radius[mapping[i]] = max(radius[mapping[i]], distance(centers[mapping[i]], leaf_center(branches[i])));
+
+    shape_data cards{};
+    for (int c : range(count))
+    {
+        if (leaves[c] == 0)
+            continue;
+        vec3f axis = length(directions[c]) > 0 ? normalize(directions[c]) : vec3f{0, 1, 0};
+        auto frame = frame_fromz(centers[c], axis);
+        float size = min(radius[c] + leaf_size / 2, max(1.0f, sqrt(leaves[c] / 2.0f)) * leaf_size / 2);
+        float tiles = max(1.0f, round(2 * size / leaf_size));
+        for (vec3f side : {frame.x, frame.y})
+        {
+            int base = cards.positions.size();
+            cards.quads.push_back({base, base + 1, base + 2, base + 3});
+            cards.positions.push_back(centers[c] - side * size - axis * size);
+            cards.positions.push_back(centers[c] + side * size - axis * size);
+            cards.positions.push_back(centers[c] + side * size + axis * size);
+            cards.positions.push_back(centers[c] - side * size + axis * size);
+            cards.texcoords.push_back({0, 0});
+            cards.texcoords.push_back({tiles, 0});
+            cards.texcoords.push_back({tiles, tiles});
+            cards.texcoords.push_back({0, tiles});
+        }
+    }
+    return cards;
+}
 
 void run(const vector<string> &args)
 {
@@ -143,6 +263,7 @@ void run(const vector<string> &args)
     string leaf_model = "leaf.ply";
     string leaves_output = "leaves.ply";
     string skeleton = "";
+    string capsules = "";
     float branch_length = 0.2f;
     float kill_range = 0.5f;
     float attraction_range = 1.0f;
@@ -154,6 +275,19 @@ void run(const vector<string> &args)
     bool enable_leaves = false;
     float leaf_scale = 0.05;
     int iterations = 1000;
+    bool leaf_cards = false;
+    string leaf_texture = "leaf_alpha.png";
+    int leaf_texture_size = 256;
+    int lods = 0;
+    float lod_prune = 0;
+    string profile_output = "";
+    string trace_output = "";
+    int profile_interval = 1;
+    bool verbose = false;
+    bool partitioned = false;
+    bool quantized = false;
+    string checkpoint = "";
+    string resume = "";
 
     auto cli = make_cli("tree", "generate treee given a model of attraction points");
     add_option(cli, "input", input, "a model containing the attraction point");
@@ -171,28 +305,188 @@ void run(const vector<string> &args)
     add_option(cli, "leaves_output", leaves_output, "resulting model of leaves");
     add_option(cli, "enable_leaves", enable_leaves, "enable to generate the leaves");
     add_option(cli, "skeleton", skeleton, "set to generate a lines-only version of the model");
+    add_option(cli, "capsules", capsules, "set to generate a lines-with-radius version of the model, as a scene rendered as capsules for .json");
+    add_option(cli, "leaf_cards", leaf_cards, "generate leaves as alpha-textured cards instead of full leaf models");
+    add_option(cli, "leaf_texture", leaf_texture, "resulting alpha mask of the leaf cards");
+    add_option(cli, "leaf_texture_size", leaf_texture_size, "resolution of the leaf cards alpha mask");
     add_option(cli, "leaf_scale", leaf_scale, "scale to apply to the leaf model");
     add_option(cli, "iterations", iterations, "maximum number of iterations while growing branches");
+    add_option(cli, "lods", lods, "number of coarser levels of detail, saved as <output>_lodN");
+    add_option(cli, "lod_prune", lod_prune, "radius under which twigs are pruned in the first lod, doubling each level (defaults 2 * leaf_radius)");
+    add_option(cli, "profile", profile_output, "save per-phase times, counters and peak memory as .json or .csv");
+    add_option(cli, "profile_interval", profile_interval, "iterations between profile samples (0 for the end only)");
+    add_option(cli, "trace", trace_output, "save the profiled phases as a Chrome trace (.json)");
+    add_option(cli, "verbose", verbose, "print the progress of every iteration");
+    add_option(cli, "partitioned", partitioned, "sort the points by the cells of a grid, and only visit the ones near the branches (for large point clouds)");
+    add_option(cli, "quantized", quantized, "store the bucketed points in 16 bits per coordinate, implies partitioned");
+    add_option(cli, "checkpoint", checkpoint, "save the skeleton, the points left and the growth parameters, to resume the growth later");
+    add_option(cli, "resume", resume, "continue the growth saved in a checkpoint for iterations more iterations (0 to only mesh it)");
     parse_cli(cli, args);
 
-    assert(attraction_range > kill_range && kill_range > branch_length);
+    tree_profile profile;
+    profile.enabled = profile_output != "" || trace_output != "";
+    profile.sample_interval = profile_interval;
 
     rng_state rng = make_rng(seed);
-    vector<branch> branches = generate_tree(input, branch_length, kill_range, attraction_range, rng, random_factor, leaf_radius, inverted_growth, iterations);
+    vector<vec3f> points;
+    vector<branch> branches;
+    if (resume != "")
+    {
+        // the growth continues with the parameters it started with
+        auto scope = tree_profile_scope{profile, "load"};
+        tree_checkpoint state = load_tree_checkpoint(resume);
+        branch_length = state.branch_length;
+        kill_range = state.kill_range;
+        attraction_range = state.attraction_range;
+        random_factor = state.random_factor;
+        rng = state.rng;
+        profile.iterations = state.iterations;
+        branches = std::move(state.branches);
+        points = std::move(state.points);
+        cout << "resumed at " << profile.iterations << " iterations, branches : " << branches.size() << endl;
+    }
+    else
+    {
+        auto scope = tree_profile_scope{profile, "load"};
+        points = load_shape(input).positions;
+        branches = make_tree_root(branch_length);
+    }
+
+    assert(attraction_range > kill_range && kill_range > branch_length);
+
+    if (partitioned || quantized)
+    {
+        tree_points grid;
+        {
+            auto scope = tree_profile_scope{profile, "partition"};
+            grid = make_tree_points(std::move(points), attraction_range, quantized);
+        }
+        grow_tree(grid, branches, branch_length, kill_range, attraction_range, rng, random_factor, iterations, profile, verbose);
+        if (checkpoint != "")
+            points = get_tree_points(grid);
+    }
+    else
+        grow_tree(points, branches, branch_length, kill_range, attraction_range, rng, random_factor, iterations, profile, verbose);
+    cout << "exited at " << profile.iterations << " iterations, branches : " << branches.size() << endl;
+    if (checkpoint != "")
+    {
+        auto scope = tree_profile_scope{profile, "save"};
+        save_tree_checkpoint(checkpoint, {branch_length, kill_range, attraction_range, random_factor, rng,
+                                          profile.iterations, branches, points});
+    }
     shape_data leaves;
     shape_data acc;
 
-    calc_branch_radius(branches, branches[0], leaf_radius, inverted_growth);
-    acc = make_sphere_mesh(branches, sphere_steps);
+    {
+        auto scope = tree_profile_scope{profile, "radius"};
+        calc_branch_radius(branches, branches[0], leaf_radius, inverted_growth);
+    }
+    {
+        auto scope = tree_profile_scope{profile, "meshing"};
+        acc = make_sphere_mesh(branches, sphere_steps);
+    }
     if (skeleton != "")
+    {
+        auto scope = tree_profile_scope{profile, "save"};
         save_shape(skeleton, shape_from_branches(branches));
-    if (enable_leaves) {
-        leaves = make_leaves(branches, leaf_model, leaf_scale, leaves_output, cone_steps, output);
+    }
+    if (capsules != "")
+    {
+        auto scope = tree_profile_scope{profile, "save"};
+        save_capsules(capsules, branches);
+    }
+    if (enable_leaves && leaf_cards) {
+        shape_data cards;
+        image_data mask;
+        {
+            auto scope = tree_profile_scope{profile, "leaves"};
+            tie(cards, mask) = make_leaf_cards(branches, leaf_model, leaf_scale, leaf_texture_size);
+        }
+        auto scope = tree_profile_scope{profile, "save"};
+        save_shape(leaves_output, cards);
+        save_image(leaf_texture, mask);
+    } else if (enable_leaves) {
+        {
+            auto scope = tree_profile_scope{profile, "leaves"};
+            leaves = make_leaves(branches, leaf_model, leaf_scale, leaves_output, cone_steps, output);
+        }
+        auto scope = tree_profile_scope{profile, "save"};
         save_shape(leaves_output, leaves);
     }
-    merge_shape_inplace(acc, lines_to_trunc_cones(branches, cone_steps));
-    acc.normals = compute_normals(acc);
-    save_shape(output, acc);
+    {
+        auto scope = tree_profile_scope{profile, "meshing"};
+        merge_shape_inplace(acc, lines_to_trunc_cones(branches, cone_steps));
+    }
+    {
+        auto scope = tree_profile_scope{profile, "normals"};
+        acc.normals = compute_normals(acc);
+    }
+    {
+        auto scope = tree_profile_scope{profile, "save"};
+        save_shape(output, acc);
+    }
+
+    // coarser levels of detail from the same skeleton: fewer radial steps,
+    // thin twigs pruned, and their leaves clustered on cards
+    if (lods > 0 && enable_leaves && !leaf_cards)
+    {
+        auto scope = tree_profile_scope{profile, "leaves"};
+        save_image(leaf_texture, make_leaf_cards(branches, leaf_model, leaf_scale, leaf_texture_size).second);
+    }
+    if (lod_prune <= 0)
+        lod_prune = 2 * leaf_radius;
+    float leaf_size = 0;
+    if (lods > 0 && enable_leaves)
+    {
+        auto bbox = invalidb3f;
+        for (auto &p : load_shape(leaf_model).positions)
+            bbox = merge(bbox, p);
+        leaf_size = max(bbox.max - bbox.min) * leaf_scale;
+    }
+    for (int level = 1; level <= lods; level++)
+    {
+        vector<int> mapping;
+        vector<branch> pruned;
+        shape_data lod, clusters;
+        {
+            auto scope = tree_profile_scope{profile, "meshing"};
+            pruned = prune_branches(branches, lod_prune * (1 << (level - 1)), mapping);
+            lod = make_sphere_mesh(pruned, max(1, sphere_steps >> level));
+            merge_shape_inplace(lod, lines_to_trunc_cones(pruned, max(3, cone_steps >> level)));
+        }
+        {
+            auto scope = tree_profile_scope{profile, "normals"};
+            lod.normals = compute_normals(lod);
+        }
+        if (enable_leaves)
+        {
+            auto scope = tree_profile_scope{profile, "leaves"};
+            clusters = make_leaf_clusters(branches, mapping, leaf_size);
+        }
+        {
+            auto scope = tree_profile_scope{profile, "save"};
+            save_shape(lod_filename(output, level), lod);
+            if (capsules != "")
+                save_capsules(lod_filename(capsules, level), pruned);
+            if (enable_leaves)
+                save_shape(lod_filename(leaves_output, level), clusters);
+        }
+        cout << "lod #" << level << " branches : " << pruned.size() << " triangles : " << lod.triangles.size() << endl;
+    }
+
+    // final sample, and a summary of where time went
+    sample_tree_profile(profile, -1);
+    if (profile.enabled)
+    {
+        for (tree_phase &phase : profile.phases)
+            cout << "phase " << phase.name << " : " << phase.nanoseconds * 1e-9 << "s" << endl;
+        cout << "distances : " << profile.distances << " peak memory : " << profile.peak_memory / (1 << 20) << "MB" << endl;
+        cout << "skeleton memory : " << compute_memory(branches).bytes / (1 << 10) << "KB" << endl;
+    }
+    if (profile_output != "")
+        save_tree_profile(profile_output, profile);
+    if (trace_output != "")
+        save_tree_trace(trace_output, profile);
 }
 
 int main(int argc, const char *argv[])
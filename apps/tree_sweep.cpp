@@ -0,0 +1,188 @@
+#include <iostream>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <yocto/yocto_sampling.h>
+#include <yocto/yocto_cli.h>
+#include <yocto/yocto_shape.h>
+#include <yocto/yocto_sceneio.h>
+#include <yocto/yocto_parallel.h>
+#include <yocto/yocto_math.h>
+#include <yocto/branch.h>
+
+using namespace yocto;
+using std::cout;
+using std::endl;
+
+// growth parameters of a tree in the sweep, and the stats of its growth
+struct sweep_variant
+{
+    float branch_length, kill_range, attraction_range, random_factor;
+    string skeleton = "";
+    size_t branches = 0;
+    size_t leaves = 0;
+    int iterations = 0;
+    double seconds = 0;
+    string error = ""; // why the tree could not be grown or saved
+};
+
+// steps values evenly spaced from range[0] to range[1], as given on the
+// command line by min, max and steps
+vector<float> sweep_values(const string &name, const array<float, 3> &range)
+{
+    int steps = (int)range[2];
+    if (steps < 1)
+        throw std::invalid_argument{name + ": steps should be at least 1"};
+    vector<float> values;
+    for (int i = 0; i < steps; i++)
+        values.push_back(steps == 1 ? range[0] : range[0] + (range[1] - range[0]) * i / (steps - 1));
+    return values;
+}
+
+// the combinations of the parameter values, skipping the ones that the
+// generator does not support
+vector<sweep_variant> make_variants(const vector<float> &branch_lengths, const vector<float> &kill_ranges,
+                                    const vector<float> &attraction_ranges, const vector<float> &random_factors)
+{
+    vector<sweep_variant> variants;
+    for (float branch_length : branch_lengths)
+        for (float kill_range : kill_ranges)
+            for (float attraction_range : attraction_ranges)
+                for (float random_factor : random_factors)
+                    if (attraction_range > kill_range && kill_range > branch_length)
+                        variants.push_back({branch_length, kill_range, attraction_range, random_factor});
+    return variants;
+}
+
+// stats of the variants as Csv, with one row written as each variant completes,
+// so that the rows of a sweep survive the failure of some of its variants
+struct sweep_stats
+{
+    string filename = "";
+    std::unique_ptr<FILE, int (*)(FILE *)> file = {nullptr, &fclose};
+    std::mutex mutex;
+};
+
+void open_sweep_stats(sweep_stats &stats, const string &filename)
+{
+    stats.filename = filename;
+    stats.file = {fopen(filename.c_str(), "w"), &fclose};
+    if (!stats.file)
+        throw io_error{filename + ": file not found"};
+    fprintf(stats.file.get(),
+            "skeleton,seed,br_length,kill,attraction,random_factor,branches,leaves,iterations,seconds,error\n");
+    if (fflush(stats.file.get()) != 0)
+        throw io_error{filename + ": write error"};
+}
+
+void write_sweep_stats(sweep_stats &stats, const sweep_variant &variant, uint64_t seed)
+{
+    string error = variant.error; // quoted, with quotes doubled
+    for (size_t i = error.find('"'); i != string::npos; i = error.find('"', i + 2))
+        error.insert(i, 1, '"');
+    auto lock = std::lock_guard{stats.mutex};
+    FILE *f = stats.file.get();
+    fprintf(f, "%s,%llu,%g,%g,%g,%g,%zu,%zu,%d,%.6f,\"%s\"\n", variant.skeleton.c_str(), (unsigned long long)seed,
+            variant.branch_length, variant.kill_range, variant.attraction_range, variant.random_factor,
+            variant.branches, variant.leaves, variant.iterations, variant.seconds, error.c_str());
+    if (fflush(f) != 0)
+        throw io_error{stats.filename + ": write error"};
+}
+
+void run(const vector<string> &args)
+{
+    uint64_t seed = time(0);
+    string input = "points.ply";
+    string output = "sweep";
+    array<float, 3> branch_length = {0.2f, 0.2f, 1};
+    array<float, 3> kill_range = {0.5f, 0.5f, 1};
+    array<float, 3> attraction_range = {1.0f, 1.0f, 1};
+    array<float, 3> random_factor = {0.0f, 0.0f, 1};
+    int iterations = 1000;
+    int threads = 0;
+
+    auto cli = make_cli("tree_sweep", "grow trees for ranges of parameters, given a model of attraction points");
+    add_option(cli, "input", input, "a model containing the attraction point");
+    add_option(cli, "output", output, "directory of the skeletons and of stats.csv");
+    add_option(cli, "br_length", branch_length, "min, max and steps of the length of a single branch segment");
+    add_option(cli, "kill", kill_range, "min, max and steps of the branch-point distance at which attraction points are deleted");
+    add_option(cli, "attraction", attraction_range, "min, max and steps of the distance at which attraction points attract the branch grows");
+    add_option(cli, "random_factor", random_factor, "min, max and steps of the influence of randomness in the directions of the branches");
+    add_option(cli, "seed", seed, "rng seed, the same for all trees (defaults time)");
+    add_option(cli, "iterations", iterations, "maximum number of iterations while growing branches");
+    add_option(cli, "threads", threads, "number of threads (defaults all)");
+    parse_cli(cli, args);
+
+    if (threads > 0)
+        set_parallel_threads(threads);
+
+    vector<sweep_variant> variants = make_variants(
+        sweep_values("br_length", branch_length), sweep_values("kill", kill_range),
+        sweep_values("attraction", attraction_range), sweep_values("random_factor", random_factor));
+    if (variants.empty())
+        throw std::invalid_argument{"no variant has attraction > kill > br_length"};
+
+    // the points are loaded once and shared read-only, while each tree
+    // grows on its own grid of the ids of the points left
+    const vector<vec3f> points = load_shape(input).positions;
+    cout << "growing " << variants.size() << " trees on " << points.size() << " points with "
+         << get_parallel_threads() << " threads, seed " << seed << endl;
+    std::filesystem::create_directories(output);
+    sweep_stats stats;
+    open_sweep_stats(stats, (std::filesystem::path{output} / "stats.csv").string());
+
+    simple_timer timer;
+    parallel_for(variants.size(), [&](size_t index) {
+        sweep_variant &variant = variants[index];
+        variant.skeleton = "tree_" + std::to_string(index) + ".ply";
+        try
+        {
+            simple_timer variant_timer;
+            tree_profile profile;
+            tree_points grid = make_tree_points(points, variant.attraction_range);
+            vector<branch> branches = generate_tree(grid, variant.branch_length, variant.kill_range,
+                                                    variant.attraction_range, make_rng(seed),
+                                                    variant.random_factor, iterations, profile);
+            variant.seconds = elapsed_seconds(variant_timer);
+            variant.branches = branches.size();
+            variant.leaves = recalc_leaves(branches).size();
+            variant.iterations = profile.iterations;
+            save_shape((std::filesystem::path{output} / variant.skeleton).string(), shape_from_branches(branches));
+        }
+        catch (const std::exception &error)
+        {
+            variant.error = error.what();
+        }
+        write_sweep_stats(stats, variant, seed);
+    });
+    double total = 0;
+    int failed = 0;
+    for (const sweep_variant &variant : variants)
+    {
+        total += variant.seconds;
+        if (variant.error != "")
+        {
+            print_error(variant.skeleton + ": " + variant.error);
+            failed++;
+        }
+    }
+    cout << "grown in " << elapsed_seconds(timer) << " s, " << total << " s of growth" << endl;
+    if (failed != 0)
+        throw std::runtime_error{std::to_string(failed) + " of " + std::to_string(variants.size()) +
+                                 " trees failed, see " + stats.filename};
+}
+
+int main(int argc, const char *argv[])
+{
+    try
+    {
+        run({argv, argv + argc});
+        return 0;
+    }
+    catch (const std::exception &error)
+    {
+        print_error(error.what());
+        return 1;
+    }
+}
@@ -29,28 +29,86 @@
 #include <yocto/yocto_cli.h>
 #include <yocto/yocto_gui.h>
 #include <yocto/yocto_math.h>
+#include <yocto/yocto_parallel.h>
 #include <yocto/yocto_scene.h>
 #include <yocto/yocto_sceneio.h>
 #include <yocto/yocto_shape.h>
 #include <yocto/yocto_trace.h>
 
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
 using namespace yocto;
 using namespace std::string_literals;
 
+// Heap allocations made while rendering, counted by replacing operator new,
+// so that samplers can be checked to not allocate. Threads saving images run
+// while rendering, and are not counted.
+static std::atomic<size_t> render_allocations = 0;
+static std::atomic<bool>   count_allocations  = false;
+static thread_local bool   saving_thread      = false;
+
+void* operator new(size_t size) {
+  if (count_allocations && !saving_thread) render_allocations += 1;
+  if (auto data = std::malloc(size != 0 ? size : 1)) return data;
+  throw std::bad_alloc{};
+}
+void operator delete(void* data) noexcept { std::free(data); }
+
+// Render samples, counting the heap allocations
+static void trace_counted_samples(trace_state& state, const scene_data& scene,
+    const trace_bvh& bvh, const trace_lights& lights,
+    const trace_params& params) {
+  count_allocations = true;
+  trace_samples(state, scene, bvh, lights, params);
+  count_allocations = false;
+}
+
+// Add cameras orbiting around the vertical axis through the scene center,
+// starting from the given camera. Returns the indices of the new cameras.
+static vector<int> add_turntable_cameras(
+    scene_data& scene, int camera, int nviews) {
+  auto center = yocto::center(compute_bounds(scene));
+  auto start  = scene.cameras.at(camera);
+  auto views  = vector<int>{};
+  for (auto view : range(nviews)) {
+    auto angle   = 2 * pif * view / nviews;
+    auto orbit   = translation_frame(center) *
+                 rotation_frame({0, 1, 0}, angle) *
+                 translation_frame(-center);
+    auto& orbiting = scene.cameras.emplace_back(start);
+    orbiting.frame = orbit * start.frame;
+    if (!scene.camera_names.empty()) {
+      scene.camera_names.push_back("turntable" + std::to_string(view + 1));
+    }
+    views.push_back((int)scene.cameras.size() - 1);
+  }
+  return views;
+}
+
 // main function
 void run(const vector<string>& args) {
   // parameters
-  auto scenename   = "scene.json"s;
-  auto outname     = "out.png"s;
-  auto paramsname  = ""s;
-  auto interactive = false;
-  auto edit        = false;
-  auto camname     = ""s;
-  bool addsky      = false;
-  auto envname     = ""s;
-  auto savebatch   = false;
-  auto dumpname    = ""s;
-  auto params      = trace_params{};
+  auto scenename    = "scene.json"s;
+  auto outname      = "out.png"s;
+  auto paramsname   = ""s;
+  auto interactive  = false;
+  auto edit         = false;
+  auto camname      = ""s;
+  bool addsky       = false;
+  auto envname      = ""s;
+  auto savebatch    = false;
+  auto allcameras   = false;
+  auto turntable    = 0;
+  auto imagetile    = 0;
+  auto lodpixels    = 0.0f;
+  auto memorybudget = 0;
+  auto memorystats  = false;
+  auto threads      = 0;
+  auto pinthreads   = false;
+  auto dumpname     = ""s;
+  auto params       = trace_params{};
 
   // parse command line
   auto cli = make_cli("ytrace", "render with raytracing");
@@ -62,6 +120,12 @@ void run(const vector<string>& args) {
   add_option(cli, "addsky", addsky, "add sky");
   add_option(cli, "envname", envname, "add environment");
   add_option(cli, "savebatch", savebatch, "save batch");
+  add_option(cli, "allcameras", allcameras, "render all cameras");
+  add_option(cli, "turntable", turntable, "render a turntable of n views");
+  add_option(cli, "imagetile", imagetile, "render and save exr image tiles");
+  add_option(cli, "lodpixels", lodpixels, "pick shape lods from screen size");
+  add_option(cli, "memorybudget", memorybudget, "memory budget in MB");
+  add_option(cli, "memorystats", memorystats, "print memory usage");
   add_option(cli, "resolution", params.resolution, "image resolution");
   add_option(
       cli, "sampler", params.sampler, "sampler type", trace_sampler_labels);
@@ -72,16 +136,27 @@ void run(const vector<string>& args) {
   add_option(cli, "denoise", params.denoise, "enable denoiser");
   add_option(cli, "batch", params.batch, "sample batch");
   add_option(cli, "clamp", params.clamp, "clamp params");
+  add_option(cli, "noise", params.noise, "adaptive noise threshold");
+  add_option(cli, "tilesize", params.tilesize, "render tile size");
+  add_option(cli, "mipmaps", params.mipmaps, "filter textures with mipmaps");
   add_option(cli, "nocaustics", params.nocaustics, "disable caustics");
   add_option(cli, "envhidden", params.envhidden, "hide environment");
   add_option(cli, "tentfilter", params.tentfilter, "filter image");
   add_option(cli, "embreebvh", params.embreebvh, "use Embree bvh");
   add_option(cli, "highqualitybvh", params.highqualitybvh, "high quality bvh");
   add_option(cli, "noparallel", params.noparallel, "disable threading");
+  add_option(cli, "threads", threads, "number of threads (defaults all)");
+  add_option(cli, "pinthreads", pinthreads, "pin threads to cores");
   add_option(cli, "dumpparams", dumpname, "dump params filename");
   add_option(cli, "edit", edit, "edit interactively");
   parse_cli(cli, args);
 
+  // thread pool
+  if (threads > 0 || pinthreads) {
+    set_parallel_threads(
+        threads > 0 ? threads : get_parallel_threads(), pinthreads);
+  }
+
   // load config
   if (!paramsname.empty()) {
     update_trace_params(paramsname, params);
@@ -98,9 +173,20 @@ void run(const vector<string>& args) {
   print_info("rendering {}", scenename);
   auto timer = simple_timer{};
 
-  // scene loading
-  timer      = simple_timer{};
-  auto scene = load_scene(scenename);
+  // scene loading, building shape bvhs as soon as shapes are loaded
+  timer            = simple_timer{};
+  auto shape_bvhs  = vector<shape_bvh>{};
+  auto bvhs_mutex  = std::mutex{};
+  auto build_shape = [&](const scene_data& scene, int shape) {
+    auto sbvh = make_shape_bvh(scene.shapes[shape], params.highqualitybvh);
+    auto _    = std::lock_guard{bvhs_mutex};
+    if (shape >= (int)shape_bvhs.size())
+      shape_bvhs.resize(scene.shapes.size());
+    shape_bvhs[shape] = std::move(sbvh);
+  };
+  auto scene = params.embreebvh ? load_scene(scenename)
+                                : load_scene(scenename, build_shape);
+  shape_bvhs.resize(scene.shapes.size());
   print_info("load scene: {}", elapsed_formatted(timer));
 
   // add sky
@@ -117,11 +203,36 @@ void run(const vector<string>& args) {
   // tesselation
   if (!scene.subdivs.empty()) {
     tesselate_subdivs(scene);
+    for (auto& subdiv : scene.subdivs) shape_bvhs[subdiv.shape] = {};
   }
 
-  // build bvh
+  // level of detail, picked once for the main camera
+  if (lodpixels > 0) {
+    auto lods = find_shape_lods(scene);
+    select_shape_lods(scene, lods, scene.cameras[params.camera],
+        params.resolution, lodpixels);
+    // clear unused levels, so that they do not end up in the bvh
+    auto used = vector<bool>(scene.shapes.size(), false);
+    for (auto& instance : scene.instances) used[instance.shape] = true;
+    for (auto& chain : lods) {
+      for (auto shape : chain) {
+        if (used[shape]) continue;
+        scene.shapes[shape] = {};
+        shape_bvhs[shape]   = {};
+      }
+    }
+  }
+
+  // build texture mipmaps
+  if (params.mipmaps) {
+    timer = simple_timer{};
+    make_texture_mips(scene);
+    print_info("build mipmaps: {}", elapsed_formatted(timer));
+  }
+
+  // build bvh, on top of the shape bvhs built while loading
   timer    = simple_timer{};
-  auto bvh = make_trace_bvh(scene, params);
+  auto bvh = make_trace_bvh(scene, params, std::move(shape_bvhs));
   print_info("build bvh: {}", elapsed_formatted(timer));
 
   // init renderer
@@ -133,30 +244,152 @@ void run(const vector<string>& args) {
     params.sampler = trace_sampler_type::eyelight;
   }
 
-  // state
-  auto state = make_trace_state(scene, params);
+  // state, allocated per tile when rendering in image tiles
+  auto state = imagetile > 0 ? trace_state{} : make_trace_state(scene, params);
+
+  // fit the scene in the memory budget, left after rendering data
+  if (memorybudget > 0) {
+    auto budget    = (size_t)memorybudget * 1024 * 1024;
+    auto rendering = compute_memory(bvh).bytes + compute_memory(state).bytes +
+                     compute_memory(lights).bytes;
+    if (compute_memory(scene).bytes + rendering > budget) {
+      timer       = simple_timer{};
+      auto before = compute_memory(scene).bytes;
+      auto after  = reduce_scene_memory(
+          scene, budget > rendering ? budget - rendering : 0);
+      // environment textures may have been resized, and the old tables freed
+      lights = make_trace_lights(scene, params);
+      print_info("reduce scene memory: {} -> {} bytes: {}", before, after,
+          elapsed_formatted(timer));
+    }
+  }
+
+  // memory usage
+  if (memorystats) {
+    auto print_memory = [](const string& name, const memory_usage& memory) {
+      print_info("memory {}: {} bytes ({} slack)", name, memory.bytes,
+          memory.slack);
+    };
+    auto total = memory_usage{};
+    print_memory("scene", compute_memory(scene));
+    print_memory("bvh", compute_memory(bvh));
+    print_memory("lights", compute_memory(lights));
+    print_memory("state", compute_memory(state));
+    total += compute_memory(scene);
+    total += compute_memory(bvh);
+    total += compute_memory(lights);
+    total += compute_memory(state);
+    print_memory("total", total);
+  }
 
   if (!interactive) {
-    // render
-    timer = simple_timer{};
-    for (auto sample : range(0, params.samples, params.batch)) {
-      auto sample_timer = simple_timer{};
-      trace_samples(state, scene, bvh, lights, params);
-      print_info("render sample {}/{}: {}", state.samples, params.samples,
-          elapsed_formatted(sample_timer));
-      if (savebatch && state.samples % params.batch == 0) {
-        auto image     = get_image(state);
-        auto batchname = replace_extension(outname,
-            "-" + std::to_string(state.samples) + path_extension(outname));
-        save_image(batchname, image);
+    // views to render, sharing the bvh and lights
+    auto views = vector<int>{params.camera};
+    if (allcameras) {
+      views.clear();
+      for (auto camera : range((int)scene.cameras.size()))
+        views.push_back(camera);
+    }
+    if (turntable > 0) {
+      views = add_turntable_cameras(scene, params.camera, turntable);
+    }
+
+    // images are saved asynchronously, double buffered so that a snapshot
+    // can be taken while the previous one is being saved
+    auto save_images = vector<image_data>(2);
+    auto save_future = std::future<void>{};
+    auto save_next   = 0;
+    auto save_async  = [&](const string& filename) {
+      auto& image = save_images[save_next];
+      save_next   = (save_next + 1) % (int)save_images.size();
+      get_image(image, state);
+      if (save_future.valid()) save_future.get();
+      save_future = run_async(
+          [&image, filename]() {
+            saving_thread = true;
+            save_image(filename, image);
+          });
+    };
+
+    reset_trace_alloc_stats();
+    for (auto view : range(views.size())) {
+      // output name, numbered for multiple views
+      auto viewname = outname;
+      if (views.size() > 1) {
+        auto number = std::to_string(view + 1);
+        number      = string(max(4 - (int)number.size(), 0), '0') + number;
+        viewname    = replace_extension(outname, "") + "-" + number +
+                   path_extension(outname);
+        print_info("render view {}/{}: {}", view + 1, views.size(),
+            viewname);
       }
+
+      // render in image tiles, each streamed to disk when done, so that
+      // memory is bounded by the tile size
+      if (imagetile > 0) {
+        params.camera = views[view];
+        timer         = simple_timer{};
+        auto size     = get_trace_resolution(scene, params);
+        auto ntiles   = ((size.x + imagetile - 1) / imagetile) *
+                      ((size.y + imagetile - 1) / imagetile);
+        auto writer   = image_writer{};
+        auto tile     = image_data{};
+        open_image_writer(viewname, writer, size.x, size.y, imagetile);
+        for (auto j = 0; j < size.y; j += imagetile) {
+          for (auto i = 0; i < size.x; i += imagetile) {
+            auto tile_timer = simple_timer{};
+            make_trace_state(state, scene, params, {i, j},
+                {min(i + imagetile, size.x), min(j + imagetile, size.y)});
+            for (auto sample : range(0, params.samples, params.batch)) {
+              trace_counted_samples(state, scene, bvh, lights, params);
+              if (get_active_tiles(state) == 0) break;
+            }
+            get_image(tile, state);
+            write_image_tile(writer, {i, j}, tile);
+            print_info("render tile {}/{}: {}", writer.next, ntiles,
+                elapsed_formatted(tile_timer));
+          }
+        }
+        close_image_writer(writer);
+        print_info("render image: {}", elapsed_formatted(timer));
+        continue;
+      }
+
+      // reset state for the view
+      if (params.camera != views[view]) {
+        params.camera = views[view];
+        make_trace_state(state, scene, params);
+      }
+
+      // render
+      timer = simple_timer{};
+      for (auto sample : range(0, params.samples, params.batch)) {
+        auto sample_timer = simple_timer{};
+        trace_counted_samples(state, scene, bvh, lights, params);
+        print_info("render sample {}/{}: {}", state.samples, params.samples,
+            elapsed_formatted(sample_timer));
+        if (params.noise > 0) {
+          print_info("active tiles {}/{}", get_active_tiles(state),
+              state.tiles.size());
+        }
+        if (savebatch && state.samples % params.batch == 0) {
+          save_async(replace_extension(viewname, "") + "-" +
+                     std::to_string(state.samples) + path_extension(viewname));
+        }
+        if (get_active_tiles(state) == 0) break;
+      }
+      print_info("render image: {}", elapsed_formatted(timer));
+
+      // save image, while the next view renders
+      save_async(viewname);
     }
-    print_info("render image: {}", elapsed_formatted(timer));
+    auto allocs = get_trace_alloc_stats();
+    print_info("render allocations: {} ({} bytes), heap allocations: {}",
+        allocs.allocations, allocs.bytes, render_allocations.load());
 
-    // save image
-    timer      = simple_timer{};
-    auto image = get_image(state);
-    save_image(outname, image);
+    // wait for the last image
+    timer = simple_timer{};
+    if (save_future.valid()) save_future.get();
     print_info("save image: {}", elapsed_formatted(timer));
   } else {
 #ifdef YOCTO_OPENGL
@@ -189,7 +422,7 @@ void run(const vector<string>& args) {
     auto render_restart = [&]() {
       // make sure we can start
       trace_cancel(context);
-      state = make_trace_state(scene, params);
+      make_trace_state(state, scene, params);
       if (image.width != state.width || image.height != state.height)
         image = make_image(state.width, state.height, true);
 
@@ -0,0 +1,125 @@
+//
+// LICENSE:
+//
+// Copyright (c) 2016 -- 2022 Fabio Pellacini
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <yocto/yocto_cli.h>
+#include <yocto/yocto_math.h>
+#include <yocto/yocto_parallel.h>
+
+using namespace yocto;
+
+// Parallel for that spawns and joins one async task per thread at each call,
+// as parallel loops did before the thread pool. Used as a reference.
+template <typename T, typename Func>
+static void spawn_parallel_for(T num, int nthreads, Func&& func) {
+  auto      futures = vector<future<void>>{};
+  atomic<T> next_idx(0);
+  for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
+    futures.emplace_back(
+        std::async(std::launch::async, [&func, &next_idx, num]() {
+          while (true) {
+            auto idx = next_idx.fetch_add(1);
+            if (idx >= num) break;
+            func(idx);
+          }
+        }));
+  }
+  for (auto& f : futures) f.get();
+}
+
+// Runs a loop `calls` times, and returns the time per call in microseconds.
+template <typename Loop>
+static double time_calls(int calls, Loop&& loop) {
+  loop();
+  auto timer = simple_timer{};
+  for (auto call = 0; call < calls; call++) loop();
+  return elapsed_nanoseconds(timer) / 1.0e3 / calls;
+}
+
+// main function
+void run(const vector<string>& args) {
+  // parameters
+  auto threads    = 0;
+  auto pinthreads = false;
+  auto calls      = 1000;
+  auto work       = 0;
+
+  // parse command line
+  auto cli = make_cli(
+      "ybench_parallel", "measure the overhead of parallel loops");
+  add_option(cli, "threads", threads, "number of threads (defaults all)");
+  add_option(cli, "pinthreads", pinthreads, "pin threads to cores");
+  add_option(cli, "calls", calls, "number of calls per loop");
+  add_option(cli, "work", work, "iterations of busy work per index");
+  parse_cli(cli, args);
+
+  // thread pool
+  if (threads > 0 || pinthreads) {
+    set_parallel_threads(
+        threads > 0 ? threads : get_parallel_threads(), pinthreads);
+  }
+  auto nthreads = get_parallel_threads();
+  print_info("threads: {}", nthreads);
+
+  // busy work that the compiler cannot remove
+  auto sink = atomic<uint64_t>{0};
+  auto body = [&sink, work](size_t idx) {
+    auto value = (uint64_t)idx;
+    for (auto step = 0; step < work; step++)
+      value = value * 6364136223846793005ull + 1442695040888963407ull;
+    sink += value;
+  };
+
+  // time per call of loops over a growing number of indices, and of nested
+  // loops, where each index of the outer loop runs an inner loop
+  for (auto num : {1, 16, 256, 4096}) {
+    auto spawn = time_calls(calls, [&]() {
+      spawn_parallel_for((size_t)num, nthreads, body);
+    });
+    auto pool   = time_calls(
+        calls, [&]() { parallel_for((size_t)num, body); });
+    auto nested = time_calls(calls, [&]() {
+      parallel_for((size_t)16, [&](size_t) {
+        parallel_for((size_t)max(num / 16, 1), body);
+      });
+    });
+    print_info("{} indices: spawn {} us, pool {} us, nested {} us", num, spawn,
+        pool, nested);
+  }
+  if (sink == 0) print_info("");
+}
+
+// Run
+int main(int argc, const char* argv[]) {
+  try {
+    run({argv, argv + argc});
+    return 0;
+  } catch (const std::exception& error) {
+    print_error(error.what());
+    return 1;
+  }
+}
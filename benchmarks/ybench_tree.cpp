@@ -0,0 +1,263 @@
+//
+// LICENSE:
+//
+// Copyright (c) 2016 -- 2022 Fabio Pellacini
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <yocto/branch.h>
+#include <yocto/yocto_bvh.h>
+#include <yocto/yocto_cli.h>
+#include <yocto/yocto_modelio.h>
+#include <yocto/yocto_parallel.h>
+#include <yocto/yocto_scene.h>
+#include <yocto/yocto_sceneio.h>
+#include <yocto/yocto_shape.h>
+#include <yocto/yocto_trace.h>
+
+#include <cstdio>
+#include <filesystem>
+
+using namespace yocto;
+
+// Tree parameters of a bundled example, as in examples/*/commands.
+struct bench_example {
+  string name             = "";
+  float  branch_length    = 0.2f;
+  float  kill_range       = 0.5f;
+  float  attraction_range = 1.0f;
+  float  random_factor    = 0.0f;
+  float  leaf_radius      = 0.005f;
+  float  inverted_growth  = 2.0f;
+};
+
+// Bundled examples. Suzanne has no commands, and uses the dragon ones.
+static const auto bench_examples = vector<bench_example>{
+    {"bunny", 0.001f, 0.007f, 0.1f, 0.0f, 0.00018f, 3.0f},
+    {"christmas_tree", 0.0125f, 0.025f, 1.0f, 0.1f, 0.005f, 3.5f},
+    {"cypress", 0.02f, 0.05f, 1.0f, 0.1f, 0.005f, 3.5f},
+    {"dragon", 0.05f, 0.1f, 1.0f, 0.1f, 0.005f, 3.0f},
+    {"hemisphere", 0.01f, 0.02f, 1.0f, 0.3f, 0.002f, 3.0f},
+    {"pine", 0.01f, 0.04f, 2.0f, 0.3f, 0.001f, 3.0f},
+    {"suzanne", 0.05f, 0.1f, 1.0f, 0.1f, 0.005f, 3.0f},
+};
+
+// Timings of a benchmark over its repeats, and the number of items, like
+// points or triangles, it processed in each repeat.
+struct bench_result {
+  string example = "";
+  string name    = "";
+  int    repeats = 0;
+  double min     = 0;
+  double mean    = 0;
+  size_t items   = 0;
+};
+
+// Runs func `repeats` times, after a warm-up run. Func returns the number of
+// items it processed.
+template <typename Func>
+static bench_result run_bench(
+    const string& example, const string& name, int repeats, Func&& func) {
+  auto result  = bench_result{example, name, repeats};
+  result.items = func();
+  result.min   = flt_max;
+  auto total   = 0.0;
+  for (auto repeat = 0; repeat < repeats; repeat++) {
+    auto timer = simple_timer{};
+    func();
+    auto seconds = elapsed_seconds(timer);
+    result.min   = std::min(result.min, seconds);
+    total += seconds;
+  }
+  result.mean = total / repeats;
+  print_info(
+      "{} {}: {} s ({} items)", example, name, result.mean, result.items);
+  return result;
+}
+
+// Saves results as a Json document.
+static void save_results(const string& filename,
+    const vector<bench_result>& results, int threads, int iterations,
+    int resolution) {
+  auto text   = string{};
+  auto buffer = array<char, 1024>{};
+  snprintf(buffer.data(), buffer.size(),
+      "{\n  \"threads\": %d,\n  \"iterations\": %d,\n  \"resolution\": %d,\n"
+      "  \"results\": [",
+      threads, iterations, resolution);
+  text += buffer.data();
+  for (auto idx = 0; idx < (int)results.size(); idx++) {
+    auto& result = results[idx];
+    snprintf(buffer.data(), buffer.size(),
+        "%s\n    {\"example\": \"%s\", \"name\": \"%s\", \"repeats\": %d, "
+        "\"min\": %.6f, \"mean\": %.6f, \"items\": %zu}",
+        idx != 0 ? "," : "", result.example.c_str(), result.name.c_str(),
+        result.repeats, result.min, result.mean, result.items);
+    text += buffer.data();
+  }
+  text += "\n  ]\n}\n";
+  save_text(filename, text);
+}
+
+// main function
+void run(const vector<string>& args) {
+  // parameters
+  auto examples   = string{"examples"};
+  auto output     = string{"ybench_tree.json"};
+  auto only       = string{""};
+  auto repeats    = 3;
+  auto iterations = 30;
+  auto resolution = 128;
+  auto threads    = 0;
+
+  // parse command line
+  auto cli = make_cli(
+      "ybench_tree", "measure the tree generator on the bundled examples");
+  add_option(cli, "examples", examples, "examples directory");
+  add_option(cli, "output", output, "results filename (json)");
+  add_option(cli, "example", only, "run only this example");
+  add_option(cli, "repeats", repeats, "timed runs of each benchmark");
+  add_option(cli, "iterations", iterations, "growth iterations");
+  add_option(cli, "resolution", resolution, "trace resolution");
+  add_option(cli, "threads", threads, "number of threads (defaults all)");
+  parse_cli(cli, args);
+
+  // thread pool
+  if (threads > 0) set_parallel_threads(threads);
+
+  auto results  = vector<bench_result>{};
+  auto ply_copy = (std::filesystem::temp_directory_path() / "ybench_tree.ply")
+                      .string();
+  for (auto& example : bench_examples) {
+    if (!only.empty() && example.name != only) continue;
+    auto filename = (std::filesystem::path{examples} / example.name /
+                     "points.ply")
+                        .string();
+
+    // ply io
+    auto ply   = ply_model{};
+    auto error = string{};
+    results.push_back(run_bench(example.name, "load_ply", repeats, [&]() {
+      ply = {};
+      if (!load_ply(filename, ply, error)) throw io_error{error};
+      return ply.elements.empty() ? (size_t)0 : ply.elements[0].count;
+    }));
+    results.push_back(run_bench(example.name, "save_ply", repeats, [&]() {
+      if (!save_ply(ply_copy, ply, error)) throw io_error{error};
+      return ply.elements.empty() ? (size_t)0 : ply.elements[0].count;
+    }));
+    std::filesystem::remove(ply_copy);
+    auto points = load_shape(filename).positions;
+
+    // full growth, bounded by iterations
+    auto branches = vector<branch>{};
+    auto grow     = [&]() {
+      auto profile = tree_profile{};
+      branches     = generate_tree(points, example.branch_length,
+          example.kill_range, example.attraction_range, make_rng(15),
+          example.random_factor, iterations, profile);
+      return points.size();
+    };
+    results.push_back(run_bench(example.name, "generate_tree", repeats, grow));
+    results.push_back(
+        run_bench(example.name, "generate_tree_partitioned", repeats, [&]() {
+          auto profile = tree_profile{};
+          auto grid    = make_tree_points(
+              vector<vec3f>{points}, example.attraction_range);
+          branches = generate_tree(grid, example.branch_length,
+              example.kill_range, example.attraction_range, make_rng(15),
+              example.random_factor, iterations, profile);
+          return points.size();
+        }));
+    results.push_back(
+        run_bench(example.name, "generate_tree_quantized", repeats, [&]() {
+          auto profile = tree_profile{};
+          auto grid    = make_tree_points(
+              vector<vec3f>{points}, example.attraction_range, true);
+          auto quantized = generate_tree(grid, example.branch_length,
+              example.kill_range, example.attraction_range, make_rng(15),
+              example.random_factor, iterations, profile);
+          return points.size();
+        }));
+
+    // kernels on the points left after growth
+    auto remaining = points;
+    kill_points(remaining, branches, example.kill_range);
+    results.push_back(run_bench(example.name, "kill_points", repeats, [&]() {
+      auto killed = remaining;
+      kill_points(killed, branches, example.kill_range);
+      return remaining.size() * branches.size();
+    }));
+    results.push_back(
+        run_bench(example.name, "choose_attractors", repeats, [&]() {
+          choose_attractors(remaining, branches, example.attraction_range);
+          return remaining.size() * branches.size();
+        }));
+
+    // meshing, with the tree app defaults
+    auto mesh = shape_data{};
+    results.push_back(run_bench(example.name, "make_mesh", repeats, [&]() {
+      calc_branch_radius(branches, branches[0], example.leaf_radius,
+          example.inverted_growth);
+      mesh = make_sphere_mesh(branches, 4);
+      merge_shape_inplace(mesh, lines_to_trunc_cones(branches, 16));
+      mesh.normals = compute_normals(mesh);
+      return mesh.triangles.size();
+    }));
+
+    // bvh and rendering of the mesh
+    results.push_back(
+        run_bench(example.name, "make_shape_bvh", repeats, [&]() {
+          auto bvh = make_shape_bvh(mesh, false);
+          return mesh.triangles.size();
+        }));
+    auto scene        = make_shape_scene(mesh, true);
+    auto params       = trace_params{};
+    params.resolution = resolution;
+    params.samples    = repeats + 1;
+    auto bvh          = make_trace_bvh(scene, params);
+    auto lights       = make_trace_lights(scene, params);
+    auto state        = make_trace_state(scene, params);
+    results.push_back(run_bench(example.name, "trace_samples", repeats, [&]() {
+      trace_samples(state, scene, bvh, lights, params);
+      return (size_t)state.width * (size_t)state.height;
+    }));
+  }
+
+  // save results
+  save_results(
+      output, results, get_parallel_threads(), iterations, resolution);
+  print_info("results saved to {}", output);
+}
+
+// Run
+int main(int argc, const char* argv[]) {
+  try {
+    run({argv, argv + argc});
+    return 0;
+  } catch (const std::exception& error) {
+    print_error(error.what());
+    return 1;
+  }
+}
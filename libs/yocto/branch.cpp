@@ -1,7 +1,13 @@
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <set>
 #include <tuple>
 #include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <yocto/yocto_sampling.h>
 #include <yocto/yocto_cli.h>
 #include <yocto/yocto_shape.h>
@@ -9,12 +15,431 @@
 #include <yocto/yocto_math.h>
 #include <yocto/yocto_geometry.h>
 #include <yocto/branch.h>
+#include <yocto/truncated_cone.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TREE_SSE2
+#endif
+// AVX2 and AVX-512 kernels, chosen at runtime by the features of the cpu
+#if defined(TREE_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TREE_AVX
+#endif
+
 namespace yocto
 {
     using std::cout;
     using std::endl;
     using std::tie;
 
+    /*
+     branch ends stored as separate coordinates, so that the distance kernels
+     test a point against a lane of ends at once. Ends are padded to a
+     multiple of the widest lane size with ends at infinity, that are never
+     in range
+    */
+#if defined(TREE_AVX)
+    const size_t lane_size = 16;
+#elif defined(TREE_SSE2)
+    const size_t lane_size = 4;
+#else
+    const size_t lane_size = 1;
+#endif
+
+    struct tree_ends
+    {
+        vector<float> x, y, z;
+        vector<int> ids;
+        size_t count = 0;	   // ends, without padding
+        vector<float> squared; // squared distances, used by the kernels
+    };
+
+    static void clear_ends(tree_ends &ends)
+    {
+        ends.x.clear();
+        ends.y.clear();
+        ends.z.clear();
+        ends.ids.clear();
+        ends.count = 0;
+    }
+
+    static void add_end(tree_ends &ends, vec3f position, int id)
+    {
+        ends.x.push_back(position.x);
+        ends.y.push_back(position.y);
+        ends.z.push_back(position.z);
+        ends.ids.push_back(id);
+        ends.count++;
+    }
+
+    static void pad_ends(tree_ends &ends)
+    {
+        float inf = 1.0 / 0.0;
+        size_t count = ends.count;
+        while (ends.x.size() % lane_size != 0)
+            add_end(ends, {inf, inf, inf}, std::numeric_limits<int>::max());
+        ends.count = count;
+    }
+
+    // neighbouring floats, for positive finite numbers
+    static float next_float(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        bits++;
+        memcpy(&value, &bits, sizeof(bits));
+        return value;
+    }
+
+    static float previous_float(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        bits--;
+        memcpy(&value, &bits, sizeof(bits));
+        return value;
+    }
+
+    /*
+     the squared distances below the result are exactly the ones whose
+     distance() is below range, so that kernels compare squared distances
+     and still match the scalar search. Kernels take both ranges
+    */
+    static float squared_range(float range)
+    {
+        float squared = range * range;
+        while (std::sqrt(squared) < range)
+            squared = next_float(squared);
+        while (squared > 0 && std::sqrt(previous_float(squared)) >= range)
+            squared = previous_float(squared);
+        return squared;
+    }
+
+    // the closest end of the lanes, with ties going to the lowest id,
+    // or -1 if no lane has an end in range
+    static int closest_lane(const float *mins, const int *closests, size_t lanes, float &min)
+    {
+        min = flt_max;
+        int closest = -1;
+        for (size_t k = 0; k < lanes; k++)
+        {
+            if (closests[k] >= 0 && (min > mins[k] || (min == mins[k] && closests[k] < closest)))
+            {
+                closest = closests[k];
+                min = mins[k];
+            }
+        }
+        return closest;
+    }
+
+    // the largest squared distance whose distance rounds to the one of min,
+    // since ends further away may round to the same distance and win the tie
+    static float tied_distance(float min)
+    {
+        float tied = min;
+        while (std::sqrt(next_float(tied)) == std::sqrt(min))
+            tied = next_float(tied);
+        return tied;
+    }
+
+    /*
+     the kernels below return the id of the end closest to p within range,
+     or -1 if none is, and whether any end is within range of p, counting
+     the distances computed.
+     Ties go to the lowest id. Vector kernels compare squared distances with
+     range2, and match the scalar ones on distance(), that may tie ends with
+     different squared distances
+    */
+#ifndef TREE_SSE2
+    static int find_closest_scalar(tree_ends &ends, vec3f p, float range, float)
+    {
+        float min = 1.0 / 0.0;
+        int closest = -1;
+        for (size_t i = 0; i < ends.x.size(); i++)
+        {
+            float dist = distance(p, vec3f{ends.x[i], ends.y[i], ends.z[i]});
+            if (dist < range && (min > dist || (min == dist && ends.ids[i] < closest)))
+            {
+                closest = ends.ids[i];
+                min = dist;
+            }
+        }
+        return closest;
+    }
+
+    static bool any_within_scalar(const tree_ends &ends, vec3f p, float range, float, int64_t &count)
+    {
+        for (size_t i = 0; i < ends.count; i++)
+        {
+            count++;
+            if (distance(p, vec3f{ends.x[i], ends.y[i], ends.z[i]}) < range)
+                return true;
+        }
+        return false;
+    }
+#endif
+
+#ifdef TREE_SSE2
+    static __m128 squared_distances(const tree_ends &ends, size_t i, __m128 px, __m128 py, __m128 pz)
+    {
+        __m128 dx = _mm_sub_ps(px, _mm_loadu_ps(&ends.x[i]));
+        __m128 dy = _mm_sub_ps(py, _mm_loadu_ps(&ends.y[i]));
+        __m128 dz = _mm_sub_ps(pz, _mm_loadu_ps(&ends.z[i]));
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+    }
+
+    static int find_closest_sse2(tree_ends &ends, vec3f p, float, float range2)
+    {
+        // closest squared distance in each lane, keeping squared distances
+        __m128 px = _mm_set1_ps(p.x), py = _mm_set1_ps(p.y), pz = _mm_set1_ps(p.z);
+        __m128 lane_min = _mm_set1_ps(range2);
+        __m128i lane_closest = _mm_set1_epi32(-1);
+        ends.squared.resize(ends.x.size());
+        for (size_t i = 0; i < ends.x.size(); i += 4)
+        {
+            __m128 dist2 = squared_distances(ends, i, px, py, pz);
+            _mm_storeu_ps(&ends.squared[i], dist2);
+            __m128i ids = _mm_loadu_si128((const __m128i *)&ends.ids[i]);
+            __m128 tie = _mm_and_ps(_mm_cmpeq_ps(dist2, lane_min), _mm_castsi128_ps(_mm_cmplt_epi32(ids, lane_closest)));
+            __m128 update = _mm_or_ps(_mm_cmplt_ps(dist2, lane_min), tie);
+            lane_min = _mm_or_ps(_mm_and_ps(update, dist2), _mm_andnot_ps(update, lane_min));
+            lane_closest = _mm_or_si128(_mm_and_si128(_mm_castps_si128(update), ids),
+                                        _mm_andnot_si128(_mm_castps_si128(update), lane_closest));
+        }
+        float mins[4];
+        int closests[4];
+        _mm_storeu_ps(mins, lane_min);
+        _mm_storeu_si128((__m128i *)closests, lane_closest);
+        float min;
+        int closest = closest_lane(mins, closests, 4, min);
+        if (closest < 0)
+            return -1;
+
+        float tied = tied_distance(min);
+        if (tied == min)
+            return closest;
+        __m128 lane_tied = _mm_set1_ps(tied);
+        __m128i lane_first = _mm_set1_epi32(closest);
+        for (size_t i = 0; i < ends.x.size(); i += 4)
+        {
+            __m128 dist2 = _mm_loadu_ps(&ends.squared[i]);
+            __m128i ids = _mm_loadu_si128((const __m128i *)&ends.ids[i]);
+            __m128 lower = _mm_and_ps(_mm_cmple_ps(dist2, lane_tied), _mm_castsi128_ps(_mm_cmplt_epi32(ids, lane_first)));
+            if (_mm_movemask_ps(lower) == 0)
+                continue;
+            for (size_t k = i; k < i + 4; k++)
+                if (ends.squared[k] <= tied && ends.ids[k] < closest)
+                    closest = ends.ids[k];
+        }
+        return closest;
+    }
+
+    static bool any_within_sse2(const tree_ends &ends, vec3f p, float, float range2, int64_t &count)
+    {
+        __m128 px = _mm_set1_ps(p.x), py = _mm_set1_ps(p.y), pz = _mm_set1_ps(p.z);
+        __m128 lane_range = _mm_set1_ps(range2);
+        for (size_t i = 0; i < ends.x.size(); i += 4)
+        {
+            __m128 dist2 = squared_distances(ends, i, px, py, pz);
+            count += std::min((size_t)4, ends.count - std::min(i, ends.count));
+            if (_mm_movemask_ps(_mm_cmplt_ps(dist2, lane_range)) != 0)
+                return true;
+        }
+        return false;
+    }
+#endif
+
+#ifdef TREE_AVX
+    __attribute__((target("avx2"))) static __m256 squared_distances_avx2(const tree_ends &ends, size_t i, __m256 px,
+                                                                         __m256 py, __m256 pz)
+    {
+        __m256 dx = _mm256_sub_ps(px, _mm256_loadu_ps(&ends.x[i]));
+        __m256 dy = _mm256_sub_ps(py, _mm256_loadu_ps(&ends.y[i]));
+        __m256 dz = _mm256_sub_ps(pz, _mm256_loadu_ps(&ends.z[i]));
+        return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+    }
+
+    __attribute__((target("avx2"))) static int find_closest_avx2(tree_ends &ends, vec3f p, float, float range2)
+    {
+        __m256 px = _mm256_set1_ps(p.x), py = _mm256_set1_ps(p.y), pz = _mm256_set1_ps(p.z);
+        __m256 lane_min = _mm256_set1_ps(range2);
+        __m256i lane_closest = _mm256_set1_epi32(-1);
+        ends.squared.resize(ends.x.size());
+        for (size_t i = 0; i < ends.x.size(); i += 8)
+        {
+            __m256 dist2 = squared_distances_avx2(ends, i, px, py, pz);
+            _mm256_storeu_ps(&ends.squared[i], dist2);
+            __m256i ids = _mm256_loadu_si256((const __m256i *)&ends.ids[i]);
+            __m256 tie = _mm256_and_ps(_mm256_cmp_ps(dist2, lane_min, _CMP_EQ_OQ),
+                                       _mm256_castsi256_ps(_mm256_cmpgt_epi32(lane_closest, ids)));
+            __m256 update = _mm256_or_ps(_mm256_cmp_ps(dist2, lane_min, _CMP_LT_OQ), tie);
+            lane_min = _mm256_blendv_ps(lane_min, dist2, update);
+            lane_closest = _mm256_castps_si256(
+                _mm256_blendv_ps(_mm256_castsi256_ps(lane_closest), _mm256_castsi256_ps(ids), update));
+        }
+        float mins[8];
+        int closests[8];
+        _mm256_storeu_ps(mins, lane_min);
+        _mm256_storeu_si256((__m256i *)closests, lane_closest);
+        float min;
+        int closest = closest_lane(mins, closests, 8, min);
+        if (closest < 0)
+            return -1;
+
+        float tied = tied_distance(min);
+        if (tied == min)
+            return closest;
+        __m256 lane_tied = _mm256_set1_ps(tied);
+        __m256i lane_first = _mm256_set1_epi32(closest);
+        for (size_t i = 0; i < ends.x.size(); i += 8)
+        {
+            __m256 dist2 = _mm256_loadu_ps(&ends.squared[i]);
+            __m256i ids = _mm256_loadu_si256((const __m256i *)&ends.ids[i]);
+            __m256 lower = _mm256_and_ps(_mm256_cmp_ps(dist2, lane_tied, _CMP_LE_OQ),
+                                         _mm256_castsi256_ps(_mm256_cmpgt_epi32(lane_first, ids)));
+            if (_mm256_movemask_ps(lower) == 0)
+                continue;
+            for (size_t k = i; k < i + 8; k++)
+                if (ends.squared[k] <= tied && ends.ids[k] < closest)
+                    closest = ends.ids[k];
+        }
+        return closest;
+    }
+
+    __attribute__((target("avx2"))) static bool any_within_avx2(const tree_ends &ends, vec3f p, float, float range2,
+                                                                int64_t &count)
+    {
+        __m256 px = _mm256_set1_ps(p.x), py = _mm256_set1_ps(p.y), pz = _mm256_set1_ps(p.z);
+        __m256 lane_range = _mm256_set1_ps(range2);
+        for (size_t i = 0; i < ends.x.size(); i += 8)
+        {
+            __m256 dist2 = squared_distances_avx2(ends, i, px, py, pz);
+            count += std::min((size_t)8, ends.count - std::min(i, ends.count));
+            if (_mm256_movemask_ps(_mm256_cmp_ps(dist2, lane_range, _CMP_LT_OQ)) != 0)
+                return true;
+        }
+        return false;
+    }
+
+    // AVX-512 enables fma, so the products use the rounding variant, that is
+    // never contracted with the sums, and round as in the other kernels
+    __attribute__((target("avx512f"))) static __m512 squared_distances_avx512(const tree_ends &ends, size_t i,
+                                                                              __m512 px, __m512 py, __m512 pz)
+    {
+        __m512 dx = _mm512_sub_ps(px, _mm512_loadu_ps(&ends.x[i]));
+        __m512 dy = _mm512_sub_ps(py, _mm512_loadu_ps(&ends.y[i]));
+        __m512 dz = _mm512_sub_ps(pz, _mm512_loadu_ps(&ends.z[i]));
+        __m512 dx2 = _mm512_maskz_mul_round_ps((__mmask16)-1, dx, dx, _MM_FROUND_CUR_DIRECTION);
+        __m512 dy2 = _mm512_maskz_mul_round_ps((__mmask16)-1, dy, dy, _MM_FROUND_CUR_DIRECTION);
+        __m512 dz2 = _mm512_maskz_mul_round_ps((__mmask16)-1, dz, dz, _MM_FROUND_CUR_DIRECTION);
+        return _mm512_add_ps(_mm512_add_ps(dx2, dy2), dz2);
+    }
+
+    __attribute__((target("avx512f"))) static int find_closest_avx512(tree_ends &ends, vec3f p, float, float range2)
+    {
+        __m512 px = _mm512_set1_ps(p.x), py = _mm512_set1_ps(p.y), pz = _mm512_set1_ps(p.z);
+        __m512 lane_min = _mm512_set1_ps(range2);
+        __m512i lane_closest = _mm512_set1_epi32(-1);
+        ends.squared.resize(ends.x.size());
+        for (size_t i = 0; i < ends.x.size(); i += 16)
+        {
+            __m512 dist2 = squared_distances_avx512(ends, i, px, py, pz);
+            _mm512_storeu_ps(&ends.squared[i], dist2);
+            __m512i ids = _mm512_loadu_si512(&ends.ids[i]);
+            __mmask16 tie = _mm512_cmp_ps_mask(dist2, lane_min, _CMP_EQ_OQ) &
+                            _mm512_cmpgt_epi32_mask(lane_closest, ids);
+            __mmask16 update = _mm512_cmp_ps_mask(dist2, lane_min, _CMP_LT_OQ) | tie;
+            lane_min = _mm512_mask_blend_ps(update, lane_min, dist2);
+            lane_closest = _mm512_mask_blend_epi32(update, lane_closest, ids);
+        }
+        float mins[16];
+        int closests[16];
+        _mm512_storeu_ps(mins, lane_min);
+        _mm512_storeu_si512(closests, lane_closest);
+        float min;
+        int closest = closest_lane(mins, closests, 16, min);
+        if (closest < 0)
+            return -1;
+
+        float tied = tied_distance(min);
+        if (tied == min)
+            return closest;
+        __m512 lane_tied = _mm512_set1_ps(tied);
+        __m512i lane_first = _mm512_set1_epi32(closest);
+        for (size_t i = 0; i < ends.x.size(); i += 16)
+        {
+            __m512 dist2 = _mm512_loadu_ps(&ends.squared[i]);
+            __m512i ids = _mm512_loadu_si512(&ends.ids[i]);
+            __mmask16 lower = _mm512_cmp_ps_mask(dist2, lane_tied, _CMP_LE_OQ) &
+                              _mm512_cmpgt_epi32_mask(lane_first, ids);
+            if (lower == 0)
+                continue;
+            for (size_t k = i; k < i + 16; k++)
+                if (ends.squared[k] <= tied && ends.ids[k] < closest)
+                    closest = ends.ids[k];
+        }
+        return closest;
+    }
+
+    __attribute__((target("avx512f"))) static bool any_within_avx512(const tree_ends &ends, vec3f p, float,
+                                                                     float range2, int64_t &count)
+    {
+        __m512 px = _mm512_set1_ps(p.x), py = _mm512_set1_ps(p.y), pz = _mm512_set1_ps(p.z);
+        __m512 lane_range = _mm512_set1_ps(range2);
+        for (size_t i = 0; i < ends.x.size(); i += 16)
+        {
+            __m512 dist2 = squared_distances_avx512(ends, i, px, py, pz);
+            count += std::min((size_t)16, ends.count - std::min(i, ends.count));
+            if (_mm512_cmp_ps_mask(dist2, lane_range, _CMP_LT_OQ) != 0)
+                return true;
+        }
+        return false;
+    }
+#endif
+
+    // the kernels of the widest lanes the cpu supports
+    struct tree_kernels
+    {
+        int (*find_closest)(tree_ends &ends, vec3f p, float range, float range2);
+        bool (*any_within)(const tree_ends &ends, vec3f p, float range, float range2, int64_t &count);
+    };
+
+    static tree_kernels select_kernels()
+    {
+#ifdef TREE_AVX
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+            return {find_closest_avx512, any_within_avx512};
+        if (__builtin_cpu_supports("avx2"))
+            return {find_closest_avx2, any_within_avx2};
+#endif
+#ifdef TREE_SSE2
+        return {find_closest_sse2, any_within_sse2};
+#else
+        return {find_closest_scalar, any_within_scalar};
+#endif
+    }
+
+    // kernels are chosen once, on first use
+    static const tree_kernels &get_kernels()
+    {
+        static const tree_kernels kernels = select_kernels();
+        return kernels;
+    }
+
+    // id of the end closest to p within range, or -1 if none is
+    static int find_closest(tree_ends &ends, vec3f p, float range, float range2)
+    {
+        return get_kernels().find_closest(ends, p, range, range2);
+    }
+
+    // whether any end is within range of p, counting the distances computed
+    static bool any_within(const tree_ends &ends, vec3f p, float range, float range2, int64_t &count)
+    {
+        return get_kernels().any_within(ends, p, range, range2, count);
+    }
+
     // comparator for set3f
     bool cmp3f(vec3f a, vec3f b)
     {
@@ -28,23 +453,291 @@ namespace yocto
      removes the points which are in kill_range from a branch
      (points that are too close to a branch.end)
     */
-    void kill_points(vector<vec3f> &points, vector<branch> &branches, float kill_range)
+    void kill_points(vector<vec3f> &points, vector<branch> &branches, float kill_range, int64_t *distances)
     {
-        vector<vec3f> old = points;
-        points.clear();
+        tree_ends ends;
+        for (int i : range((int)branches.size()))
+            add_end(ends, branches[i].end, i);
+        pad_ends(ends);
 
-        for (vec3f p : old)
+        // compacts the survivors in place, keeping their order
+        float kill_range2 = squared_range(kill_range);
+        size_t alive = 0;
+        int64_t count = 0;
+        for (vec3f p : points)
         {
-            bool kill = false;
-            for (branch &br : branches)
-                if (distance(br.end, p) < kill_range)
-                {
-                    kill = true;
-                    break;
-                }
-            if (!kill)
-                points.push_back(p);
+            if (!any_within(ends, p, kill_range, kill_range2, count))
+                points[alive++] = p;
         }
+        points.resize(alive);
+        if (distances != nullptr)
+            *distances += count;
+    }
+
+    static vec3i get_cell(const tree_points &points, vec3f position)
+    {
+        vec3f cell = position / points.cell_size;
+        return {(int)floor(cell.x), (int)floor(cell.y), (int)floor(cell.z)};
+    }
+
+    static vec3f get_origin(const tree_points &points, const tree_bucket &bucket)
+    {
+        return vec3f{(float)bucket.cell.x, (float)bucket.cell.y, (float)bucket.cell.z} * points.cell_size;
+    }
+
+    static void quantize_position(tree_points &points, const tree_bucket &bucket, size_t i, vec3f position)
+    {
+        vec3f uvw = clamp((position - get_origin(points, bucket)) / points.cell_size, 0, 1) * 65535;
+        points.qx[i] = (uint16_t)round(uvw.x);
+        points.qy[i] = (uint16_t)round(uvw.y);
+        points.qz[i] = (uint16_t)round(uvw.z);
+    }
+
+    vec3f get_position(const tree_points &points, const tree_bucket &bucket, size_t i)
+    {
+        if (points.shared != nullptr)
+            return (*points.shared)[points.ids[bucket.begin + i]];
+        if (!points.quantized)
+            return points.positions[bucket.begin + i];
+        size_t j = bucket.begin + i;
+        vec3f q = {(float)points.qx[j], (float)points.qy[j], (float)points.qz[j]};
+        return get_origin(points, bucket) + q * (points.cell_size / 65535);
+    }
+
+    // positions of the points of a bucket as separate coordinates, as the
+    // kernels read them
+    struct tree_lanes
+    {
+        vector<float> x, y, z;
+    };
+
+    static void set_lane(tree_lanes &lanes, size_t i, vec3f position)
+    {
+        lanes.x[i] = position.x;
+        lanes.y[i] = position.y;
+        lanes.z[i] = position.z;
+    }
+
+    // origin + codes * scale, with the rounding of get_position
+    static void decode_coordinate(const uint16_t *codes, size_t size, float origin, float scale, float *values)
+    {
+        size_t i = 0;
+#ifdef TREE_SSE2
+        __m128 lane_origin = _mm_set1_ps(origin), lane_scale = _mm_set1_ps(scale);
+        for (; i + 8 <= size; i += 8)
+        {
+            __m128i q = _mm_loadu_si128((const __m128i *)(codes + i));
+            __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(q, _mm_setzero_si128()));
+            __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(q, _mm_setzero_si128()));
+            _mm_storeu_ps(values + i, _mm_add_ps(lane_origin, _mm_mul_ps(lo, lane_scale)));
+            _mm_storeu_ps(values + i + 4, _mm_add_ps(lane_origin, _mm_mul_ps(hi, lane_scale)));
+        }
+#endif
+        for (; i < size; i++)
+            values[i] = origin + (float)codes[i] * scale;
+    }
+
+    // the positions of the points of a bucket, decoded once for all its points
+    static void load_bucket(const tree_points &points, const tree_bucket &bucket, tree_lanes &lanes)
+    {
+        lanes.x.resize(bucket.size);
+        lanes.y.resize(bucket.size);
+        lanes.z.resize(bucket.size);
+        if (points.quantized)
+        {
+            vec3f origin = get_origin(points, bucket);
+            float scale = points.cell_size / 65535;
+            decode_coordinate(&points.qx[bucket.begin], bucket.size, origin.x, scale, lanes.x.data());
+            decode_coordinate(&points.qy[bucket.begin], bucket.size, origin.y, scale, lanes.y.data());
+            decode_coordinate(&points.qz[bucket.begin], bucket.size, origin.z, scale, lanes.z.data());
+        }
+        else if (points.shared != nullptr)
+        {
+            for (size_t i = 0; i < bucket.size; i++)
+                set_lane(lanes, i, (*points.shared)[points.ids[bucket.begin + i]]);
+        }
+        else
+        {
+            for (size_t i = 0; i < bucket.size; i++)
+                set_lane(lanes, i, points.positions[bucket.begin + i]);
+        }
+    }
+
+    // order of the i-th point of the grid, as its index in the input of
+    // shared grids, and as its index otherwise, that compaction keeps in order
+    static int get_order(const tree_points &points, size_t i)
+    {
+        return points.shared != nullptr ? points.ids[i] : (int)i;
+    }
+
+    // number of points stored by the grid, killed ones included
+    static size_t stored_points(const tree_points &points)
+    {
+        if (points.shared != nullptr)
+            return points.ids.size();
+        return points.quantized ? points.qx.size() : points.positions.size();
+    }
+
+    // moves the i-th point of the grid to the j-th place
+    static void move_point(tree_points &points, size_t i, size_t j)
+    {
+        if (points.shared != nullptr)
+            points.ids[j] = points.ids[i];
+        else if (points.quantized)
+        {
+            points.qx[j] = points.qx[i];
+            points.qy[j] = points.qy[i];
+            points.qz[j] = points.qz[i];
+        }
+        else
+            points.positions[j] = points.positions[i];
+    }
+
+    // moves the points left to the start of the grid, and gives back the
+    // memory of the killed ones, once they are half of the points stored
+    static void compact_points(tree_points &points)
+    {
+        if (points.count > stored_points(points) / 2)
+            return;
+        size_t next = 0;
+        for (tree_bucket &bucket : points.buckets)
+        {
+            for (size_t i = 0; i < bucket.size; i++)
+                move_point(points, bucket.begin + i, next + i);
+            bucket.begin = next;
+            next += bucket.size;
+        }
+        if (points.shared != nullptr)
+            points.ids = vector<int>(points.ids.begin(), points.ids.begin() + next);
+        else if (points.quantized)
+        {
+            points.qx = vector<uint16_t>(points.qx.begin(), points.qx.begin() + next);
+            points.qy = vector<uint16_t>(points.qy.begin(), points.qy.begin() + next);
+            points.qz = vector<uint16_t>(points.qz.begin(), points.qz.begin() + next);
+        }
+        else
+            points.positions = vector<vec3f>(points.positions.begin(), points.positions.begin() + next);
+    }
+
+    // cells along z, then y, then x
+    static bool cell_less(vec3i a, vec3i b)
+    {
+        return tie(a.z, a.y, a.x) < tie(b.z, b.y, b.x);
+    }
+
+    // a bucket for each run of points in the same cell, for points sorted by cell
+    template <typename Position>
+    static void make_buckets(tree_points &grid, size_t count, Position &&position)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            vec3i cell = get_cell(grid, position(i));
+            if (grid.buckets.empty() || grid.buckets.back().cell != cell)
+            {
+                grid.cells[cell] = (int)grid.buckets.size();
+                grid.buckets.push_back({cell, i, 0});
+            }
+            grid.buckets.back().size++;
+        }
+        grid.count = count;
+    }
+
+    tree_points make_tree_points(vector<vec3f> &&points, float cell_size, bool quantized)
+    {
+        tree_points grid;
+        grid.cell_size = cell_size;
+        grid.quantized = quantized;
+        // points in the same cell are sorted by position, so that the order
+        // does not depend on the input one
+        std::sort(points.begin(), points.end(), [&grid](vec3f a, vec3f b) {
+            vec3i ca = get_cell(grid, a), cb = get_cell(grid, b);
+            if (ca != cb)
+                return cell_less(ca, cb);
+            return tie(a.z, a.y, a.x) < tie(b.z, b.y, b.x);
+        });
+        make_buckets(grid, points.size(), [&points](size_t i) { return points[i]; });
+        if (quantized)
+        {
+            grid.qx.resize(points.size());
+            grid.qy.resize(points.size());
+            grid.qz.resize(points.size());
+            for (const tree_bucket &bucket : grid.buckets)
+                for (size_t i = bucket.begin; i < bucket.begin + bucket.size; i++)
+                    quantize_position(grid, bucket, i, points[i]);
+            points = vector<vec3f>{};
+        }
+        else
+            grid.positions = std::move(points);
+        return grid;
+    }
+
+    tree_points make_tree_points(const vector<vec3f> &points, float cell_size)
+    {
+        tree_points grid;
+        grid.cell_size = cell_size;
+        grid.shared = &points;
+        grid.ids.resize(points.size());
+        for (int i : range((int)points.size()))
+            grid.ids[i] = i;
+        std::sort(grid.ids.begin(), grid.ids.end(), [&grid, &points](int a, int b) {
+            vec3i ca = get_cell(grid, points[a]), cb = get_cell(grid, points[b]);
+            if (ca != cb)
+                return cell_less(ca, cb);
+            return a < b;
+        });
+        make_buckets(grid, grid.ids.size(), [&grid, &points](size_t i) { return points[grid.ids[i]]; });
+        return grid;
+    }
+
+    void kill_points(tree_points &points, vector<branch> &branches, float kill_range, int64_t *distances)
+    {
+        // points are already out of range of the branches checked before,
+        // so only the new ones are tested, against the buckets around them
+        vector<std::pair<int, int>> touched; // bucket and branch
+        for (int b = points.killed; b < (int)branches.size(); b++)
+        {
+            vec3f end = branches[b].end;
+            vec3i lo = get_cell(points, end - kill_range), hi = get_cell(points, end + kill_range);
+            for (int k = lo.z; k <= hi.z; k++)
+                for (int j = lo.y; j <= hi.y; j++)
+                    for (int i = lo.x; i <= hi.x; i++)
+                    {
+                        auto it = points.cells.find({i, j, k});
+                        if (it != points.cells.end() && points.buckets[it->second].size != 0)
+                            touched.push_back({it->second, b});
+                    }
+        }
+        points.killed = branches.size();
+        std::sort(touched.begin(), touched.end());
+
+        float kill_range2 = squared_range(kill_range);
+        int64_t count = 0;
+        tree_ends ends;
+        tree_lanes lanes;
+        for (size_t first = 0, last = 0; first < touched.size(); first = last)
+        {
+            tree_bucket &bucket = points.buckets[touched[first].first];
+            clear_ends(ends);
+            for (last = first; last < touched.size() && touched[last].first == touched[first].first; last++)
+                add_end(ends, branches[touched[last].second].end, touched[last].second);
+            pad_ends(ends);
+
+            // compacts the survivors in place, keeping their order
+            load_bucket(points, bucket, lanes);
+            size_t alive = 0;
+            for (size_t i = 0; i < bucket.size; i++)
+            {
+                if (any_within(ends, {lanes.x[i], lanes.y[i], lanes.z[i]}, kill_range, kill_range2, count))
+                    continue;
+                move_point(points, bucket.begin + i, bucket.begin + alive);
+                alive++;
+            }
+            points.count -= bucket.size - alive;
+            bucket.size = alive;
+        }
+        compact_points(points);
+        if (distances != nullptr)
+            *distances += count;
     }
 
     vec3f random_growth_vector(rng_state rng, float random_factor)
@@ -74,33 +767,122 @@ namespace yocto
     /* chooses the points that are attractors for each branch.
        Returns true if it finds at least one match
     */
-    bool choose_attractors(vector<vec3f> &points, vector<branch> &branches, float attraction_range)
+    bool choose_attractors(vector<vec3f> &points, vector<branch> &branches, float attraction_range, int64_t *distances)
     {
-        for (branch &b : branches)
-            b.attractors.clear();
+        if (distances != nullptr)
+            *distances += (int64_t)points.size() * branches.size();
+        tree_ends ends;
+        for (int i : range((int)branches.size()))
+        {
+            branches[i].attractors.clear();
+            add_end(ends, branches[i].end, i);
+        }
+        pad_ends(ends);
+        float attraction_range2 = squared_range(attraction_range);
         bool match_found = false;
         for (vec3f p : points)
         {
-            float min = 1.0 / 0.0;
-            branch *closest = NULL;
-            for (branch &b : branches)
-            {
-                float dist = distance(p, b.end);
-                if (dist < attraction_range && min > dist)
-                {
-                    closest = &b;
-                    min = dist;
-                }
-            }
-            if (closest != NULL)
+            int closest = find_closest(ends, p, attraction_range, attraction_range2);
+            if (closest >= 0)
             {
-                closest->attractors.push_back(p);
+                branches[closest].attractors.push_back(p);
                 match_found = true;
             }
         }
         return match_found;
     }
 
+    bool choose_attractors(tree_points &points, vector<branch> &branches, float attraction_range, int64_t *distances)
+    {
+        for (; points.indexed < (int)branches.size(); points.indexed++)
+            points.ends[get_cell(points, branches[points.indexed].end)].push_back(points.indexed);
+        for (branch &b : branches)
+            b.attractors.clear();
+
+        // closest branch of each point, with ties going to the first branch
+        // as in the full search
+        struct attractor
+        {
+            int branch, order;
+            vec3f position;
+        };
+        vector<attractor> matches;
+        tree_ends nearby; // branch ends around the current bucket
+        tree_lanes lanes;
+        int reach = (int)ceil(attraction_range / points.cell_size);
+        float attraction_range2 = squared_range(attraction_range);
+        int64_t count = 0;
+        for (tree_bucket &bucket : points.buckets)
+        {
+            if (bucket.size == 0)
+                continue;
+            clear_ends(nearby);
+            vec3i c = bucket.cell;
+            for (int k = c.z - reach; k <= c.z + reach; k++)
+                for (int j = c.y - reach; j <= c.y + reach; j++)
+                    for (int i = c.x - reach; i <= c.x + reach; i++)
+                    {
+                        auto it = points.ends.find({i, j, k});
+                        if (it == points.ends.end())
+                            continue;
+                        for (int b : it->second)
+                            add_end(nearby, branches[b].end, b);
+                    }
+            if (nearby.count == 0)
+                continue;
+            pad_ends(nearby);
+            count += (int64_t)bucket.size * nearby.count;
+            load_bucket(points, bucket, lanes);
+            for (size_t i = 0; i < bucket.size; i++)
+            {
+                vec3f p = {lanes.x[i], lanes.y[i], lanes.z[i]};
+                int closest = find_closest(nearby, p, attraction_range, attraction_range2);
+                if (closest >= 0)
+                    matches.push_back({closest, get_order(points, bucket.begin + i), p});
+            }
+        }
+        if (distances != nullptr)
+            *distances += count;
+
+        // attractors in the order of the points, as their directions are
+        // summed in order
+        std::sort(matches.begin(), matches.end(), [](const attractor &a, const attractor &b) {
+            return tie(a.branch, a.order) < tie(b.branch, b.order);
+        });
+        for (attractor &match : matches)
+            branches[match.branch].attractors.push_back(match.position);
+        return !matches.empty();
+    }
+
+    void pop_point(vector<vec3f> &points)
+    {
+        points.pop_back();
+    }
+
+    void pop_point(tree_points &points)
+    {
+        tree_bucket *last = nullptr;
+        for (tree_bucket &bucket : points.buckets)
+            if (bucket.size != 0 && (last == nullptr || get_order(points, bucket.begin + bucket.size - 1) >
+                                                            get_order(points, last->begin + last->size - 1)))
+                last = &bucket;
+        if (last == nullptr)
+            return;
+        last->size--;
+        points.count--;
+        compact_points(points);
+    }
+
+    static size_t count_points(const vector<vec3f> &points)
+    {
+        return points.size();
+    }
+
+    static size_t count_points(const tree_points &points)
+    {
+        return points.count;
+    }
+
     shape_data shape_from_branches(vector<branch> &branches)
     {
         shape_data sh;
@@ -153,4 +935,343 @@ namespace yocto
         }
         return leaves;
     }
+
+    double calc_branch_radius(vector<branch> &branches, branch &curr, double leaf_radius, double inverted_growth)
+    {
+        if (curr.children.empty())
+        {
+            curr.high_base_radius = leaf_radius;
+            return leaf_radius;
+        }
+        double sum = 0;
+        if (curr.children.size() == 1)
+            return curr.high_base_radius = calc_branch_radius(branches, branches[curr.children[0]], leaf_radius, inverted_growth);
+        for (int child : curr.children)
+        {
+            calc_branch_radius(branches, branches[child], leaf_radius, inverted_growth);
+            sum += std::pow(branches[child].high_base_radius, inverted_growth);
+        }
+        curr.high_base_radius = std::pow(sum, 1 / inverted_growth);
+        return curr.high_base_radius;
+    }
+
+    // grows the tree skeleton given the parameters and the sampled points,
+    // either in a vector or in buckets
+    template <typename Points>
+    static void grow_skeleton(Points &points, vector<branch> &branches, float branch_length, float kill_range, float attraction_range, rng_state rng, float random_factor, int iterations, tree_profile &profile, bool verbose)
+    {
+        vector<int> leaves = recalc_leaves(branches); // vector of indexes of the leave branches
+        int first = profile.iterations + 1, last = profile.iterations + iterations;
+        for (int iteration = first; iteration <= last; iteration++)
+        {
+            size_t num_points = count_points(points), num_branches = branches.size();
+            {
+                auto scope = tree_profile_scope{profile, "kill"};
+                kill_points(points, branches, kill_range, &profile.distances);
+            }
+            profile.killed += num_points - count_points(points);
+            profile.points = count_points(points);
+            // reset all attractors before recalculating them
+            if (count_points(points) == 0)
+                break;
+            bool attracted;
+            {
+                auto scope = tree_profile_scope{profile, "assign"};
+                attracted = choose_attractors(points, branches, attraction_range, &profile.distances);
+            }
+            {
+                auto scope = tree_profile_scope{profile, "grow"};
+                if (attracted)
+                {
+                    grow_towards_attractors(branches, branch_length, rng, random_factor);
+                    leaves = recalc_leaves(branches);
+                    pop_point(points); // stupid way to avoid "stuck" branches
+                }
+                else
+                {
+                    if (verbose)
+                        cout << "forward \n";
+                    grow_forward(branches, leaves, branch_length, rng, random_factor);
+                }
+            }
+            profile.added += branches.size() - num_branches;
+            profile.iterations = iteration;
+            profile.points = count_points(points);
+            profile.branches = branches.size();
+            sample_tree_profile(profile, iteration);
+            if (verbose)
+                cout << "iteration #" << iteration << " remaining points : " << count_points(points) << " branches : " << branches.size() << endl;
+        }
+    }
+
+    void grow_tree(vector<vec3f> &points, vector<branch> &branches, float branch_length, float kill_range, float attraction_range, rng_state rng, float random_factor, int iterations, tree_profile &profile, bool verbose)
+    {
+        grow_skeleton(points, branches, branch_length, kill_range, attraction_range, rng, random_factor, iterations, profile, verbose);
+    }
+
+    void grow_tree(tree_points &points, vector<branch> &branches, float branch_length, float kill_range, float attraction_range, rng_state rng, float random_factor, int iterations, tree_profile &profile, bool verbose)
+    {
+        grow_skeleton(points, branches, branch_length, kill_range, attraction_range, rng, random_factor, iterations, profile, verbose);
+    }
+
+    vector<branch> make_tree_root(float branch_length)
+    {
+        return {branch{{0, 0, 0}, {0, branch_length, 0}, -1}};
+    }
+
+    vector<branch> generate_tree(vector<vec3f> points, float branch_length, float kill_range, float attraction_range, rng_state rng, float random_factor, int iterations, tree_profile &profile, bool verbose)
+    {
+        vector<branch> branches = make_tree_root(branch_length);
+        grow_tree(points, branches, branch_length, kill_range, attraction_range, rng, random_factor, iterations, profile, verbose);
+        return branches;
+    }
+
+    vector<branch> generate_tree(tree_points &points, float branch_length, float kill_range, float attraction_range, rng_state rng, float random_factor, int iterations, tree_profile &profile, bool verbose)
+    {
+        vector<branch> branches = make_tree_root(branch_length);
+        grow_tree(points, branches, branch_length, kill_range, attraction_range, rng, random_factor, iterations, profile, verbose);
+        return branches;
+    }
+
+    vector<vec3f> get_tree_points(const tree_points &points)
+    {
+        vector<std::pair<int, vec3f>> sorted;
+        sorted.reserve(points.count);
+        for (const tree_bucket &bucket : points.buckets)
+            for (size_t i = 0; i < bucket.size; i++)
+                sorted.push_back({get_order(points, bucket.begin + i), get_position(points, bucket, i)});
+        std::sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) { return a.first < b.first; });
+        vector<vec3f> positions;
+        positions.reserve(sorted.size());
+        for (auto &[id, position] : sorted)
+            positions.push_back(position);
+        return positions;
+    }
+
+    shape_data lines_to_trunc_cones(const vector<branch> &branches, int steps)
+    {
+        auto shape = shape_data{};
+        for (int i : range(branches.size()))
+        {
+            const branch &b = branches[i];
+            float low_base_radius;
+
+            if (i == 0)
+                low_base_radius = b.high_base_radius;
+            else
+                low_base_radius = branches[b.parent_ind].high_base_radius;
+
+            auto cylinder = make_truncated_cone(low_base_radius, b.high_base_radius, 1, steps);
+            auto frame = frame_fromz((b.start + b.end) / 2,
+                                     b.start - b.end);
+            auto length = distance(b.start, b.end);
+            for (auto &position : cylinder.positions)
+                position = transform_point(frame, position * vec3f{1, 1, length / 2});
+            for (auto &normal : cylinder.normals)
+                normal = transform_direction(frame, normal);
+            merge_shape_inplace(shape, cylinder);
+        }
+
+        return shape;
+    }
+
+    shape_data make_sphere_mesh(vector<branch> branches, int sphere_steps)
+    {
+        shape_data acc{};
+        shape_data csph = quads_to_triangles(make_sphere(sphere_steps, 1));
+
+        for (branch &b : branches)
+        {
+            shape_data sph = {csph.points, csph.lines, csph.triangles, csph.quads, csph.positions};
+            for (vec3f &p2 : sph.positions)
+            {
+                p2 *= b.high_base_radius;
+                p2 += b.end;
+            }
+            merge_shape_inplace(acc, sph);
+        }
+        return acc;
+    }
+
+    string lod_filename(const string &filename, int level)
+    {
+        string extension = path_extension(filename);
+        return filename.substr(0, filename.size() - extension.size()) + "_lod" + std::to_string(level) + extension;
+    }
+
+    memory_usage compute_memory(const vector<branch> &branches)
+    {
+        memory_usage memory = vector_memory(branches);
+        for (const branch &b : branches)
+        {
+            memory += vector_memory(b.children);
+            memory += vector_memory(b.attractors);
+        }
+        return memory;
+    }
+
+    memory_usage compute_memory(const tree_points &points)
+    {
+        memory_usage memory = vector_memory(points.buckets);
+        memory += vector_memory(points.positions);
+        memory += vector_memory(points.qx);
+        memory += vector_memory(points.qy);
+        memory += vector_memory(points.qz);
+        memory += vector_memory(points.ids);
+        for (auto &[cell, ends] : points.ends)
+            memory += vector_memory(ends);
+        return memory;
+    }
+
+    // files closed on scope exit
+    using file_ptr = std::unique_ptr<FILE, int (*)(FILE *)>;
+
+    // checkpoint header, with the format version in the last character
+    static const char checkpoint_magic[8] = {'Y', 'T', 'R', 'E', 'E', 'C', 'P', '1'};
+
+    template <typename T>
+    static void write_values(FILE *f, const string &filename, const T *values, size_t count)
+    {
+        if (count != 0 && fwrite(values, sizeof(T), count, f) != count)
+            throw io_error{filename + ": write error"};
+    }
+
+    template <typename T>
+    static void read_values(FILE *f, const string &filename, T *values, size_t count)
+    {
+        if (count != 0 && fread(values, sizeof(T), count, f) != count)
+            throw io_error{filename + ": read error"};
+    }
+
+    template <typename T>
+    static void write_vector(FILE *f, const string &filename, const vector<T> &values)
+    {
+        uint64_t count = values.size();
+        write_values(f, filename, &count, 1);
+        write_values(f, filename, values.data(), values.size());
+    }
+
+    // bytes left to read in a file
+    static uint64_t bytes_left(FILE *f, const string &filename, uint64_t size)
+    {
+        long offset = ftell(f);
+        if (offset < 0 || (uint64_t)offset > size)
+            throw io_error{filename + ": read error"};
+        return size - (uint64_t)offset;
+    }
+
+    // reads a count of items of the given size, checking that the file holds them
+    static uint64_t read_count(FILE *f, const string &filename, uint64_t size, uint64_t item_size)
+    {
+        uint64_t count = 0;
+        read_values(f, filename, &count, 1);
+        if (count > bytes_left(f, filename, size) / item_size)
+            throw io_error{filename + ": corrupted tree checkpoint"};
+        return count;
+    }
+
+    template <typename T>
+    static void read_vector(FILE *f, const string &filename, uint64_t size, vector<T> &values)
+    {
+        values.resize(read_count(f, filename, size, sizeof(T)));
+        read_values(f, filename, values.data(), values.size());
+    }
+
+    void save_tree_checkpoint(const string &filename, const tree_checkpoint &checkpoint)
+    {
+        file_ptr fs = {fopen(filename.c_str(), "wb"), &fclose};
+        if (!fs)
+            throw io_error{filename + ": file not found"};
+        FILE *f = fs.get();
+        write_values(f, filename, checkpoint_magic, 8);
+        float params[4] = {checkpoint.branch_length, checkpoint.kill_range, checkpoint.attraction_range,
+                           checkpoint.random_factor};
+        write_values(f, filename, params, 4);
+        uint64_t rng[2] = {checkpoint.rng.state, checkpoint.rng.inc};
+        write_values(f, filename, rng, 2);
+        int32_t iterations = checkpoint.iterations;
+        write_values(f, filename, &iterations, 1);
+        uint64_t count = checkpoint.branches.size();
+        write_values(f, filename, &count, 1);
+        for (const branch &b : checkpoint.branches)
+        {
+            vec3f ends[2] = {b.start, b.end};
+            write_values(f, filename, ends, 2);
+            int32_t parent = b.parent_ind;
+            write_values(f, filename, &parent, 1);
+            write_vector(f, filename, b.children);
+        }
+        write_vector(f, filename, checkpoint.points);
+    }
+
+    tree_checkpoint load_tree_checkpoint(const string &filename)
+    {
+        file_ptr fs = {fopen(filename.c_str(), "rb"), &fclose};
+        if (!fs)
+            throw io_error{filename + ": file not found"};
+        FILE *f = fs.get();
+        if (fseek(f, 0, SEEK_END) != 0)
+            throw io_error{filename + ": read error"};
+        long size = ftell(f);
+        if (size < 0 || fseek(f, 0, SEEK_SET) != 0)
+            throw io_error{filename + ": read error"};
+        char magic[8];
+        read_values(f, filename, magic, 8);
+        if (memcmp(magic, checkpoint_magic, 8) != 0)
+            throw io_error{filename + ": not a tree checkpoint"};
+        tree_checkpoint checkpoint;
+        float params[4];
+        read_values(f, filename, params, 4);
+        for (float param : params)
+            if (!std::isfinite(param))
+                throw io_error{filename + ": corrupted tree checkpoint"};
+        if (!(params[2] > params[1] && params[1] > params[0] && params[0] > 0))
+            throw io_error{filename + ": corrupted tree checkpoint"};
+        checkpoint.branch_length = params[0];
+        checkpoint.kill_range = params[1];
+        checkpoint.attraction_range = params[2];
+        checkpoint.random_factor = params[3];
+        uint64_t rng[2];
+        read_values(f, filename, rng, 2);
+        checkpoint.rng = {rng[0], rng[1]};
+        int32_t iterations;
+        read_values(f, filename, &iterations, 1);
+        checkpoint.iterations = iterations;
+        if (iterations < 0)
+            throw io_error{filename + ": corrupted tree checkpoint"};
+
+        // each branch takes its ends, its parent and the count of its children
+        uint64_t count = read_count(f, filename, size, sizeof(vec3f) * 2 + sizeof(int32_t) + sizeof(uint64_t));
+        if (count == 0)
+            throw io_error{filename + ": empty tree checkpoint"};
+        if (count > (uint64_t)std::numeric_limits<int>::max())
+            throw io_error{filename + ": corrupted tree checkpoint"};
+        checkpoint.branches.resize(count);
+        for (size_t i = 0; i < checkpoint.branches.size(); i++)
+        {
+            branch &b = checkpoint.branches[i];
+            vec3f ends[2];
+            read_values(f, filename, ends, 2);
+            b.start = ends[0];
+            b.end = ends[1];
+            int32_t parent;
+            read_values(f, filename, &parent, 1);
+            b.parent_ind = parent;
+            b.high_base_radius = 0;
+            read_vector(f, filename, size, b.children);
+            // the root comes first, and parents before their children
+            if (parent < -1 || parent >= (int64_t)i || (parent == -1) != (i == 0))
+                throw io_error{filename + ": corrupted tree checkpoint"};
+            for (int child : b.children)
+                if (child <= 0 || (uint64_t)child >= count)
+                    throw io_error{filename + ": corrupted tree checkpoint"};
+        }
+        // children should point back to their parents, so that the tree has no cycles
+        for (size_t i = 0; i < checkpoint.branches.size(); i++)
+            for (int child : checkpoint.branches[i].children)
+                if (checkpoint.branches[child].parent_ind != (int)i)
+                    throw io_error{filename + ": corrupted tree checkpoint"};
+        read_vector(f, filename, size, checkpoint.points);
+        return checkpoint;
+    }
 }
@@ -8,6 +8,7 @@
 #include <yocto/yocto_sceneio.h>
 #include <yocto/yocto_math.h>
 #include <yocto/yocto_geometry.h>
+#include <yocto/tree_profile.h>
 
 namespace yocto
 {
@@ -26,11 +27,64 @@ namespace yocto
 		vec3f direction();
 	};
 
+	// the points of a grid cell, a range of the points of the grid that keeps
+	// the points left at its start
+	struct tree_bucket
+	{
+		vec3i cell;
+		size_t begin = 0; // first point in the grid
+		size_t size = 0;  // points left
+	};
+
+	/*
+	 attraction points sorted by the cells of a sparse grid, so that growth
+	 only visits the points around the branch ends. Buckets are compacted in
+	 place when points are killed, and the points give back their memory
+	 once half of them are killed.
+	 The grid also tracks the branches of the tree it grows
+	*/
+	struct tree_points
+	{
+		float cell_size = 1;
+		bool quantized = false;
+		const vector<vec3f> *shared = nullptr; // input positions, in shared grids
+		vector<vec3f> positions;			   // points, by cell
+		vector<uint16_t> qx, qy, qz;		   // positions from the cell origin, in quantized grids
+		vector<int> ids;					   // indexes of the points, in shared grids
+		vector<tree_bucket> buckets;		   // in the order of their points
+		unordered_map<vec3i, int> cells;	   // bucket of each cell
+		size_t count = 0;					   // points left
+		unordered_map<vec3i, vector<int>> ends; // branches by the cell of their end
+		int indexed = 0;					   // branches added to ends
+		int killed = 0;						   // branches that killed their points
+	};
+
+	/* sorts the points in place by cells of cell_size, and keeps them in
+	   the grid, so that the grid takes the memory of the points.
+	   Trees grow as on the points in the order of get_tree_points.
+	   Quantized points take half the memory, and are snapped to 1/65535 of
+	   a cell, so the tree may differ slightly from the one grown on the
+	   original points
+	*/
+	tree_points make_tree_points(vector<vec3f> &&points, float cell_size, bool quantized = false);
+	/* sorts the ids of points that stay shared, read-only, with other
+	   grids, so that trees can grow on the same points at the same time.
+	   Trees grow as on the points in input order.
+	   The points should outlive the grid
+	*/
+	tree_points make_tree_points(const vector<vec3f> &points, float cell_size);
+
+	// position of the i-th point of a bucket
+	vec3f get_position(const tree_points &points, const tree_bucket &bucket, size_t i);
+
 	/*
 	 removes the points which are in kill_range from a branch
-	 (points that are too close to a branch.end)
+	 (points that are too close to a branch.end).
+	 The number of distances computed is added to distances, if given
 	*/
-	void kill_points(vector<vec3f> &points, vector<branch> &branches, float kill_range);
+	void kill_points(vector<vec3f> &points, vector<branch> &branches, float kill_range, int64_t *distances = nullptr);
+	// same, only checking the branches added since the last call
+	void kill_points(tree_points &points, vector<branch> &branches, float kill_range, int64_t *distances = nullptr);
 
 	void merge_shape_inplace(shape_data &shape, const shape_data &merge);
 
@@ -41,13 +95,82 @@ namespace yocto
 	 */
 	void grow_forward(vector<branch> &branches, vector<int> &leaves, float branch_length, rng_state rng, float random_factor);
 	/* chooses the points that are attractors for each branch.
-	   Returns true if it finds at least one match
+	   Returns true if it finds at least one match.
+	   The number of distances computed is added to distances, if given
 	*/
-	bool choose_attractors(vector<vec3f> &points, vector<branch> &branches, float attraction_range);
+	bool choose_attractors(vector<vec3f> &points, vector<branch> &branches, float attraction_range, int64_t *distances = nullptr);
+	// same, only checking the branches in the cells around each point
+	bool choose_attractors(tree_points &points, vector<branch> &branches, float attraction_range, int64_t *distances = nullptr);
+
+	// removes the point that comes last in the order of the points
+	void pop_point(vector<vec3f> &points);
+	void pop_point(tree_points &points);
 
 	shape_data shape_from_branches(vector<branch> &branches);
 
 	void grow_towards_attractors(vector<branch> &branches, float branch_length, rng_state rng, float random_factor);
 
 	vector<int> recalc_leaves(vector<branch> &branches);
+
+	/* grows the skeleton from the root towards the points, until no points
+	   are left or the given number of iterations is reached.
+	   Phases and counters are recorded in profile
+	*/
+	vector<branch> generate_tree(vector<vec3f> points, float branch_length, float kill_range, float attraction_range, rng_state rng, float random_factor, int iterations, tree_profile &profile, bool verbose = false);
+	/* same, on bucketed points, that should have cells of attraction_range.
+	   Grows the same tree, in time and memory bounded by the points around
+	   the branches
+	*/
+	vector<branch> generate_tree(tree_points &points, float branch_length, float kill_range, float attraction_range, rng_state rng, float random_factor, int iterations, tree_profile &profile, bool verbose = false);
+
+	// the first branch of a tree, from the origin upwards
+	vector<branch> make_tree_root(float branch_length);
+
+	/* continues the growth of branches for up to the given iterations,
+	   removing the reached points, so that growth can be checkpointed
+	   and resumed. Iterations are counted from profile.iterations
+	*/
+	void grow_tree(vector<vec3f> &points, vector<branch> &branches, float branch_length, float kill_range, float attraction_range, rng_state rng, float random_factor, int iterations, tree_profile &profile, bool verbose = false);
+	void grow_tree(tree_points &points, vector<branch> &branches, float branch_length, float kill_range, float attraction_range, rng_state rng, float random_factor, int iterations, tree_profile &profile, bool verbose = false);
+
+	// the points left in a grid, in the order they grow the tree
+	vector<vec3f> get_tree_points(const tree_points &points);
+
+	// sets the radius of curr and its subtree, with leaf_radius at the leaves
+	double calc_branch_radius(vector<branch> &branches, branch &curr, double leaf_radius, double inverted_growth);
+
+	// a truncated cone for each branch
+	shape_data lines_to_trunc_cones(const vector<branch> &branches, int steps);
+
+	// a sphere at the end of each branch, to join the cones
+	shape_data make_sphere_mesh(vector<branch> branches, int sphere_steps);
+
+	// name of a level of detail, as "tree_lod1.ply" for "tree.ply"
+	string lod_filename(const string &filename, int level);
+
+	// memory held by the skeleton, with the children and attractors of each branch
+	memory_usage compute_memory(const vector<branch> &branches);
+	// memory held by the points and the buckets, without the hash maps
+	// overhead and the shared points
+	memory_usage compute_memory(const tree_points &points);
+
+	// the state of a growth, to resume it later: the growth parameters,
+	// the skeleton and the points left, in input order
+	struct tree_checkpoint
+	{
+		float branch_length = 0.2f;
+		float kill_range = 0.5f;
+		float attraction_range = 1.0f;
+		float random_factor = 0.0f;
+		rng_state rng = {};
+		int iterations = 0; // iterations run
+		vector<branch> branches;
+		vector<vec3f> points;
+	};
+
+	/* saves and loads checkpoints in a binary format, in native byte order.
+	   Attractors and radii are not saved, since they are recomputed
+	*/
+	void save_tree_checkpoint(const string &filename, const tree_checkpoint &checkpoint);
+	tree_checkpoint load_tree_checkpoint(const string &filename);
 }
\ No newline at end of file
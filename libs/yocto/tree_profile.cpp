@@ -0,0 +1,180 @@
+#include <cstdio>
+#include <memory>
+#include <yocto/yocto_sceneio.h>
+#include <yocto/tree_profile.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace yocto
+{
+	tree_profile_scope::tree_profile_scope(tree_profile &profile, const string &name)
+	{
+		if (!profile.enabled)
+			return;
+		this->profile = &profile;
+		for (int i = 0; i < (int)profile.phases.size(); i++)
+			if (profile.phases[i].name == name)
+				phase = i;
+		if (phase < 0)
+		{
+			phase = profile.phases.size();
+			profile.phases.push_back({name});
+		}
+		start = elapsed_nanoseconds(profile.timer);
+	}
+
+	tree_profile_scope::~tree_profile_scope()
+	{
+		if (profile == nullptr)
+			return;
+		int64_t duration = elapsed_nanoseconds(profile->timer) - start;
+		profile->phases[phase].nanoseconds += duration;
+		profile->phases[phase].calls += 1;
+		profile->events.push_back({phase, start, duration});
+	}
+
+	size_t get_peak_memory()
+	{
+#if defined(__APPLE__)
+		rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+			return 0;
+		return (size_t)usage.ru_maxrss; // bytes
+#elif defined(__unix__)
+		rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+			return 0;
+		return (size_t)usage.ru_maxrss * 1024; // kilobytes
+#else
+		return 0;
+#endif
+	}
+
+	void sample_tree_profile(tree_profile &profile, int iteration)
+	{
+		if (!profile.enabled)
+			return;
+		if (iteration >= 0 && (profile.sample_interval <= 0 || iteration % profile.sample_interval != 0))
+			return;
+		profile.peak_memory = get_peak_memory();
+		tree_sample sample = {iteration, elapsed_nanoseconds(profile.timer), profile.points, profile.branches,
+							  profile.killed, profile.added, profile.distances, profile.peak_memory};
+		for (tree_phase &phase : profile.phases)
+			sample.phases.push_back(phase.nanoseconds);
+		profile.samples.push_back(sample);
+	}
+
+	// files closed on scope exit
+	using file_ptr = std::unique_ptr<FILE, int (*)(FILE *)>;
+
+	static file_ptr open_profile_file(const string &filename)
+	{
+		file_ptr fs = {fopen(filename.c_str(), "w"), &fclose};
+		if (!fs)
+			throw io_error{filename + ": file not found"};
+		return fs;
+	}
+
+	// counters of a sample minus the ones of the previous sample
+	static tree_sample sample_delta(const tree_profile &profile, int index)
+	{
+		tree_sample delta = profile.samples[index];
+		if (index > 0)
+		{
+			const tree_sample &previous = profile.samples[index - 1];
+			delta.killed -= previous.killed;
+			delta.added -= previous.added;
+			delta.distances -= previous.distances;
+		}
+		return delta;
+	}
+
+	void save_tree_profile(const string &filename, const tree_profile &profile)
+	{
+		file_ptr fs = open_profile_file(filename);
+		FILE *f = fs.get();
+		auto seconds = [](int64_t nanoseconds) { return nanoseconds * 1e-9; };
+
+		if (path_extension(filename) == ".csv")
+		{
+			fprintf(f, "iteration,seconds,points,branches,killed,added,distances,peak_memory");
+			for (const tree_phase &phase : profile.phases)
+				fprintf(f, ",%s", phase.name.c_str());
+			fprintf(f, "\n");
+			for (int s = 0; s < (int)profile.samples.size(); s++)
+			{
+				const tree_sample &sample = profile.samples[s];
+				tree_sample delta = sample_delta(profile, s);
+				fprintf(f, "%d,%.6f,%zu,%zu,%lld,%lld,%lld,%zu", sample.iteration, seconds(sample.time),
+						sample.points, sample.branches, (long long)delta.killed, (long long)delta.added,
+						(long long)delta.distances, sample.peak_memory);
+				for (int i = 0; i < (int)profile.phases.size(); i++)
+					fprintf(f, ",%.6f", i < (int)sample.phases.size() ? seconds(sample.phases[i]) : 0.0);
+				fprintf(f, "\n");
+			}
+		}
+		else
+		{
+			fprintf(f, "{\n");
+			fprintf(f, "  \"seconds\": %.6f,\n", seconds(elapsed_nanoseconds(profile.timer)));
+			fprintf(f, "  \"counters\": {\"distances\": %lld, \"killed\": %lld, \"added\": %lld},\n",
+					(long long)profile.distances, (long long)profile.killed, (long long)profile.added);
+			fprintf(f, "  \"peak_memory\": %zu,\n", profile.peak_memory);
+			fprintf(f, "  \"phases\": [");
+			for (int i = 0; i < (int)profile.phases.size(); i++)
+			{
+				const tree_phase &phase = profile.phases[i];
+				fprintf(f, "%s\n    {\"name\": \"%s\", \"seconds\": %.6f, \"calls\": %lld}", i ? "," : "",
+						phase.name.c_str(), seconds(phase.nanoseconds), (long long)phase.calls);
+			}
+			fprintf(f, "\n  ],\n");
+			fprintf(f, "  \"samples\": [");
+			for (int i = 0; i < (int)profile.samples.size(); i++)
+			{
+				const tree_sample &sample = profile.samples[i];
+				tree_sample delta = sample_delta(profile, i);
+				fprintf(f, "%s\n    {\"iteration\": %d, \"seconds\": %.6f, \"points\": %zu, \"branches\": %zu, "
+						   "\"killed\": %lld, \"added\": %lld, \"distances\": %lld, \"peak_memory\": %zu}",
+						i ? "," : "", sample.iteration, seconds(sample.time), sample.points, sample.branches,
+						(long long)delta.killed, (long long)delta.added, (long long)delta.distances,
+						sample.peak_memory);
+			}
+			fprintf(f, "\n  ]\n}\n");
+		}
+		if (ferror(f))
+			throw io_error{filename + ": write error"};
+	}
+
+	void save_tree_trace(const string &filename, const tree_profile &profile)
+	{
+		file_ptr fs = open_profile_file(filename);
+		FILE *f = fs.get();
+		auto micros = [](int64_t nanoseconds) { return nanoseconds * 1e-3; };
+
+		// complete events for phases, counter events for samples
+		fprintf(f, "{\"traceEvents\": [");
+		bool first = true;
+		for (const tree_event &event : profile.events)
+		{
+			fprintf(f, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 0, \"tid\": 0}",
+					first ? "" : ",", profile.phases[event.phase].name.c_str(), micros(event.start),
+					micros(event.duration));
+			first = false;
+		}
+		for (const tree_sample &sample : profile.samples)
+		{
+			fprintf(f, "%s\n{\"name\": \"growth\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 0, \"tid\": 0, "
+					   "\"args\": {\"points\": %zu, \"branches\": %zu}}",
+					first ? "" : ",", micros(sample.time), sample.points, sample.branches);
+			fprintf(f, ",\n{\"name\": \"memory\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 0, \"tid\": 0, "
+					   "\"args\": {\"peak_memory\": %zu}}",
+					micros(sample.time), sample.peak_memory);
+			first = false;
+		}
+		fprintf(f, "\n], \"displayTimeUnit\": \"ms\"}\n");
+		if (ferror(f))
+			throw io_error{filename + ": write error"};
+	}
+}
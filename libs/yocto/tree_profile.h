@@ -0,0 +1,92 @@
+#ifndef _TREE_PROFILE_H_
+#define _TREE_PROFILE_H_
+
+#include <string>
+#include <vector>
+#include <yocto/yocto_cli.h>
+
+namespace yocto
+{
+	using std::string;
+	using std::vector;
+
+	// total time spent in a phase of the tree generator
+	struct tree_phase
+	{
+		string name;
+		int64_t nanoseconds = 0;
+		int64_t calls = 0;
+	};
+
+	// one timed run of a phase, in nanoseconds from the start of the profile
+	struct tree_event
+	{
+		int phase;
+		int64_t start, duration;
+	};
+
+	// counters sampled during growth, as running totals. The last sample,
+	// taken at the end of the run, has iteration -1.
+	struct tree_sample
+	{
+		int iteration;
+		int64_t time;
+		size_t points, branches;
+		int64_t killed, added, distances;
+		size_t peak_memory;
+		vector<int64_t> phases; // time spent in each phase so far
+	};
+
+	// per-phase timers, counters and peak-memory samples of a generator run.
+	// Counters are always updated, while timers and samples are recorded
+	// only when enabled, so that a disabled profile costs nothing.
+	struct tree_profile
+	{
+		bool enabled = false;
+		int sample_interval = 1; // iterations between samples, 0 for none
+		simple_timer timer = {};
+		vector<tree_phase> phases = {};
+		vector<tree_event> events = {};
+		vector<tree_sample> samples = {};
+
+		// current state of the growth
+		int iterations = 0;	 // iterations run
+		size_t points = 0;	 // attractors left
+		size_t branches = 0; // branches grown
+
+		// running totals
+		int64_t distances = 0; // point-branch distance evaluations
+		int64_t killed = 0;	   // attractors removed by kill_points
+		int64_t added = 0;	   // branches added by growth
+		size_t peak_memory = 0;
+	};
+
+	// times a phase from construction to destruction
+	struct tree_profile_scope
+	{
+		tree_profile_scope(tree_profile &profile, const string &name);
+		~tree_profile_scope();
+
+		tree_profile *profile = nullptr;
+		int phase = -1;
+		int64_t start = 0;
+	};
+
+	// peak resident memory of the process in bytes, 0 if not available
+	size_t get_peak_memory();
+
+	// records a sample if the iteration falls on the sampling interval, or
+	// always for the final sample with iteration -1
+	void sample_tree_profile(tree_profile &profile, int iteration);
+
+	// saves the phase totals, counters and samples as Json, or the samples
+	// as Csv, with one cumulative time column per phase, by file extension.
+	// Samples report killed, added and distances since the previous sample.
+	void save_tree_profile(const string &filename, const tree_profile &profile);
+
+	// saves the timed phases and the sampled counters as a Chrome trace,
+	// to be opened in chrome://tracing or Perfetto
+	void save_tree_trace(const string &filename, const tree_profile &profile);
+}
+
+#endif
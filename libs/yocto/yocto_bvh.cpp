@@ -43,6 +43,7 @@
 #include <utility>
 
 #include "yocto_geometry.h"
+#include "yocto_parallel.h"
 
 #ifdef YOCTO_EMBREE
 #include <embree3/rtcore.h>
@@ -65,40 +66,6 @@ inline const auto uint_max = std::numeric_limits<unsigned int>::max();
 
 }  // namespace yocto
 
-// -----------------------------------------------------------------------------
-// PARALLEL HELPERS
-// -----------------------------------------------------------------------------
-namespace yocto {
-
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the integer index.
-template <typename T, typename Func>
-inline void parallel_for(T num, Func&& func) {
-  auto              futures  = vector<std::future<void>>{};
-  auto              nthreads = std::thread::hardware_concurrency();
-  std::atomic<T>    next_idx(0);
-  std::atomic<bool> has_error(false);
-  for (auto thread_id = 0; thread_id < (int)nthreads; thread_id++) {
-    futures.emplace_back(
-        std::async(std::launch::async, [&func, &next_idx, &has_error, num]() {
-          try {
-            while (true) {
-              auto idx = next_idx.fetch_add(1);
-              if (idx >= num) break;
-              if (has_error) break;
-              func(idx);
-            }
-          } catch (...) {
-            has_error = true;
-            throw;
-          }
-        }));
-  }
-  for (auto& f : futures) f.get();
-}
-
-}  // namespace yocto
-
 // -----------------------------------------------------------------------------
 // IMPLEMENTATION FOR BVH BUILD
 // -----------------------------------------------------------------------------
@@ -363,17 +330,25 @@ shape_bvh make_shape_bvh(const shape_data& shape, bool highquality) {
 
 scene_bvh make_scene_bvh(
     const scene_data& scene, bool highquality, bool noparallel) {
+  return make_scene_bvh(scene, {}, highquality, noparallel);
+}
+
+scene_bvh make_scene_bvh(const scene_data& scene, vector<shape_bvh>&& shapes,
+    bool highquality, bool noparallel) {
   // bvh
-  auto sbvh = scene_bvh{};
+  auto sbvh   = scene_bvh{};
+  sbvh.shapes = std::move(shapes);
 
-  // build shape bvh
+  // build missing shape bvh
   sbvh.shapes.resize(scene.shapes.size());
   if (noparallel) {
     for (auto idx : range(scene.shapes.size())) {
+      if (!sbvh.shapes[idx].bvh.nodes.empty()) continue;
       sbvh.shapes[idx] = make_shape_bvh(scene.shapes[idx], highquality);
     }
   } else {
     parallel_for(scene.shapes.size(), [&](size_t idx) {
+      if (!sbvh.shapes[idx].bvh.nodes.empty()) return;
       sbvh.shapes[idx] = make_shape_bvh(scene.shapes[idx], highquality);
     });
   }
@@ -450,6 +425,17 @@ void update_scene_bvh(scene_bvh& sbvh, const scene_data& scene,
   refit_bvh(sbvh.bvh, bboxes);
 }
 
+// Memory used by bvhs
+memory_usage compute_memory(const shape_bvh& bvh) {
+  return compute_memory(bvh.bvh);
+}
+memory_usage compute_memory(const scene_bvh& bvh) {
+  auto memory = compute_memory(bvh.bvh);
+  memory += vector_memory(bvh.shapes);
+  for (auto& shape : bvh.shapes) memory += compute_memory(shape);
+  return memory;
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -457,8 +443,12 @@ void update_scene_bvh(scene_bvh& sbvh, const scene_data& scene,
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-shape_intersection intersect_shape_bvh(const shape_bvh& sbvh,
-    const shape_data& shape, const ray3f& ray_, bool find_any) {
+// Intersect a shape, skipping the hits rejected by `filter`, which takes the
+// element index and uv. Rejected hits do not shorten the ray.
+template <typename Filter>
+static shape_intersection intersect_shape_bvh(const shape_bvh& sbvh,
+    const shape_data& shape, const ray3f& ray_, bool find_any,
+    Filter&& filter) {
   // get bvh tree
   auto& bvh = sbvh.bvh;
 
@@ -508,6 +498,7 @@ shape_intersection intersect_shape_bvh(const shape_bvh& sbvh,
         auto  pintersection = intersect_point(
              ray, shape.positions[p], shape.radius[p]);
         if (!pintersection.hit) continue;
+        if (!filter(bvh.primitives[idx], pintersection.uv)) continue;
         intersection = {bvh.primitives[idx], pintersection.uv,
             pintersection.distance, true};
         ray.tmax     = pintersection.distance;
@@ -515,9 +506,15 @@ shape_intersection intersect_shape_bvh(const shape_bvh& sbvh,
     } else if (!shape.lines.empty()) {
       for (auto idx = node.start; idx < node.start + node.num; idx++) {
         auto& l             = shape.lines[bvh.primitives[idx]];
-        auto  pintersection = intersect_line(ray, shape.positions[l.x],
-             shape.positions[l.y], shape.radius[l.x], shape.radius[l.y]);
+        auto  pintersection =
+            shape.capsules ? intersect_capsule(ray, shape.positions[l.x],
+                                 shape.positions[l.y], shape.radius[l.x],
+                                 shape.radius[l.y])
+                           : intersect_line(ray, shape.positions[l.x],
+                                 shape.positions[l.y], shape.radius[l.x],
+                                 shape.radius[l.y]);
         if (!pintersection.hit) continue;
+        if (!filter(bvh.primitives[idx], pintersection.uv)) continue;
         intersection = {bvh.primitives[idx], pintersection.uv,
             pintersection.distance, true};
         ray.tmax     = pintersection.distance;
@@ -528,6 +525,7 @@ shape_intersection intersect_shape_bvh(const shape_bvh& sbvh,
         auto  pintersection = intersect_triangle(ray, shape.positions[t.x],
              shape.positions[t.y], shape.positions[t.z]);
         if (!pintersection.hit) continue;
+        if (!filter(bvh.primitives[idx], pintersection.uv)) continue;
         intersection = {bvh.primitives[idx], pintersection.uv,
             pintersection.distance, true};
         ray.tmax     = pintersection.distance;
@@ -538,6 +536,7 @@ shape_intersection intersect_shape_bvh(const shape_bvh& sbvh,
         auto  pintersection = intersect_quad(ray, shape.positions[q.x],
              shape.positions[q.y], shape.positions[q.z], shape.positions[q.w]);
         if (!pintersection.hit) continue;
+        if (!filter(bvh.primitives[idx], pintersection.uv)) continue;
         intersection = {bvh.primitives[idx], pintersection.uv,
             pintersection.distance, true};
         ray.tmax     = pintersection.distance;
@@ -551,8 +550,30 @@ shape_intersection intersect_shape_bvh(const shape_bvh& sbvh,
   return intersection;
 }
 
+shape_intersection intersect_shape_bvh(const shape_bvh& sbvh,
+    const shape_data& shape, const ray3f& ray, bool find_any) {
+  return intersect_shape_bvh(
+      sbvh, shape, ray, find_any, [](int, const vec2f&) { return true; });
+}
+
+// Intersect an instance shape, alpha testing hits if requested
+static shape_intersection intersect_instance_shape_bvh(const scene_bvh& sbvh,
+    const scene_data& scene, const instance_data& instance, const ray3f& ray,
+    bool find_any, bool alphatest) {
+  auto& bvh   = sbvh.shapes[instance.shape];
+  auto& shape = scene.shapes[instance.shape];
+  if (!alphatest || !is_alphatested(scene, instance)) {
+    return intersect_shape_bvh(bvh, shape, ray, find_any);
+  }
+  return intersect_shape_bvh(
+      bvh, shape, ray, find_any, [&](int element, const vec2f& uv) {
+        return eval_opacity(scene, instance, element, uv) > 0;
+      });
+}
+
 scene_intersection intersect_scene_bvh(const scene_bvh& sbvh,
-    const scene_data& scene, const ray3f& ray_, bool find_any) {
+    const scene_data& scene, const ray3f& ray_, bool find_any,
+    bool alphatest) {
   // get instances bvh
   auto& bvh = sbvh.bvh;
 
@@ -600,8 +621,8 @@ scene_intersection intersect_scene_bvh(const scene_bvh& sbvh,
       for (auto idx = node.start; idx < node.start + node.num; idx++) {
         auto& instance_ = scene.instances[bvh.primitives[idx]];
         auto  inv_ray   = transform_ray(inverse(instance_.frame, true), ray);
-        auto  sintersection = intersect_shape_bvh(sbvh.shapes[instance_.shape],
-             scene.shapes[instance_.shape], inv_ray, find_any);
+        auto  sintersection = intersect_instance_shape_bvh(
+             sbvh, scene, instance_, inv_ray, find_any, alphatest);
         if (!sintersection.hit) continue;
         intersection = {bvh.primitives[idx], sintersection.element,
             sintersection.uv, sintersection.distance, true};
@@ -617,11 +638,12 @@ scene_intersection intersect_scene_bvh(const scene_bvh& sbvh,
 }
 
 scene_intersection intersect_instance_bvh(const scene_bvh& sbvh,
-    const scene_data& scene, int instance_, const ray3f& ray, bool find_any) {
+    const scene_data& scene, int instance_, const ray3f& ray, bool find_any,
+    bool alphatest) {
   auto& instance     = scene.instances[instance_];
   auto  inv_ray      = transform_ray(inverse(instance.frame, true), ray);
-  auto  intersection = intersect_shape_bvh(sbvh.shapes[instance.shape],
-       scene.shapes[instance.shape], inv_ray, find_any);
+  auto  intersection = intersect_instance_shape_bvh(
+       sbvh, scene, instance, inv_ray, find_any, alphatest);
   if (!intersection.hit) return {};
   return {instance_, intersection.element, intersection.uv,
       intersection.distance, true};
@@ -82,12 +82,20 @@ struct scene_bvh {
 shape_bvh make_shape_bvh(const shape_data& shape, bool highquality = false);
 scene_bvh make_scene_bvh(
     const scene_data& scene, bool highquality = false, bool noparallel = false);
+// Build the scene bvh reusing shape bvhs that are already built, for example
+// while the scene was loading. Missing shape bvhs are built here.
+scene_bvh make_scene_bvh(const scene_data& scene, vector<shape_bvh>&& shapes,
+    bool highquality = false, bool noparallel = false);
 
 // Refit bvh data
 void update_shape_bvh(shape_bvh& bvh, const shape_data& shape);
 void update_scene_bvh(scene_bvh& bvh, const scene_data& scene,
     const vector<int>& updated_instances, const vector<int>& updated_shapes);
 
+// Memory used by bvhs, with the shape bvhs included in the scene one.
+memory_usage compute_memory(const shape_bvh& bvh);
+memory_usage compute_memory(const scene_bvh& bvh);
+
 // Results of intersect_xxx and overlap_xxx functions that include hit flag,
 // instance id, shape element id, shape element uv and intersection distance.
 // The values are all set for scene intersection. Shape intersection does not
@@ -104,13 +112,16 @@ struct scene_intersection {
 // Intersect ray with a bvh returning either the first or any intersection
 // depending on `find_any`. Returns the ray distance , the instance id,
 // the shape element index and the element barycentric coordinates.
+// With `alphatest`, scene queries skip hits on fully transparent texels,
+// as given by material opacity, color texture alpha and shape colors alpha.
 shape_intersection intersect_shape_bvh(const shape_bvh& bvh,
     const shape_data& shape, const ray3f& ray, bool find_any = false);
 scene_intersection intersect_scene_bvh(const scene_bvh& bvh,
-    const scene_data& scene, const ray3f& ray, bool find_any = false);
+    const scene_data& scene, const ray3f& ray, bool find_any = false,
+    bool alphatest = false);
 scene_intersection intersect_instance_bvh(const scene_bvh& bvh,
     const scene_data& scene, int instance, const ray3f& ray,
-    bool find_any = false);
+    bool find_any = false, bool alphatest = false);
 
 // Find a shape element that overlaps a point within a given distance
 // max distance, returning either the closest or any overlap depending on
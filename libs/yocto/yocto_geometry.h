@@ -252,6 +252,14 @@ inline vec3f triangle_point(
 inline vec3f triangle_normal(
     const vec3f& n0, const vec3f& n1, const vec3f& n2, const vec2f& uv);
 
+// Interpolated tapered capsule properties. The capsule is the convex hull
+// of two spheres. uv.y is the angle around the axis, while uv.x is in [0, 1]
+// along the cone, in [-1, 0) on the first cap and in (1, 2] on the second.
+inline vec3f capsule_point(const vec3f& p0, const vec3f& p1, float r0,
+    float r1, const vec2f& uv);
+inline vec3f capsule_normal(const vec3f& p0, const vec3f& p1, float r0,
+    float r1, const vec2f& uv);
+
 // Interpolated quad properties.
 inline vec3f quad_point(const vec3f& p0, const vec3f& p1, const vec3f& p2,
     const vec3f& p3, const vec2f& uv);
@@ -295,6 +303,12 @@ inline prim_intersection intersect_point(
 inline prim_intersection intersect_line(
     const ray3f& ray, const vec3f& p0, const vec3f& p1, float r0, float r1);
 
+// Intersect a ray with a tapered capsule, i.e. the convex hull of two
+// spheres. The returned uv can be used with `capsule_point()` and
+// `capsule_normal()`.
+inline prim_intersection intersect_capsule(
+    const ray3f& ray, const vec3f& p0, const vec3f& p1, float r0, float r1);
+
 // Intersect a ray with a triangle
 inline prim_intersection intersect_triangle(
     const ray3f& ray, const vec3f& p0, const vec3f& p1, const vec3f& p2);
@@ -588,6 +602,28 @@ inline vec3f triangle_normal(
   return normalize(n0 * (1 - uv.x - uv.y) + n1 * uv.x + n2 * uv.y);
 }
 
+// Interpolated tapered capsule properties.
+inline vec3f capsule_normal(const vec3f& p0, const vec3f& p1, float r0,
+    float r1, const vec2f& uv) {
+  auto len    = length(p1 - p0);
+  auto basis  = basis_fromz(len > 0 ? (p1 - p0) / len : vec3f{0, 0, 1});
+  auto beta   = asin(
+      clamp(len > 0 ? (r0 - r1) / len : sign(r0 - r1), -1.0f, 1.0f));
+  auto phi    = 2 * pif * uv.y;
+  auto radial = basis.x * cos(phi) + basis.y * sin(phi);
+  auto elev   = beta;
+  if (uv.x < 0) elev = beta + uv.x * (beta + pif / 2);
+  if (uv.x > 1) elev = beta + (uv.x - 1) * (pif / 2 - beta);
+  return radial * cos(elev) + basis.z * sin(elev);
+}
+inline vec3f capsule_point(const vec3f& p0, const vec3f& p1, float r0,
+    float r1, const vec2f& uv) {
+  auto normal = capsule_normal(p0, p1, r0, r1, uv);
+  if (uv.x < 0) return p0 + normal * r0;
+  if (uv.x > 1) return p1 + normal * r1;
+  return (p0 + normal * r0) * (1 - uv.x) + (p1 + normal * r1) * uv.x;
+}
+
 // Interpolated quad properties.
 inline vec3f quad_point(const vec3f& p0, const vec3f& p1, const vec3f& p2,
     const vec3f& p3, const vec2f& uv) {
@@ -756,6 +792,94 @@ inline prim_intersection intersect_line(
   return {{s, sqrt(d2) / r}, t, true};
 }
 
+// Intersect a ray with a tapered capsule. Since the capsule is convex, the
+// ray line enters and exits it once. We compute all crossings with the cone
+// and the two spheres, keeping the ones that lie on the hull, and return the
+// entry point, or the exit one if the ray starts inside.
+inline prim_intersection intersect_capsule(
+    const ray3f& ray, const vec3f& p0, const vec3f& p1, float r0, float r1) {
+  // setup intersection params
+  auto ba = p1 - p0, oa = ray.o - p0, ob = ray.o - p1;
+  auto rr = r0 - r1;
+  auto a  = dot(ray.d, ray.d);
+  auto m0 = dot(ba, ba);
+  auto m1 = dot(ba, oa);
+  auto m2 = dot(ba, ray.d);
+  auto d2 = m0 - rr * rr;  // squared length of the cone generator
+
+  // signed position along the cone generator, in [0, d2] on the cone
+  auto along = [&](float t) { return m1 + t * m2 - r0 * rr; };
+
+  // crossings of the capsule, as distance, region and normal
+  auto tin = flt_max, tout = -flt_max;
+  auto nin = vec3f{0, 0, 0}, nout = vec3f{0, 0, 0};
+  auto uin = 0.0f, uout = 0.0f;
+  auto add_crossing = [&](float t, const vec3f& n, float u) {
+    if (t < tin) {
+      tin = t;
+      nin = n;
+      uin = u;
+    }
+    if (t > tout) {
+      tout = t;
+      nout = n;
+      uout = u;
+    }
+  };
+
+  // cone, unless one sphere contains the other
+  if (d2 > 0) {
+    auto m3 = dot(ray.d, oa), m5 = dot(oa, oa);
+    auto k2 = d2 * a - m2 * m2;
+    auto k1 = d2 * m3 - m1 * m2 + m2 * rr * r0;
+    auto k0 = d2 * m5 - m1 * m1 + m1 * rr * r0 * 2 - m0 * r0 * r0;
+    auto h  = k1 * k1 - k0 * k2;
+    if (k2 != 0 && h >= 0) {
+      for (auto t : {(-k1 - sqrt(h)) / k2, (-k1 + sqrt(h)) / k2}) {
+        auto y = along(t);
+        if (y <= 0 || y >= d2) continue;
+        add_crossing(t, normalize((oa + ray.d * t) * d2 - ba * y), y / d2);
+      }
+    }
+  }
+
+  // spheres, restricted to the caps
+  auto add_cap = [&](const vec3f& oc, float r, bool first) {
+    auto b = dot(ray.d, oc);
+    auto h = b * b - a * (dot(oc, oc) - r * r);
+    if (h < 0) return;
+    for (auto t : {(-b - sqrt(h)) / a, (-b + sqrt(h)) / a}) {
+      auto y = along(t);
+      if (d2 > 0 && (first ? y > 0 : y < d2)) continue;
+      if (d2 <= 0 && (first ? rr < 0 : rr >= 0)) continue;
+      add_crossing(t, (oc + ray.d * t) / r, first ? -1.0f : 2.0f);
+    }
+  };
+  add_cap(oa, r0, true);
+  add_cap(ob, r1, false);
+
+  // pick the first crossing within the ray bounds
+  if (tin > tout) return {};
+  auto in_bounds = [&ray](float t) { return t >= ray.tmin && t <= ray.tmax; };
+  if (!in_bounds(tin) && !in_bounds(tout)) return {};
+  auto t = in_bounds(tin) ? tin : tout;
+  auto n = in_bounds(tin) ? nin : nout;
+  auto u = in_bounds(tin) ? uin : uout;
+
+  // compute the capsule uv from the normal
+  auto len   = sqrt(m0);
+  auto basis = basis_fromz(len > 0 ? ba / len : vec3f{0, 0, 1});
+  auto beta  = asin(clamp(len > 0 ? rr / len : sign(rr), -1.0f, 1.0f));
+  auto phi   = atan2(dot(n, basis.y), dot(n, basis.x)) / (2 * pif);
+  if (phi < 0) phi += 1;
+  auto elev = asin(clamp(dot(n, basis.z), -1.0f, 1.0f));
+  if (u < 0) u = -clamp((beta - elev) / (beta + pif / 2), 0.0f, 1.0f);
+  if (u > 1) u = 1 + clamp((elev - beta) / (pif / 2 - beta), 0.0f, 1.0f);
+
+  // intersection occurred: set params and exit
+  return {{u, phi}, t, true};
+}
+
 // Intersect a ray with a sphere
 inline prim_intersection intersect_sphere(
     const ray3f& ray, const vec3f& p, float r) {
@@ -40,6 +40,7 @@
 
 #include "yocto_cutrace.h"
 #include "yocto_geometry.h"
+#include "yocto_parallel.h"
 
 #ifdef __APPLE__
 #define GL_SILENCE_DEPRECATION
@@ -55,40 +56,6 @@
 #undef far
 #endif
 
-// -----------------------------------------------------------------------------
-// PARALLEL HELPERS
-// -----------------------------------------------------------------------------
-namespace yocto {
-
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the two integer indices.
-template <typename T, typename Func>
-inline void parallel_for(T num1, T num2, Func&& func) {
-  auto              futures  = vector<std::future<void>>{};
-  auto              nthreads = std::thread::hardware_concurrency();
-  std::atomic<T>    next_idx(0);
-  std::atomic<bool> has_error(false);
-  for (auto thread_id = 0; thread_id < (int)nthreads; thread_id++) {
-    futures.emplace_back(std::async(
-        std::launch::async, [&func, &next_idx, &has_error, num1, num2]() {
-          try {
-            while (true) {
-              auto j = next_idx.fetch_add(1);
-              if (j >= num2) break;
-              if (has_error) break;
-              for (auto i = (T)0; i < num1; i++) func(i, j);
-            }
-          } catch (...) {
-            has_error = true;
-            throw;
-          }
-        }));
-  }
-  for (auto& f : futures) f.get();
-}
-
-}  // namespace yocto
-
 // -----------------------------------------------------------------------------
 // SCENE DRAWING
 // -----------------------------------------------------------------------------
@@ -298,6 +265,7 @@ bool draw_trace_widgets(const gui_input& input, int sample,
     edited += draw_gui_slider("bounces", params.bounces, 1, 128);
     edited += draw_gui_slider("batch", params.batch, 1, 16);
     edited += draw_gui_slider("clamp", params.clamp, 10, 1000);
+    edited += draw_gui_slider("noise", params.noise, 0, 0.1f);
     edited += draw_gui_checkbox("envhidden", params.envhidden);
     continue_gui_line();
     edited += draw_gui_checkbox("filter", params.tentfilter);
@@ -626,15 +594,17 @@ void show_trace_gui(const string& title, const string& name, scene_data& scene,
     }
   }
 
-  // render previews
+  // render previews, reusing memory across edits
+  auto pstate         = trace_state{};
+  auto preview        = image_data{};
   auto render_preview = [&]() -> bool {
     // preview
     auto pparams = params;
     pparams.resolution /= params.pratio;
     pparams.samples = 1;
-    auto pstate     = make_trace_state(scene, pparams);
+    make_trace_state(pstate, scene, pparams);
     trace_samples(pstate, scene, bvh, lights, pparams);
-    auto preview = get_image(pstate);
+    get_image(preview, pstate);
     for (auto idx = 0; idx < state.width * state.height; idx++) {
       auto i = idx % image.width, j = idx / image.width;
       auto pi           = clamp(i / params.pratio, 0, preview.width - 1),
@@ -648,7 +618,7 @@ void show_trace_gui(const string& title, const string& name, scene_data& scene,
   auto render_reset = [&]() {
     // make sure we can start
     trace_cancel(context);
-    state = make_trace_state(scene, params);
+    make_trace_state(state, scene, params);
     if (image.width != state.width || image.height != state.height)
       image = make_image(state.width, state.height, true);
   };
@@ -34,12 +34,19 @@
 
 #include <stb_image/stb_image_resize.h>
 
+#include <cmath>
 #include <future>
 #include <memory>
 #include <stdexcept>
 
 #include "yocto_color.h"
 #include "yocto_noise.h"
+#include "yocto_parallel.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define YOCTO_IMAGE_SSE2
+#endif
 
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
@@ -52,36 +59,362 @@ using std::unique_ptr;
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
-// PARALLEL HELPERS
+// VECTORIZED COLOR KERNELS
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the integer index.
-template <typename T, typename Func>
-inline void parallel_for_batch(T num, T batch, Func&& func) {
-  auto              futures  = vector<std::future<void>>{};
-  auto              nthreads = std::thread::hardware_concurrency();
-  std::atomic<T>    next_idx(0);
-  std::atomic<bool> has_error(false);
-  for (auto thread_id = 0; thread_id < (int)nthreads; thread_id++) {
-    futures.emplace_back(std::async(
-        std::launch::async, [&func, &next_idx, &has_error, num, batch]() {
-          try {
-            while (true) {
-              auto start = next_idx.fetch_add(batch);
-              if (start >= num) break;
-              if (has_error) break;
-              auto end = std::min(num, start + batch);
-              for (auto i = (T)start; i < end; i++) func(i);
-            }
-          } catch (...) {
-            has_error = true;
-            throw;
-          }
-        }));
+// Color kernels process blocks of pixels stored as separate channels, using
+// SSE2 lanes of four floats where available, and scalar lanes otherwise.
+// Kernels are written once in terms of the lane operations below.
+#ifdef YOCTO_IMAGE_SSE2
+
+const auto lane_size = 4;
+struct lanef {
+  __m128 v;
+};
+struct lanem {
+  __m128 v;
+};
+
+static inline lanef lane_set(float a) { return {_mm_set1_ps(a)}; }
+static inline lanef lane_load(const float* a) { return {_mm_load_ps(a)}; }
+static inline void  lane_store(float* a, lanef b) { _mm_store_ps(a, b.v); }
+static inline lanef operator+(lanef a, lanef b) {
+  return {_mm_add_ps(a.v, b.v)};
+}
+static inline lanef operator-(lanef a, lanef b) {
+  return {_mm_sub_ps(a.v, b.v)};
+}
+static inline lanef operator*(lanef a, lanef b) {
+  return {_mm_mul_ps(a.v, b.v)};
+}
+static inline lanef operator/(lanef a, lanef b) {
+  return {_mm_div_ps(a.v, b.v)};
+}
+static inline lanem operator<(lanef a, lanef b) {
+  return {_mm_cmplt_ps(a.v, b.v)};
+}
+static inline lanem operator>(lanef a, lanef b) {
+  return {_mm_cmpgt_ps(a.v, b.v)};
+}
+static inline lanef lane_min(lanef a, lanef b) {
+  return {_mm_min_ps(a.v, b.v)};
+}
+static inline lanef lane_max(lanef a, lanef b) {
+  return {_mm_max_ps(a.v, b.v)};
+}
+static inline lanef lane_select(lanem mask, lanef a, lanef b) {
+  return {_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v))};
+}
+// Split positive numbers in mantissa, in [1,2), and exponent.
+static inline void lane_frexp(lanef a, lanef& mantissa, lanef& exponent) {
+  auto bits = _mm_castps_si128(a.v);
+  exponent  = {_mm_cvtepi32_ps(_mm_sub_epi32(
+      _mm_and_si128(_mm_srli_epi32(bits, 23), _mm_set1_epi32(0xff)),
+      _mm_set1_epi32(127)))};
+  mantissa  = {_mm_castsi128_ps(
+      _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+          _mm_set1_epi32(0x3f800000)))};
+}
+// Round positive numbers to the nearest integer.
+static inline lanef lane_round(lanef a) {
+  auto rounded = _mm_cvttps_epi32(_mm_add_ps(a.v, _mm_set1_ps(0.5f)));
+  return {_mm_cvtepi32_ps(rounded)};
+}
+// Multiply by two to an integer power, in [-126,127].
+static inline lanef lane_ldexp(lanef a, lanef exponent) {
+  auto bits = _mm_slli_epi32(
+      _mm_add_epi32(_mm_cvttps_epi32(exponent.v), _mm_set1_epi32(127)), 23);
+  return {_mm_mul_ps(a.v, _mm_castsi128_ps(bits))};
+}
+
+#else
+
+const auto lane_size = 1;
+struct lanef {
+  float v;
+};
+struct lanem {
+  bool v;
+};
+
+static inline lanef lane_set(float a) { return {a}; }
+static inline lanef lane_load(const float* a) { return {*a}; }
+static inline void  lane_store(float* a, lanef b) { *a = b.v; }
+static inline lanef operator+(lanef a, lanef b) { return {a.v + b.v}; }
+static inline lanef operator-(lanef a, lanef b) { return {a.v - b.v}; }
+static inline lanef operator*(lanef a, lanef b) { return {a.v * b.v}; }
+static inline lanef operator/(lanef a, lanef b) { return {a.v / b.v}; }
+static inline lanem operator<(lanef a, lanef b) { return {a.v < b.v}; }
+static inline lanem operator>(lanef a, lanef b) { return {a.v > b.v}; }
+static inline lanef lane_min(lanef a, lanef b) { return {min(a.v, b.v)}; }
+static inline lanef lane_max(lanef a, lanef b) { return {max(a.v, b.v)}; }
+static inline lanef lane_select(lanem mask, lanef a, lanef b) {
+  return mask.v ? a : b;
+}
+// Log2 and exp2, using the standard library.
+static inline lanef lane_log2(lanef x) { return {std::log2(x.v)}; }
+static inline lanef lane_exp2(lanef x) { return {std::exp2(x.v)}; }
+
+#endif
+
+// Lane operations with scalars
+static inline lanef operator+(lanef a, float b) { return a + lane_set(b); }
+static inline lanef operator-(lanef a, float b) { return a - lane_set(b); }
+static inline lanef operator*(lanef a, float b) { return a * lane_set(b); }
+static inline lanef operator/(lanef a, float b) { return a / lane_set(b); }
+static inline lanef operator+(float a, lanef b) { return lane_set(a) + b; }
+static inline lanef operator-(float a, lanef b) { return lane_set(a) - b; }
+static inline lanef operator*(float a, lanef b) { return lane_set(a) * b; }
+static inline lanef operator/(float a, lanef b) { return lane_set(a) / b; }
+static inline lanem operator<(lanef a, float b) { return a < lane_set(b); }
+static inline lanem operator>(lanef a, float b) { return a > lane_set(b); }
+static inline lanef lane_clamp(lanef a, float min, float max) {
+  return lane_min(lane_max(a, lane_set(min)), lane_set(max));
+}
+
+#ifdef YOCTO_IMAGE_SSE2
+// Log2 and exp2 approximations, with relative error below 1e-6. Polynomials
+// are taken from Cephes and avoid divisions.
+static inline lanef lane_log2(lanef x) {
+  auto mantissa = lanef{}, exponent = lanef{};
+  lane_frexp(x, mantissa, exponent);
+  // center the mantissa around one for faster convergence
+  auto large = mantissa > 1.41421356f;
+  mantissa   = lane_select(large, mantissa * 0.5f, mantissa);
+  exponent   = lane_select(large, exponent + 1, exponent);
+  auto t = mantissa - 1, t2 = t * t;
+  auto p = 7.0376836292e-2f * t - 1.1514610310e-1f;
+  p      = p * t + 1.1676998740e-1f;
+  p      = p * t - 1.2420140846e-1f;
+  p      = p * t + 1.4249322787e-1f;
+  p      = p * t - 1.6668057665e-1f;
+  p      = p * t + 2.0000714765e-1f;
+  p      = p * t - 2.4999993993e-1f;
+  p      = p * t + 3.3333331174e-1f;
+  auto ln = t + t2 * (p * t - 0.5f);
+  return exponent + ln * 1.44269504f;
+}
+static inline lanef lane_exp2(lanef x) {
+  x      = lane_clamp(x, -126, 127);
+  auto n = lane_round(x + 127) - 127;
+  auto t = x - n;
+  auto p = 1.535336188319500e-4f * t + 1.339887440266574e-3f;
+  p      = p * t + 9.618437357674640e-3f;
+  p      = p * t + 5.550332471162809e-2f;
+  p      = p * t + 2.402264791363012e-1f;
+  p      = p * t + 6.931472028550421e-1f;
+  return lane_ldexp(p * t + 1, n);
+}
+#endif
+
+static inline lanef lane_pow(lanef x, float y) {
+  auto positive = x > 0;
+  auto value    = lane_exp2(lane_log2(lane_max(x, lane_set(1e-30f))) * y);
+  return lane_select(positive, value, lane_set(0));
+}
+
+// Color curves used in the kernels
+static inline lanef lane_rgb_to_srgb(lanef rgb) {
+  auto curve = 1.055f * lane_pow(rgb, 1 / 2.4f) - 0.055f;
+  return lane_select(rgb > 0.0031308f, curve, rgb * 12.92f);
+}
+static inline lanef lane_filmic(lanef hdr) {
+  hdr      = hdr * 0.6f;
+  auto ldr = (hdr * hdr * 2.51f + hdr * 0.03f) /
+             (hdr * hdr * 2.43f + hdr * 0.59f + 0.14f);
+  return lane_max(ldr, lane_set(0));
+}
+static inline lanef lane_bias(lanef a, float bias) {
+  return a / ((1 / bias - 2) * (1 - a) + 1);
+}
+static inline lanef lane_gain(lanef a, float gain) {
+  auto low  = lane_bias(a * 2, gain) / 2;
+  auto high = lane_bias(a * 2 - 1, 1 - gain) / 2 + 0.5f;
+  return lane_select(a < 0.5f, low, high);
+}
+
+// Block of pixels, stored as separate channels.
+const auto color_block_size = 8;
+struct color_block {
+  alignas(16) float r[color_block_size] = {};
+  alignas(16) float g[color_block_size] = {};
+  alignas(16) float b[color_block_size] = {};
+  alignas(16) float a[color_block_size] = {};
+};
+
+// Apply a function to each color channel of a block.
+template <typename Func>
+static inline void map_block(color_block& block, Func&& func) {
+  for (auto channel : {block.r, block.g, block.b}) {
+    for (auto i = 0; i < color_block_size; i += lane_size) {
+      lane_store(channel + i, func(lane_load(channel + i)));
+    }
+  }
+}
+// Apply saturation to a block, with equal channel weights.
+static inline void saturate_block(color_block& block, float saturation) {
+  for (auto i = 0; i < color_block_size; i += lane_size) {
+    auto r = lane_load(block.r + i), g = lane_load(block.g + i),
+         b     = lane_load(block.b + i);
+    auto grey  = 0.333333f * r + 0.333333f * g + 0.333333f * b;
+    auto zero  = lane_set(0);
+    auto scale = saturation * 2;
+    lane_store(block.r + i, lane_max(zero, grey + (r - grey) * scale));
+    lane_store(block.g + i, lane_max(zero, grey + (g - grey) * scale));
+    lane_store(block.b + i, lane_max(zero, grey + (b - grey) * scale));
   }
-  for (auto& f : futures) f.get();
+}
+
+// Tone mapping kernel, matching `tonemap()`.
+static void tonemap_block(
+    color_block& block, float exposure, bool filmic, bool srgb) {
+  if (exposure != 0) {
+    auto scale = exp2(exposure);
+    map_block(block, [scale](lanef c) { return c * scale; });
+  }
+  if (filmic) map_block(block, lane_filmic);
+  if (srgb) map_block(block, lane_rgb_to_srgb);
+}
+
+// Color grading kernel, matching `colorgrade()`.
+static void colorgrade_block(
+    color_block& block, bool linear, const colorgrade_params& params) {
+  if (params.exposure != 0) {
+    auto scale = exp2(params.exposure);
+    map_block(block, [scale](lanef c) { return c * scale; });
+  }
+  if (params.tint != vec3f{1, 1, 1}) {
+    for (auto i = 0; i < color_block_size; i += lane_size) {
+      lane_store(block.r + i, lane_load(block.r + i) * params.tint.x);
+      lane_store(block.g + i, lane_load(block.g + i) * params.tint.y);
+      lane_store(block.b + i, lane_load(block.b + i) * params.tint.z);
+    }
+  }
+  if (params.lincontrast != 0.5f) {
+    auto grey = linear ? 0.18f : 0.5f, scale = params.lincontrast * 2;
+    map_block(block, [grey, scale](lanef c) {
+      return lane_max(lane_set(0), grey + (c - grey) * scale);
+    });
+  }
+  if (params.logcontrast != 0.5f) {
+    auto epsilon  = 0.0001f;
+    auto log_grey = log2(linear ? 0.18f : 0.5f);
+    auto scale    = params.logcontrast * 2;
+    map_block(block, [epsilon, log_grey, scale](lanef c) {
+      auto log_ldr  = lane_log2(c + epsilon);
+      auto adjusted = log_grey + (log_ldr - log_grey) * scale;
+      return lane_max(lane_set(0), lane_exp2(adjusted) - epsilon);
+    });
+  }
+  if (params.linsaturation != 0.5f) saturate_block(block, params.linsaturation);
+  if (params.filmic) map_block(block, lane_filmic);
+  if (linear && params.srgb) map_block(block, lane_rgb_to_srgb);
+  if (params.contrast != 0.5f) {
+    auto gain = 1 - params.contrast;
+    map_block(block, [gain](lanef c) { return lane_gain(c, gain); });
+  }
+  if (params.saturation != 0.5f) saturate_block(block, params.saturation);
+  if (params.shadows != 0.5f || params.midtones != 0.5f ||
+      params.highlights != 0.5f || params.shadows_color != vec3f{1, 1, 1} ||
+      params.midtones_color != vec3f{1, 1, 1} ||
+      params.highlights_color != vec3f{1, 1, 1}) {
+    auto lift  = params.shadows_color;
+    auto gamma = params.midtones_color;
+    auto gain  = params.highlights_color;
+    lift       = lift - mean(lift) + params.shadows - (float)0.5;
+    gain       = gain - mean(gain) + params.highlights + (float)0.5;
+    auto grey  = gamma - mean(gamma) + params.midtones;
+    gamma      = log(((float)0.5 - lift) / (gain - lift)) / log(grey);
+    auto channels = {block.r, block.g, block.b};
+    auto idx      = 0;
+    for (auto channel : channels) {
+      auto exponent = 1 / gamma[idx], clift = lift[idx], cgain = gain[idx];
+      for (auto i = 0; i < color_block_size; i += lane_size) {
+        auto value = lane_clamp(
+            lane_pow(lane_load(channel + i), exponent), 0, 1);
+        lane_store(channel + i, cgain * value + clift * (1 - value));
+      }
+      idx++;
+    }
+  }
+}
+
+// Convert pixels to and from blocks.
+static inline void load_block(color_block& block, const vec4f* pixels) {
+  for (auto i = 0; i < color_block_size; i++) {
+    block.r[i] = pixels[i].x;
+    block.g[i] = pixels[i].y;
+    block.b[i] = pixels[i].z;
+    block.a[i] = pixels[i].w;
+  }
+}
+static inline void store_block(vec4f* pixels, const color_block& block) {
+  for (auto i = 0; i < color_block_size; i++) {
+    pixels[i] = {block.r[i], block.g[i], block.b[i], block.a[i]};
+  }
+}
+#ifdef YOCTO_IMAGE_SSE2
+// Matches `float_to_byte()`, since packing saturates to [0,255].
+static inline void store_block(vec4b* pixels, const color_block& block) {
+  auto scale = _mm_set1_ps(256);
+  for (auto i = 0; i < color_block_size; i += 4) {
+    auto r = _mm_load_ps(block.r + i), g = _mm_load_ps(block.g + i),
+         b = _mm_load_ps(block.b + i), a = _mm_load_ps(block.a + i);
+    _MM_TRANSPOSE4_PS(r, g, b, a);
+    auto p0 = _mm_cvttps_epi32(_mm_mul_ps(r, scale));
+    auto p1 = _mm_cvttps_epi32(_mm_mul_ps(g, scale));
+    auto p2 = _mm_cvttps_epi32(_mm_mul_ps(b, scale));
+    auto p3 = _mm_cvttps_epi32(_mm_mul_ps(a, scale));
+    auto packed = _mm_packus_epi16(
+        _mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+    _mm_storeu_si128((__m128i*)(pixels + i), packed);
+  }
+}
+#else
+static inline void store_block(vec4b* pixels, const color_block& block) {
+  for (auto i = 0; i < color_block_size; i++) {
+    pixels[i] = float_to_byte(
+        vec4f{block.r[i], block.g[i], block.b[i], block.a[i]});
+  }
+}
+#endif
+
+// Apply a kernel to an array of pixels, one block at a time. The last
+// partial block is padded.
+template <typename Pixel, typename Kernel>
+static void apply_color_kernel(
+    Pixel* result, const vec4f* pixels, size_t count, Kernel&& kernel) {
+  auto block = color_block{};
+  for (auto start = (size_t)0; start < count; start += color_block_size) {
+    auto size = std::min(count - start, (size_t)color_block_size);
+    if (size == color_block_size) {
+      load_block(block, pixels + start);
+      kernel(block);
+      store_block(result + start, block);
+    } else {
+      vec4f source[color_block_size] = {};
+      Pixel target[color_block_size] = {};
+      std::copy(pixels + start, pixels + start + size, source);
+      load_block(block, source);
+      kernel(block);
+      store_block(target, block);
+      std::copy(target, target + size, result + start);
+    }
+  }
+}
+
+// Apply a kernel to an array of pixels, splitting the work in rows of pixels
+// processed in parallel.
+template <typename Pixel, typename Kernel>
+static void apply_color_kernel_mt(
+    Pixel* result, const vec4f* pixels, size_t count, Kernel&& kernel) {
+  const auto batch = (size_t)1024;
+  parallel_for_batch((count + batch - 1) / batch, (size_t)1, [&](size_t idx) {
+    auto start = idx * batch;
+    apply_color_kernel(result + start, pixels + start,
+        std::min(batch, count - start), kernel);
+  });
 }
 
 }  // namespace yocto
@@ -185,9 +518,10 @@ vec4f eval_image(const image_data& image, const vec2f& uv, bool as_linear,
 image_data tonemap_image(const image_data& image, float exposure, bool filmic) {
   if (!image.linear) return image;
   auto result = make_image(image.width, image.height, false);
-  for (auto idx = 0; idx < image.width * image.height; idx++) {
-    result.pixels[idx] = tonemap(image.pixels[idx], exposure, filmic, true);
-  }
+  apply_color_kernel(result.pixels.data(), image.pixels.data(),
+      image.pixels.size(), [exposure, filmic](color_block& block) {
+        tonemap_block(block, exposure, filmic, true);
+      });
   return result;
 }
 
@@ -198,9 +532,10 @@ void tonemap_image(
     throw std::invalid_argument{"image should be the same size"};
   if (result.linear) throw std::invalid_argument{"ldr expected"};
   if (image.linear) {
-    for (auto idx : range(image.pixels.size())) {
-      result.pixels[idx] = tonemap(image.pixels[idx], exposure, filmic);
-    }
+    apply_color_kernel(result.pixels.data(), image.pixels.data(),
+        image.pixels.size(), [exposure, filmic](color_block& block) {
+          tonemap_block(block, exposure, filmic, true);
+        });
   } else {
     auto scale = vec4f{
         pow(2.0f, exposure), pow(2.0f, exposure), pow(2.0f, exposure), 1};
@@ -216,9 +551,9 @@ void tonemap_image_mt(
     throw std::invalid_argument{"image should be the same size"};
   if (result.linear) throw std::invalid_argument{"ldr expected"};
   if (image.linear) {
-    parallel_for_batch((size_t)image.width * (size_t)image.height,
-        (size_t)image.width, [&result, &image, exposure, filmic](size_t idx) {
-          result.pixels[idx] = tonemap(image.pixels[idx], exposure, filmic);
+    apply_color_kernel_mt(result.pixels.data(), image.pixels.data(),
+        image.pixels.size(), [exposure, filmic](color_block& block) {
+          tonemap_block(block, exposure, filmic, true);
         });
   } else {
     auto scale = vec4f{
@@ -367,9 +702,10 @@ vec4f colorgradeb(
 image_data colorgrade_image(
     const image_data& image, const colorgrade_params& params) {
   auto result = make_image(image.width, image.height, false);
-  for (auto idx : range(image.pixels.size())) {
-    result.pixels[idx] = colorgrade(image.pixels[idx], image.linear, params);
-  }
+  apply_color_kernel(result.pixels.data(), image.pixels.data(),
+      image.pixels.size(), [&image, &params](color_block& block) {
+        colorgrade_block(block, image.linear, params);
+      });
   return result;
 }
 
@@ -380,9 +716,10 @@ void colorgrade_image(image_data& result, const image_data& image,
   if (image.width != result.width || image.height != result.height)
     throw std::invalid_argument{"image should be the same size"};
   if (!!result.linear) throw std::invalid_argument{"non linear expected"};
-  for (auto idx : range(image.pixels.size())) {
-    result.pixels[idx] = colorgrade(image.pixels[idx], image.linear, params);
-  }
+  apply_color_kernel(result.pixels.data(), image.pixels.data(),
+      image.pixels.size(), [&image, &params](color_block& block) {
+        colorgrade_block(block, image.linear, params);
+      });
 }
 
 // Color grade an hsr or ldr image to an ldr image.
@@ -392,10 +729,9 @@ void colorgrade_image_mt(image_data& result, const image_data& image,
   if (image.width != result.width || image.height != result.height)
     throw std::invalid_argument{"image should be the same size"};
   if (!!result.linear) throw std::invalid_argument{"non linear expected"};
-  parallel_for_batch((size_t)image.width * (size_t)image.height,
-      (size_t)image.width, [&result, &image, &params](size_t idx) {
-        result.pixels[idx] = colorgrade(
-            image.pixels[idx], image.linear, params);
+  apply_color_kernel_mt(result.pixels.data(), image.pixels.data(),
+      image.pixels.size(), [&image, &params](color_block& block) {
+        colorgrade_block(block, image.linear, params);
       });
 }
 
@@ -911,47 +1247,53 @@ void rgb_to_srgb(vector<vec4b>& srgb, const vector<vec4f>& rgb) {
 void tonemap_image(vector<vec4f>& ldr, const vector<vec4f>& hdr, float exposure,
     bool filmic, bool srgb) {
   ldr.resize(hdr.size());
-  for (auto i : range(hdr.size()))
-    ldr[i] = tonemap(hdr[i], exposure, filmic, srgb);
+  apply_color_kernel(ldr.data(), hdr.data(), hdr.size(),
+      [=](color_block& block) {
+        tonemap_block(block, exposure, filmic, srgb);
+      });
 }
 void tonemap_image(vector<vec4b>& ldr, const vector<vec4f>& hdr, float exposure,
     bool filmic, bool srgb) {
   ldr.resize(hdr.size());
-  for (auto i : range(hdr.size()))
-    ldr[i] = float_to_byte(tonemap(hdr[i], exposure, filmic, srgb));
+  apply_color_kernel(ldr.data(), hdr.data(), hdr.size(),
+      [=](color_block& block) {
+        tonemap_block(block, exposure, filmic, srgb);
+      });
 }
 
 void tonemap_image_mt(vector<vec4f>& ldr, const vector<vec4f>& hdr,
     float exposure, bool filmic, bool srgb) {
-  parallel_for_batch(hdr.size(), (size_t)1024,
-      [&](size_t i) { ldr[i] = tonemap(hdr[i], exposure, filmic, srgb); });
+  apply_color_kernel_mt(ldr.data(), hdr.data(), hdr.size(),
+      [=](color_block& block) {
+        tonemap_block(block, exposure, filmic, srgb);
+      });
 }
 void tonemap_image_mt(vector<vec4b>& ldr, const vector<vec4f>& hdr,
     float exposure, bool filmic, bool srgb) {
-  parallel_for_batch(hdr.size(), (size_t)1024, [&](size_t i) {
-    ldr[i] = float_to_byte(tonemap(hdr[i], exposure, filmic, srgb));
-  });
+  apply_color_kernel_mt(ldr.data(), hdr.data(), hdr.size(),
+      [=](color_block& block) {
+        tonemap_block(block, exposure, filmic, srgb);
+      });
 }
 
 // Apply exposure and filmic tone mapping
 void colorgrade_image(vector<vec4f>& corrected, const vector<vec4f>& img,
     bool linear, const colorgrade_params& params) {
   corrected.resize(img.size());
-  for (auto i : range(img.size()))
-    corrected[i] = colorgrade(img[i], linear, params);
+  apply_color_kernel(corrected.data(), img.data(), img.size(),
+      [&](color_block& block) { colorgrade_block(block, linear, params); });
 }
 
 // Apply exposure and filmic tone mapping
 void colorgrade_image_mt(vector<vec4f>& corrected, const vector<vec4f>& img,
     bool linear, const colorgrade_params& params) {
-  parallel_for_batch(img.size(), (size_t)1024,
-      [&](size_t i) { corrected[i] = colorgrade(img[i], linear, params); });
+  apply_color_kernel_mt(corrected.data(), img.data(), img.size(),
+      [&](color_block& block) { colorgrade_block(block, linear, params); });
 }
 void colorgrade_image_mt(vector<vec4b>& corrected, const vector<vec4f>& img,
     bool linear, const colorgrade_params& params) {
-  parallel_for_batch(img.size(), (size_t)1024, [&](size_t i) {
-    corrected[i] = float_to_byte(colorgrade(img[i], linear, params));
-  });
+  apply_color_kernel_mt(corrected.data(), img.data(), img.size(),
+      [&](color_block& block) { colorgrade_block(block, linear, params); });
 }
 
 // compute white balance
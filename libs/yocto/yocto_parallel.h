@@ -37,14 +37,26 @@
 // INCLUDES
 // -----------------------------------------------------------------------------
 
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <cstdlib>
 #include <deque>
+#include <exception>
+#include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <utility>
 #include <vector>
 
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
 // -----------------------------------------------------------------------------
@@ -55,6 +67,7 @@ using std::atomic;
 using std::deque;
 using std::future;
 using std::mutex;
+using std::string;
 using std::vector;
 
 }  // namespace yocto
@@ -90,36 +103,52 @@ inline bool is_valid(const future<void>& result);
 inline bool is_running(const future<void>& result);
 inline bool is_ready(const future<void>& result);
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the integer index.
+// Number of threads used by parallel loops, including the calling thread.
+// Defaults to the YOCTO_NUM_THREADS environment variable, if set, or to the
+// hardware concurrency. Pool threads are pinned to cores if the
+// YOCTO_PIN_THREADS environment variable is set to a non-zero value.
+inline int get_parallel_threads();
+// Sets the number of threads used by parallel loops and whether pool threads
+// are pinned to cores. This restarts the thread pool, so it should only be
+// called while no parallel loop is running.
+inline void set_parallel_threads(int nthreads, bool pin = false);
+
+// Parallel loops run on a persistent pool of threads that is created on first
+// use. Each loop is split in batches that are grabbed by the calling thread
+// and by the pool threads that pick it up, so the caller always makes
+// progress and loops can be nested. Loops started from pool threads are
+// queued locally and stolen by idle threads. Exceptions thrown by `Func` stop
+// the loop and are rethrown in the calling thread.
+
+// Parallel for on the thread pool. `Func` takes the integer index.
 template <typename T, typename Func>
 inline void parallel_for(T num, Func&& func);
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the two integer indices.
+// Parallel for on the thread pool. `Func` takes the two integer indices.
 template <typename T, typename Func>
 inline void parallel_for(T num1, T num2, Func&& func);
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the integer index.
-// Works on `batch` sized chunks.
+// Parallel for on the thread pool. `Func` takes the integer index.
+// Works on `batch` sized chunks, and runs serially if there is only one chunk.
 template <typename T, typename Func>
 inline void parallel_for_batch(T num, T batch, Func&& func);
+// Parallel for on the thread pool, with at most `nworkers` threads. `Func`
+// takes the integer index and the index of the thread within the loop, in
+// [0, nworkers), so that threads can use per-thread scratch memory.
+template <typename T, typename Func>
+inline void parallel_for_workers(T num, int nworkers, Func&& func);
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes a reference to a `T`.
+// Parallel for on the thread pool. `Func` takes a reference to a `T`.
 template <typename T, typename Func>
 inline void parallel_foreach(vector<T>& values, Func&& func);
 template <typename T, typename Func>
 inline void parallel_foreach(const vector<T>& values, Func&& func);
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the integer index, a string ref,
-// and returns a bool. Handles errors explicitly.
+// Parallel for on the thread pool. `Func` takes the integer index, a string
+// ref, and returns a bool. Handles errors explicitly.
 template <typename T, typename Func>
 inline bool parallel_for(T num, string& error, Func&& func);
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes a reference to a `T`, a string ref,
-// and returns a bool. Handles errors explicitly.
+// Parallel for on the thread pool. `Func` takes a reference to a `T`, a string
+// ref, and returns a bool. Handles errors explicitly.
 template <typename T, typename Func>
 inline bool parallel_foreach(vector<T>& values, string& error, Func&& func);
 template <typename T, typename Func>
@@ -183,90 +212,286 @@ inline bool is_ready(const future<void>& result) {
                                std::future_status::ready;
 }
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the integer index.
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// THREAD POOL
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// A parallel loop shared by the threads that run it. Participants grab
+// batches of indices until none is left. Loops are reference counted since
+// pool threads may pick them up after the caller has returned, in which case
+// they find no work left and never call `func`. The caller waits on `done`
+// for the participants still running batches.
+struct parallel_job {
+  size_t                                   num   = 0;
+  size_t                                   batch = 1;
+  std::function<void(size_t, size_t, int)> func  = {};
+  atomic<size_t>                           next_idx{0};
+  atomic<int>                              next_slot{0};
+  atomic<int>                              running{0};
+  atomic<bool>                             has_error{false};
+  std::exception_ptr                       error = nullptr;
+  mutex                                    error_mutex;
+  mutex                                    done_mutex;
+  std::condition_variable                  done;
+};
+
+// Persistent pool of threads. Each thread owns a queue of loop tickets, where
+// a ticket asks one more thread to join a loop. Threads pop their own tickets
+// last-in first-out, and steal from the other queues first-in first-out.
+struct parallel_pool {
+  struct ticket_queue {
+    std::mutex                           mutex;
+    deque<std::shared_ptr<parallel_job>> tickets;
+  };
+
+  int                                   nthreads = 1;
+  bool                                  pin      = false;
+  vector<std::thread>                   threads  = {};
+  vector<std::unique_ptr<ticket_queue>> queues   = {};
+  atomic<size_t>                        next_queue{0};
+  atomic<int>                           num_tickets{0};
+  std::mutex                            wake_mutex;
+  std::condition_variable               wake;
+  bool                                  stop = false;
+
+  parallel_pool(int nthreads, bool pin);
+  ~parallel_pool();
+  parallel_pool(const parallel_pool&) = delete;
+  parallel_pool& operator=(const parallel_pool&) = delete;
+};
+
+// Pool and queue index of the current thread, if it is a pool thread.
+inline thread_local parallel_pool* parallel_thread_pool  = nullptr;
+inline thread_local int            parallel_thread_queue = -1;
+
+// Runs batches of a loop until none is left.
+inline void run_parallel_job(parallel_job& job) {
+  job.running += 1;
+  auto slot = job.next_slot.fetch_add(1);
+  while (!job.has_error) {
+    auto start = job.next_idx.fetch_add(job.batch);
+    if (start >= job.num) break;
+    try {
+      job.func(start, std::min(job.num, start + job.batch), slot);
+    } catch (...) {
+      auto _ = std::lock_guard{job.error_mutex};
+      if (!job.error) job.error = std::current_exception();
+      job.has_error = true;
+    }
+  }
+  if (job.running.fetch_sub(1) == 1) {
+    auto _ = std::lock_guard{job.done_mutex};
+    job.done.notify_one();
+  }
+}
+
+// Pops a ticket from the own queue, or steals one from the other queues.
+inline std::shared_ptr<parallel_job> pop_parallel_ticket(
+    parallel_pool& pool, int queue) {
+  auto nqueues = (int)pool.queues.size();
+  {
+    auto& own = *pool.queues[queue];
+    auto  _   = std::lock_guard{own.mutex};
+    if (!own.tickets.empty()) {
+      auto job = std::move(own.tickets.back());
+      own.tickets.pop_back();
+      return job;
+    }
+  }
+  for (auto offset = 1; offset < nqueues; offset++) {
+    auto& other = *pool.queues[(queue + offset) % nqueues];
+    auto  _     = std::lock_guard{other.mutex};
+    if (!other.tickets.empty()) {
+      auto job = std::move(other.tickets.front());
+      other.tickets.pop_front();
+      return job;
+    }
+  }
+  return nullptr;
+}
+
+// Pins a thread to a core, where supported.
+inline void pin_parallel_thread(std::thread& thread, int core) {
+#if defined(__linux__)
+  auto ncores = std::max((int)std::thread::hardware_concurrency(), 1);
+  auto cores  = cpu_set_t{};
+  CPU_ZERO(&cores);
+  CPU_SET(core % ncores, &cores);
+  pthread_setaffinity_np(thread.native_handle(), sizeof(cores), &cores);
+#endif
+}
+
+// Starts the pool threads. The calling thread takes part in every loop, so
+// the pool has one thread less than the requested number.
+inline parallel_pool::parallel_pool(int nthreads_, bool pin_)
+    : nthreads{std::max(nthreads_, 1)}, pin{pin_} {
+  for (auto queue = 0; queue < nthreads - 1; queue++) {
+    queues.push_back(std::make_unique<ticket_queue>());
+  }
+  for (auto queue = 0; queue < nthreads - 1; queue++) {
+    threads.emplace_back([this, queue]() {
+      parallel_thread_pool  = this;
+      parallel_thread_queue = queue;
+      while (true) {
+        if (auto job = pop_parallel_ticket(*this, queue)) {
+          num_tickets -= 1;
+          run_parallel_job(*job);
+          continue;
+        }
+        auto lock = std::unique_lock{wake_mutex};
+        wake.wait(lock, [this]() { return stop || num_tickets > 0; });
+        if (stop) break;
+      }
+    });
+    if (pin) pin_parallel_thread(threads.back(), queue + 1);
+  }
+}
+
+// Stops the pool threads. Pending tickets refer to finished loops.
+inline parallel_pool::~parallel_pool() {
+  {
+    auto _ = std::lock_guard{wake_mutex};
+    stop   = true;
+  }
+  wake.notify_all();
+  for (auto& thread : threads) thread.join();
+}
+
+// Pool settings from the environment
+inline std::unique_ptr<parallel_pool>& get_parallel_pool_ptr() {
+  static auto pool = std::unique_ptr<parallel_pool>{};
+  return pool;
+}
+inline parallel_pool& get_parallel_pool() {
+  static auto once = std::once_flag{};
+  std::call_once(once, []() {
+    auto nthreads = (int)std::thread::hardware_concurrency();
+    if (auto value = std::getenv("YOCTO_NUM_THREADS"))
+      nthreads = std::atoi(value);
+    auto pin = false;
+    if (auto value = std::getenv("YOCTO_PIN_THREADS"))
+      pin = std::atoi(value) != 0;
+    if (!get_parallel_pool_ptr())
+      get_parallel_pool_ptr() = std::make_unique<parallel_pool>(nthreads, pin);
+  });
+  return *get_parallel_pool_ptr();
+}
+
+// Number of threads used by parallel loops, including the calling thread.
+inline int get_parallel_threads() { return get_parallel_pool().nthreads; }
+
+// Sets the number of threads used by parallel loops.
+inline void set_parallel_threads(int nthreads, bool pin) {
+  get_parallel_pool();
+  get_parallel_pool_ptr().reset();
+  get_parallel_pool_ptr() = std::make_unique<parallel_pool>(nthreads, pin);
+}
+
+// Runs `func` on batches of [0, num) with at most `nworkers` threads. `Func`
+// takes the batch range and the index of the thread within the loop.
+template <typename Func>
+inline void run_parallel(size_t num, size_t batch, int nworkers, Func&& func) {
+  auto& pool     = get_parallel_pool();
+  auto  nbatches = (num + batch - 1) / batch;
+  auto  nhelpers = std::min(
+      {nbatches, pool.threads.size() + 1, (size_t)std::max(nworkers, 1)});
+  if (nhelpers <= 1) {
+    for (auto start = (size_t)0; start < num; start += batch)
+      func(start, std::min(num, start + batch), 0);
+    return;
+  }
+  nhelpers -= 1;
+
+  // ask pool threads to join, from the own queue of pool threads so that
+  // nested loops stay local unless stolen
+  auto job   = std::make_shared<parallel_job>();
+  job->num   = num;
+  job->batch = batch;
+  job->func  = [&func](size_t start, size_t end, int slot) {
+    func(start, end, slot);
+  };
+  auto own = parallel_thread_pool == &pool ? parallel_thread_queue : -1;
+  for (auto helper = (size_t)0; helper < nhelpers; helper++) {
+    auto  queue = own >= 0 ? (size_t)own
+                           : pool.next_queue.fetch_add(1) % pool.queues.size();
+    auto& tickets = *pool.queues[queue];
+    auto  _       = std::lock_guard{tickets.mutex};
+    tickets.tickets.push_back(job);
+  }
+  {
+    auto _ = std::lock_guard{pool.wake_mutex};
+    pool.num_tickets += (int)nhelpers;
+  }
+  if (nhelpers == 1) {
+    pool.wake.notify_one();
+  } else {
+    pool.wake.notify_all();
+  }
+
+  // take part in the loop, then run pending tickets while threads are still
+  // running batches, and sleep once none is left
+  run_parallel_job(*job);
+  while (job->running > 0) {
+    if (auto other = pop_parallel_ticket(pool, own >= 0 ? own : 0)) {
+      pool.num_tickets -= 1;
+      run_parallel_job(*other);
+      continue;
+    }
+    auto lock = std::unique_lock{job->done_mutex};
+    job->done.wait(lock, [&job]() { return job->running == 0; });
+  }
+  if (job->error) std::rethrow_exception(job->error);
+}
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// PARALLEL LOOPS
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Parallel for on the thread pool. `Func` takes the integer index.
 template <typename T, typename Func>
 inline void parallel_for(T num, Func&& func) {
-  auto         futures  = vector<future<void>>{};
-  auto         nthreads = std::thread::hardware_concurrency();
-  atomic<T>    next_idx(0);
-  atomic<bool> has_error(false);
-  for (auto thread_id = 0; thread_id < (int)nthreads; thread_id++) {
-    futures.emplace_back(
-        std::async(std::launch::async, [&func, &next_idx, &has_error, num]() {
-          try {
-            while (true) {
-              auto idx = next_idx.fetch_add(1);
-              if (idx >= num) break;
-              if (has_error) break;
-              func(idx);
-            }
-          } catch (...) {
-            has_error = true;
-            throw;
-          }
-        }));
-  }
-  for (auto& f : futures) f.get();
+  run_parallel((size_t)num, 1, get_parallel_threads(),
+      [&func](size_t start, size_t end, int) {
+        for (auto idx = (T)start; idx < (T)end; idx++) func(idx);
+      });
 }
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the two integer indices.
+// Parallel for on the thread pool. `Func` takes the two integer indices.
 template <typename T, typename Func>
 inline void parallel_for(T num1, T num2, Func&& func) {
-  auto         futures  = vector<future<void>>{};
-  auto         nthreads = std::thread::hardware_concurrency();
-  atomic<T>    next_idx(0);
-  atomic<bool> has_error(false);
-  for (auto thread_id = 0; thread_id < (int)nthreads; thread_id++) {
-    futures.emplace_back(std::async(
-        std::launch::async, [&func, &next_idx, &has_error, num1, num2]() {
-          try {
-            while (true) {
-              auto j = next_idx.fetch_add(1);
-              if (j >= num2) break;
-              if (has_error) break;
-              for (auto i = (T)0; i < num1; i++) func(i, j);
-            }
-          } catch (...) {
-            has_error = true;
-            throw;
-          }
-        }));
-  }
-  for (auto& f : futures) f.get();
+  run_parallel((size_t)num2, 1, get_parallel_threads(),
+      [&func, num1](size_t start, size_t end, int) {
+        for (auto j = (T)start; j < (T)end; j++) {
+          for (auto i = (T)0; i < num1; i++) func(i, j);
+        }
+      });
 }
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the integer index.
+// Parallel for on the thread pool. `Func` takes the integer index.
 template <typename T, typename Func>
 inline void parallel_for_batch(T num, T batch, Func&& func) {
-  auto         futures  = vector<future<void>>{};
-  auto         nthreads = std::thread::hardware_concurrency();
-  atomic<T>    next_idx(0);
-  atomic<bool> has_error(false);
-  for (auto thread_id = 0; thread_id < (int)nthreads; thread_id++) {
-    futures.emplace_back(std::async(
-        std::launch::async, [&func, &next_idx, &has_error, num, batch]() {
-          try {
-            while (true) {
-              auto start = next_idx.fetch_add(batch);
-              if (start >= num) break;
-              if (has_error) break;
-              auto end = std::min(num, start + batch);
-              for (auto i = (T)start; i < end; i++) func(i);
-            }
-          } catch (...) {
-            has_error = true;
-            throw;
-          }
-        }));
-  }
-  for (auto& f : futures) f.get();
+  run_parallel((size_t)num, (size_t)std::max(batch, (T)1),
+      get_parallel_threads(), [&func](size_t start, size_t end, int) {
+        for (auto idx = (T)start; idx < (T)end; idx++) func(idx);
+      });
 }
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes a reference to a `T`.
+// Parallel for on the thread pool, with at most `nworkers` threads.
+template <typename T, typename Func>
+inline void parallel_for_workers(T num, int nworkers, Func&& func) {
+  run_parallel((size_t)num, 1, nworkers,
+      [&func](size_t start, size_t end, int worker) {
+        for (auto idx = (T)start; idx < (T)end; idx++) func(idx, worker);
+      });
+}
+
+// Parallel for on the thread pool. `Func` takes a reference to a `T`.
 template <typename T, typename Func>
 inline void parallel_foreach(vector<T>& values, Func&& func) {
   parallel_for(
@@ -278,38 +503,29 @@ inline void parallel_foreach(const vector<T>& values, Func&& func) {
       values.size(), [&func, &values](size_t idx) { func(values[idx]); });
 }
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the integer index.
+// Parallel for on the thread pool. `Func` takes the integer index.
 template <typename T, typename Func>
 inline bool parallel_for(T num, string& error, Func&& func) {
-  auto         futures  = vector<future<void>>{};
-  auto         nthreads = std::thread::hardware_concurrency();
-  atomic<T>    next_idx(0);
   atomic<bool> has_error(false);
   mutex        error_mutex;
-  for (auto thread_id = 0; thread_id < (int)nthreads; thread_id++) {
-    futures.emplace_back(std::async(std::launch::async,
-        [&func, &next_idx, &has_error, &error_mutex, &error, num]() {
-          auto this_error = string{};
-          while (true) {
-            if (has_error) break;
-            auto idx = next_idx.fetch_add(1);
-            if (idx >= num) break;
-            if (!func(idx, this_error)) {
-              has_error = true;
-              auto _    = std::lock_guard{error_mutex};
-              error     = this_error;
-              break;
-            }
+  run_parallel((size_t)num, 1, get_parallel_threads(),
+      [&func, &has_error, &error_mutex, &error](
+          size_t start, size_t end, int) {
+        auto this_error = string{};
+        for (auto idx = (T)start; idx < (T)end; idx++) {
+          if (has_error) break;
+          if (!func(idx, this_error)) {
+            has_error = true;
+            auto _    = std::lock_guard{error_mutex};
+            error     = this_error;
+            break;
           }
-        }));
-  }
-  for (auto& f : futures) f.get();
+        }
+      });
   return !(bool)has_error;
 }
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes a reference to a `T`.
+// Parallel for on the thread pool. `Func` takes a reference to a `T`.
 template <typename T, typename Func>
 inline bool parallel_foreach(vector<T>& values, string& error, Func&& func) {
   return parallel_for(
@@ -166,6 +166,17 @@ inline int sample_discrete(const vector<float>& cdf, float r);
 // Pdf for uniform discrete distribution sampling.
 inline float sample_discrete_pdf(const vector<float>& cdf, int idx);
 
+// Build an alias table for a discrete distribution, with Vose's method.
+// On input, `probs` holds the unnormalized weights; on output, it holds the
+// acceptance probabilities of each bin, while `aliases` holds their aliases.
+// The table is built in-place in linear time.
+inline void make_discrete_alias(vector<float>& probs, vector<int>& aliases);
+// Sample a discrete distribution represented by its alias table in constant
+// time. Uses two random numbers, the first picks the bin, the second the
+// alias. Pdfs match the ones of `sample_discrete()` for the same weights.
+inline int sample_discrete_alias(
+    const vector<float>& probs, const vector<int>& aliases, float r, float ra);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -397,6 +408,59 @@ inline float sample_discrete_pdf(const vector<float>& cdf, int idx) {
   return cdf.at(idx) - cdf.at(idx - 1);
 }
 
+// Build an alias table for a discrete distribution. We use a sweeping
+// variant of Vose's method that pairs small and large bins in index order,
+// so that no work lists are needed.
+inline void make_discrete_alias(vector<float>& probs, vector<int>& aliases) {
+  auto size = (int)probs.size();
+  aliases.resize(size);
+  if (size == 0) return;
+  auto total = 0.0;
+  for (auto prob : probs) total += prob;
+  for (auto idx : range(size)) {
+    probs[idx]   = total > 0 ? (float)(probs[idx] * size / total) : 1;
+    aliases[idx] = idx;
+  }
+  auto is_small = [&](int idx) {
+    return probs[idx] < 1 && aliases[idx] == idx;
+  };
+  auto small = 0, large = 0;
+  while (small < size && !is_small(small)) small++;
+  while (large < size && probs[large] < 1) large++;
+  if (large >= size) return;
+  auto residual = (double)probs[large];
+  while (true) {
+    if (residual > 1 && small < size) {
+      // fill a small bin with the current large one
+      aliases[small] = large;
+      residual += probs[small] - 1;
+      small++;
+      while (small < size && !is_small(small)) small++;
+    } else {
+      // the large bin became small, fill it with the next large one
+      auto next = large + 1;
+      while (next < size && probs[next] < 1) next++;
+      if (next >= size) break;
+      probs[large]   = (float)residual;
+      aliases[large] = next;
+      residual       = probs[next] + residual - 1;
+      large          = next;
+    }
+  }
+  // remaining bins are full, up to numerical precision
+  probs[large] = 1;
+  for (; small < size; small++) {
+    if (is_small(small)) probs[small] = 1;
+  }
+}
+
+// Sample a discrete distribution represented by its alias table.
+inline int sample_discrete_alias(
+    const vector<float>& probs, const vector<int>& aliases, float r, float ra) {
+  auto idx = clamp((int)(r * probs.size()), 0, (int)probs.size() - 1);
+  return ra < probs[idx] ? idx : aliases[idx];
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
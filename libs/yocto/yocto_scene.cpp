@@ -29,19 +29,24 @@
 #include "yocto_scene.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <cctype>
 #include <climits>
 #include <cstdlib>
 #include <cstring>
+#include <future>
 #include <memory>
 #include <stdexcept>
+#include <thread>
 #include <unordered_map>
 
 #include "yocto_color.h"
 #include "yocto_geometry.h"
 #include "yocto_image.h"
 #include "yocto_noise.h"
+#include "yocto_parallel.h"
 #include "yocto_shading.h"
 #include "yocto_shape.h"
 
@@ -51,6 +56,7 @@
 namespace yocto {
 
 // using directives
+using std::array;
 using std::unique_ptr;
 using namespace std::string_literals;
 
@@ -107,19 +113,64 @@ ray3f eval_camera(
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+// sRGB to linear conversion table for byte textures
+static const auto srgb_to_rgb_table = []() {
+  auto table = array<float, 256>{};
+  for (auto idx : range(256)) table[idx] = srgb_to_rgb(byte_to_float((byte)idx));
+  return table;
+}();
+
+// Convert a byte texel to float, possibly to linear
+static vec4f byte_to_texel(const vec4b& color, bool as_linear) {
+  if (as_linear) {
+    return {srgb_to_rgb_table[color.x], srgb_to_rgb_table[color.y],
+        srgb_to_rgb_table[color.z], byte_to_float(color.w)};
+  } else {
+    return byte_to_float(color);
+  }
+}
+
 // pixel access
 vec4f lookup_texture(
     const texture_data& texture, int i, int j, bool as_linear) {
-  auto color = vec4f{0, 0, 0, 0};
-  if (!texture.pixelsf.empty()) {
-    color = texture.pixelsf[j * texture.width + i];
+  if (!texture.mips.empty()) {
+    return lookup_texture(texture, texture.mips.front(), i, j, as_linear);
+  } else if (!texture.pixelsf.empty()) {
+    auto color = texture.pixelsf[j * texture.width + i];
+    return (as_linear && !texture.linear) ? srgb_to_rgb(color) : color;
   } else {
-    color = byte_to_float(texture.pixelsb[j * texture.width + i]);
+    return byte_to_texel(
+        texture.pixelsb[j * texture.width + i], as_linear && !texture.linear);
   }
-  if (as_linear && !texture.linear) {
-    return srgb_to_rgb(color);
+}
+
+// Mip levels tile size
+const auto texture_tile = 8;
+
+// Index of a texel in a tiled mip level
+static int mip_index(const texture_mip& mip, int i, int j) {
+  auto ntiles = (mip.width + texture_tile - 1) / texture_tile;
+  auto tile   = (j / texture_tile) * ntiles + (i / texture_tile);
+  return tile * texture_tile * texture_tile +
+         (j % texture_tile) * texture_tile + (i % texture_tile);
+}
+
+// Size of a tiled mip level
+static int mip_size(int width, int height) {
+  auto ntiles_x = (width + texture_tile - 1) / texture_tile;
+  auto ntiles_y = (height + texture_tile - 1) / texture_tile;
+  return ntiles_x * ntiles_y * texture_tile * texture_tile;
+}
+
+// pixel access in a mip level
+vec4f lookup_texture(const texture_data& texture, const texture_mip& mip,
+    int i, int j, bool as_linear) {
+  if (!mip.pixelsf.empty()) {
+    auto color = mip.pixelsf[mip_index(mip, i, j)];
+    return (as_linear && !texture.linear) ? srgb_to_rgb(color) : color;
   } else {
-    return color;
+    return byte_to_texel(
+        mip.pixelsb[mip_index(mip, i, j)], as_linear && !texture.linear);
   }
 }
 
@@ -177,6 +228,129 @@ vec4f eval_texture(const scene_data& scene, int texture, const vec2f& uv,
       no_interpolation, clamp_to_edge);
 }
 
+// Evaluates a mip level at a point `uv`.
+static vec4f eval_texture(const texture_data& texture, const texture_mip& mip,
+    const vec2f& uv, bool as_linear, bool no_interpolation,
+    bool clamp_to_edge) {
+  // get coordinates normalized for tiling
+  auto size = vec2i{mip.width, mip.height};
+  auto s = 0.0f, t = 0.0f;
+  if (clamp_to_edge) {
+    s = clamp(uv.x, 0.0f, 1.0f) * size.x;
+    t = clamp(uv.y, 0.0f, 1.0f) * size.y;
+  } else {
+    s = fmod(uv.x, 1.0f) * size.x;
+    if (s < 0) s += size.x;
+    t = fmod(uv.y, 1.0f) * size.y;
+    if (t < 0) t += size.y;
+  }
+
+  // get image coordinates and residuals
+  auto i = clamp((int)s, 0, size.x - 1), j = clamp((int)t, 0, size.y - 1);
+  auto ii = (i + 1) % size.x, jj = (j + 1) % size.y;
+  auto u = s - i, v = t - j;
+
+  // handle interpolation
+  if (no_interpolation) {
+    return lookup_texture(texture, mip, i, j, as_linear);
+  } else {
+    return lookup_texture(texture, mip, i, j, as_linear) * (1 - u) * (1 - v) +
+           lookup_texture(texture, mip, i, jj, as_linear) * (1 - u) * v +
+           lookup_texture(texture, mip, ii, j, as_linear) * u * (1 - v) +
+           lookup_texture(texture, mip, ii, jj, as_linear) * u * v;
+  }
+}
+
+// Evaluates a texture at a level of detail, blending the two closest levels.
+vec4f eval_texture_lod(const texture_data& texture, const vec2f& uv, float lod,
+    bool as_linear) {
+  if (texture.mips.empty() || lod <= 0 || texture.nearest)
+    return eval_texture(texture, uv, as_linear);
+  auto nmips = (int)texture.mips.size();
+  lod        = min(lod, (float)(nmips - 1));
+  auto level = min((int)lod, nmips - 1), next = min(level + 1, nmips - 1);
+  auto alpha = lod - level;
+  auto color = eval_texture(
+      texture, texture.mips[level], uv, as_linear, false, texture.clamp);
+  if (alpha == 0 || next == level) return color;
+  return color * (1 - alpha) + eval_texture(texture, texture.mips[next], uv,
+                                   as_linear, false, texture.clamp) *
+                                   alpha;
+}
+vec4f eval_texture_lod(const scene_data& scene, int texture, const vec2f& uv,
+    float lod, bool as_linear) {
+  if (texture == invalidid) return {1, 1, 1, 1};
+  return eval_texture_lod(scene.textures[texture], uv, lod, as_linear);
+}
+
+// Build texture mip levels. The first level is a tiled copy of the texture,
+// that replaces its pixels, the others are halved with a box filter, down to
+// one texel.
+void make_texture_mips(texture_data& texture) {
+  if (!texture.mips.empty()) return;
+  if (texture.width == 0 || texture.height == 0) return;
+  auto as_float = !texture.pixelsf.empty();
+  auto to_mip   = [&](texture_mip& mip, int i, int j, const vec4f& linear) {
+    auto color = texture.linear ? linear : rgb_to_srgb(linear);
+    if (as_float) {
+      mip.pixelsf[mip_index(mip, i, j)] = color;
+    } else {
+      mip.pixelsb[mip_index(mip, i, j)] = float_to_byte(color);
+    }
+  };
+  auto alloc_mip = [&](int width, int height) {
+    auto& mip  = texture.mips.emplace_back();
+    mip.width  = width;
+    mip.height = height;
+    if (as_float) {
+      mip.pixelsf.assign(mip_size(width, height), {0, 0, 0, 0});
+    } else {
+      mip.pixelsb.assign(mip_size(width, height), {0, 0, 0, 0});
+    }
+  };
+
+  // first level
+  alloc_mip(texture.width, texture.height);
+  for (auto j : range(texture.height)) {
+    for (auto i : range(texture.width)) {
+      auto& mip = texture.mips.back();
+      if (as_float) {
+        mip.pixelsf[mip_index(mip, i, j)] =
+            texture.pixelsf[j * texture.width + i];
+      } else {
+        mip.pixelsb[mip_index(mip, i, j)] =
+            texture.pixelsb[j * texture.width + i];
+      }
+    }
+  }
+  texture.pixelsf = vector<vec4f>{};
+  texture.pixelsb = vector<vec4b>{};
+
+  // other levels, filtered in linear space
+  while (texture.mips.back().width > 1 || texture.mips.back().height > 1) {
+    auto prev = texture.mips.size() - 1;
+    auto pw = texture.mips[prev].width, ph = texture.mips[prev].height;
+    alloc_mip(max(pw / 2, 1), max(ph / 2, 1));
+    auto& src = texture.mips[prev];
+    auto& dst = texture.mips.back();
+    for (auto j : range(dst.height)) {
+      for (auto i : range(dst.width)) {
+        auto i0 = min(i * 2, pw - 1), i1 = min(i * 2 + 1, pw - 1);
+        auto j0 = min(j * 2, ph - 1), j1 = min(j * 2 + 1, ph - 1);
+        auto color = (lookup_texture(texture, src, i0, j0, true) +
+                         lookup_texture(texture, src, i1, j0, true) +
+                         lookup_texture(texture, src, i0, j1, true) +
+                         lookup_texture(texture, src, i1, j1, true)) /
+                     4;
+        to_mip(dst, i, j, color);
+      }
+    }
+  }
+}
+void make_texture_mips(scene_data& scene) {
+  for (auto& texture : scene.textures) make_texture_mips(texture);
+}
+
 // conversion from image
 texture_data image_to_texture(const image_data& image) {
   auto texture = texture_data{image.width, image.height, image.linear, {}, {}};
@@ -186,9 +360,29 @@ texture_data image_to_texture(const image_data& image) {
     texture.pixelsb.resize(image.pixels.size());
     float_to_byte(texture.pixelsb, image.pixels);
   }
+  texture.cutout = has_cutout_texels(texture);
   return texture;
 }
 
+// check if some texels are fully transparent
+bool has_cutout_texels(const texture_data& texture) {
+  for (auto& pixel : texture.pixelsf) {
+    if (pixel.w <= 0) return true;
+  }
+  for (auto& pixel : texture.pixelsb) {
+    if (pixel.w == 0) return true;
+  }
+  if (!texture.mips.empty()) {
+    auto& mip = texture.mips.front();
+    for (auto j : range(mip.height)) {
+      for (auto i : range(mip.width)) {
+        if (lookup_texture(texture, mip, i, j).w <= 0) return true;
+      }
+    }
+  }
+  return false;
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -298,6 +492,11 @@ vec3f eval_position(const scene_data& scene, const instance_data& instance,
     return transform_point(instance.frame,
         interpolate_quad(shape.positions[q.x], shape.positions[q.y],
             shape.positions[q.z], shape.positions[q.w], uv));
+  } else if (!shape.lines.empty() && shape.capsules) {
+    auto l = shape.lines[element];
+    return transform_point(instance.frame,
+        capsule_point(shape.positions[l.x], shape.positions[l.y],
+            shape.radius[l.x], shape.radius[l.y], uv));
   } else if (!shape.lines.empty()) {
     auto l = shape.lines[element];
     return transform_point(instance.frame,
@@ -339,6 +538,13 @@ vec3f eval_element_normal(
 vec3f eval_normal(const scene_data& scene, const instance_data& instance,
     int element, const vec2f& uv) {
   auto& shape = scene.shapes[instance.shape];
+  if (!shape.lines.empty() && shape.capsules) {
+    auto l = shape.lines[element];
+    return transform_normal(
+        instance.frame, capsule_normal(shape.positions[l.x],
+                            shape.positions[l.y], shape.radius[l.x],
+                            shape.radius[l.y], uv));
+  }
   if (shape.normals.empty())
     return eval_element_normal(scene, instance, element);
   if (!shape.triangles.empty()) {
@@ -379,7 +585,8 @@ vec2f eval_texcoord(const scene_data& scene, const instance_data& instance,
         shape.texcoords[q.z], shape.texcoords[q.w], uv);
   } else if (!shape.lines.empty()) {
     auto l = shape.lines[element];
-    return interpolate_line(shape.texcoords[l.x], shape.texcoords[l.y], uv.x);
+    return interpolate_line(
+        shape.texcoords[l.x], shape.texcoords[l.y], clamp(uv.x, 0.0f, 1.0f));
   } else if (!shape.points.empty()) {
     return shape.texcoords[shape.points[element]];
   } else {
@@ -494,6 +701,9 @@ vec3f eval_shading_normal(const scene_data& scene,
     }
     if (material.type == material_type::refractive) return normal;
     return dot(normal, outgoing) >= 0 ? normal : -normal;
+  } else if (!shape.lines.empty() && shape.capsules) {
+    auto normal = eval_normal(scene, instance, element, uv);
+    return dot(normal, outgoing) >= 0 ? normal : -normal;
   } else if (!shape.lines.empty()) {
     auto normal = eval_normal(scene, instance, element, uv);
     return orthonormalize(outgoing, normal);
@@ -519,7 +729,8 @@ vec4f eval_color(const scene_data& scene, const instance_data& instance,
         shape.colors[q.z], shape.colors[q.w], uv);
   } else if (!shape.lines.empty()) {
     auto l = shape.lines[element];
-    return interpolate_line(shape.colors[l.x], shape.colors[l.y], uv.x);
+    return interpolate_line(
+        shape.colors[l.x], shape.colors[l.y], clamp(uv.x, 0.0f, 1.0f));
   } else if (!shape.points.empty()) {
     return shape.colors[shape.points[element]];
   } else {
@@ -530,18 +741,61 @@ vec4f eval_color(const scene_data& scene, const instance_data& instance,
 // Evaluate material
 material_point eval_material(const scene_data& scene,
     const instance_data& instance, int element, const vec2f& uv) {
+  return eval_material(scene, instance, element, uv, 0);
+}
+
+// Ratio of the texture space area over the world space area of an element,
+// used to convert ray footprints to texture levels of detail.
+static float eval_texcoord_density(
+    const scene_data& scene, const instance_data& instance, int element) {
+  auto& shape = scene.shapes[instance.shape];
+  if (shape.texcoords.empty()) return 0;
+  // world and texture space areas of a triangle
+  auto areas = [&](int a, int b, int c) {
+    auto& ta = shape.texcoords[a];
+    return vec2f{
+        triangle_area(transform_point(instance.frame, shape.positions[a]),
+            transform_point(instance.frame, shape.positions[b]),
+            transform_point(instance.frame, shape.positions[c])),
+        abs(cross(shape.texcoords[b] - ta, shape.texcoords[c] - ta)) / 2};
+  };
+  auto area = vec2f{0, 0};
+  if (!shape.triangles.empty()) {
+    auto& t = shape.triangles[element];
+    area    = areas(t.x, t.y, t.z);
+  } else if (!shape.quads.empty()) {
+    auto& q = shape.quads[element];
+    area    = areas(q.x, q.y, q.w) + areas(q.z, q.w, q.y);
+  }
+  return area.x > 0 ? area.y / area.x : 0;
+}
+
+// Eval material, filtering textures over a ray footprint
+material_point eval_material(const scene_data& scene,
+    const instance_data& instance, int element, const vec2f& uv,
+    float footprint) {
   auto& material = scene.materials[instance.material];
   auto  texcoord = eval_texcoord(scene, instance, element, uv);
 
+  // texture lookup, with level of detail if requested
+  auto density  = footprint > 0
+                      ? eval_texcoord_density(scene, instance, element)
+                      : 0.0f;
+  auto eval_tex = [&](int texture, bool as_linear) {
+    if (density <= 0 || texture == invalidid)
+      return eval_texture(scene, texture, texcoord, as_linear);
+    auto& texture_ = scene.textures[texture];
+    auto  lod      = log2(footprint * sqrt(density * texture_.width *
+                                           (float)texture_.height));
+    return eval_texture_lod(texture_, texcoord, lod, as_linear);
+  };
+
   // evaluate textures
-  auto emission_tex = eval_texture(
-      scene, material.emission_tex, texcoord, true);
-  auto color_shp     = eval_color(scene, instance, element, uv);
-  auto color_tex     = eval_texture(scene, material.color_tex, texcoord, true);
-  auto roughness_tex = eval_texture(
-      scene, material.roughness_tex, texcoord, false);
-  auto scattering_tex = eval_texture(
-      scene, material.scattering_tex, texcoord, true);
+  auto emission_tex   = eval_tex(material.emission_tex, true);
+  auto color_shp      = eval_color(scene, instance, element, uv);
+  auto color_tex      = eval_tex(material.color_tex, true);
+  auto roughness_tex  = eval_tex(material.roughness_tex, false);
+  auto scattering_tex = eval_tex(material.scattering_tex, true);
 
   // material point
   auto point         = material_point{};
@@ -580,6 +834,24 @@ material_point eval_material(const scene_data& scene,
   return point;
 }
 
+// Eval material opacity, skipping the other material properties.
+float eval_opacity(const scene_data& scene, const instance_data& instance,
+    int element, const vec2f& uv) {
+  auto& material  = scene.materials[instance.material];
+  auto  texcoord  = eval_texcoord(scene, instance, element, uv);
+  auto  color_shp = eval_color(scene, instance, element, uv);
+  auto  color_tex = eval_texture(scene, material.color_tex, texcoord, true);
+  return material.opacity * color_tex.w * color_shp.w;
+}
+
+// check if an instance has fully transparent texels. Uniform opacity and
+// vertex colors are left to the samplers, since texels cannot skip them.
+bool is_alphatested(const scene_data& scene, const instance_data& instance) {
+  auto& material = scene.materials[instance.material];
+  return material.color_tex != invalidid &&
+         scene.textures[material.color_tex].cutout;
+}
+
 // check if an instance is volumetric
 bool is_volumetric(const scene_data& scene, const instance_data& instance) {
   return is_volumetric(scene.materials[instance.material]);
@@ -729,6 +1001,64 @@ bbox3f compute_bounds(const scene_data& scene) {
   return bbox;
 }
 
+// Level-of-detail chains of shapes
+vector<vector<int>> find_shape_lods(const scene_data& scene) {
+  auto shape_map = unordered_map<string, int>{};
+  for (auto idx : range(scene.shape_names.size()))
+    shape_map[scene.shape_names[idx]] = (int)idx;
+  auto lods = vector<vector<int>>{};
+  for (auto idx : range(scene.shape_names.size())) {
+    auto& name = scene.shape_names[idx];
+    if (name.find("_lod") != string::npos) continue;
+    auto chain = vector<int>{(int)idx};
+    while (true) {
+      auto it = shape_map.find(name + "_lod" + std::to_string(chain.size()));
+      if (it == shape_map.end()) break;
+      chain.push_back(it->second);
+    }
+    if (chain.size() > 1) lods.push_back(chain);
+  }
+  return lods;
+}
+
+// Switch instances of lod chains to the level matching their screen size
+void select_shape_lods(scene_data& scene, const vector<vector<int>>& lods,
+    const camera_data& camera, int resolution, float lod_pixels) {
+  // chain and level of each shape
+  auto shape_lods = vector<vec2i>(scene.shapes.size(), {-1, -1});
+  for (auto chain : range(lods.size())) {
+    for (auto level : range(lods[chain].size())) {
+      shape_lods[lods[chain][level]] = {(int)chain, (int)level};
+    }
+  }
+
+  // bounds of the finest levels
+  auto shape_bbox = vector<bbox3f>(lods.size(), invalidb3f);
+  for (auto chain : range(lods.size())) {
+    for (auto p : scene.shapes[lods[chain].front()].positions)
+      shape_bbox[chain] = merge(shape_bbox[chain], p);
+  }
+
+  // pick levels from the projected size of the instance bounds; the larger
+  // film side spans the image resolution
+  for (auto& instance : scene.instances) {
+    auto [chain, level] = shape_lods[instance.shape];
+    if (chain < 0) continue;
+    auto bbox   = transform_bbox(instance.frame, shape_bbox[chain]);
+    auto radius = length(bbox.max - bbox.min) / 2;
+    auto dist   = camera.orthographic
+                      ? 1.0f
+                      : max(distance(camera.frame.o, center(bbox)) - radius,
+                            camera.lens);
+    auto pixels = 2 * radius * camera.lens / (dist * camera.film) * resolution;
+    auto levels = (int)lods[chain].size();
+    level       = pixels <= 0 ? levels - 1
+                              : clamp((int)ceil(log2(lod_pixels / pixels)), 0,
+                                    levels - 1);
+    instance.shape = lods[chain][level];
+  }
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -807,9 +1137,10 @@ void tesselate_subdiv(
 
 void tesselate_subdivs(scene_data& scene) {
   // tesselate shapes
-  for (auto& subdiv : scene.subdivs) {
+  parallel_for(scene.subdivs.size(), [&](size_t idx) {
+    auto& subdiv = scene.subdivs[idx];
     tesselate_subdiv(scene.shapes[subdiv.shape], subdiv, scene);
-  }
+  });
 }
 
 }  // namespace yocto
@@ -819,51 +1150,6 @@ void tesselate_subdivs(scene_data& scene) {
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-size_t compute_memory(const scene_data& scene) {
-  auto vector_memory = [](auto& values) -> size_t {
-    if (values.empty()) return 0;
-    return values.size() * sizeof(values[0]);
-  };
-
-  auto memory = (size_t)0;
-  memory += vector_memory(scene.cameras);
-  memory += vector_memory(scene.instances);
-  memory += vector_memory(scene.materials);
-  memory += vector_memory(scene.shapes);
-  memory += vector_memory(scene.textures);
-  memory += vector_memory(scene.environments);
-  memory += vector_memory(scene.camera_names);
-  memory += vector_memory(scene.instance_names);
-  memory += vector_memory(scene.material_names);
-  memory += vector_memory(scene.shape_names);
-  memory += vector_memory(scene.texture_names);
-  memory += vector_memory(scene.environment_names);
-  for (auto& shape : scene.shapes) {
-    memory += vector_memory(shape.points);
-    memory += vector_memory(shape.lines);
-    memory += vector_memory(shape.triangles);
-    memory += vector_memory(shape.quads);
-    memory += vector_memory(shape.positions);
-    memory += vector_memory(shape.normals);
-    memory += vector_memory(shape.texcoords);
-    memory += vector_memory(shape.colors);
-    memory += vector_memory(shape.triangles);
-  }
-  for (auto& subdiv : scene.subdivs) {
-    memory += vector_memory(subdiv.quadspos);
-    memory += vector_memory(subdiv.quadsnorm);
-    memory += vector_memory(subdiv.quadstexcoord);
-    memory += vector_memory(subdiv.positions);
-    memory += vector_memory(subdiv.normals);
-    memory += vector_memory(subdiv.texcoords);
-  }
-  for (auto& texture : scene.textures) {
-    memory += vector_memory(texture.pixelsb);
-    memory += vector_memory(texture.pixelsf);
-  }
-  return memory;
-}
-
 vector<string> scene_stats(const scene_data& scene, bool verbose) {
   auto accumulate = [](const auto& values, const auto& func) -> size_t {
     auto sum = (size_t)0;
@@ -897,7 +1183,7 @@ vector<string> scene_stats(const scene_data& scene, bool verbose) {
   stats.push_back("subdivs:      " + format(scene.subdivs.size()));
   stats.push_back("environments: " + format(scene.environments.size()));
   stats.push_back("textures:     " + format(scene.textures.size()));
-  stats.push_back("memory:       " + format(compute_memory(scene)));
+  stats.push_back("memory:       " + format(compute_memory(scene).bytes));
   stats.push_back(
       "points:       " + format(accumulate(scene.shapes,
                              [](auto& shape) { return shape.points.size(); })));
@@ -943,7 +1229,8 @@ vector<string> scene_validation(const scene_data& scene, bool notextures) {
   auto check_empty_textures = [&errs](const scene_data& scene) {
     for (auto idx : range(scene.textures.size())) {
       auto& texture = scene.textures[idx];
-      if (texture.pixelsf.empty() && texture.pixelsb.empty()) {
+      if (texture.pixelsf.empty() && texture.pixelsb.empty() &&
+          texture.mips.empty()) {
         errs.push_back("empty texture " + scene.texture_names[idx]);
       }
     }
@@ -962,6 +1249,263 @@ vector<string> scene_validation(const scene_data& scene, bool notextures) {
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// SCENE MEMORY
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Memory of scene elements
+memory_usage compute_memory(const texture_data& texture) {
+  auto memory = memory_usage{};
+  memory += vector_memory(texture.pixelsf);
+  memory += vector_memory(texture.pixelsb);
+  memory += vector_memory(texture.mips);
+  for (auto& mip : texture.mips) {
+    memory += vector_memory(mip.pixelsf);
+    memory += vector_memory(mip.pixelsb);
+  }
+  return memory;
+}
+memory_usage compute_memory(const subdiv_data& subdiv) {
+  auto memory = memory_usage{};
+  memory += vector_memory(subdiv.quadspos);
+  memory += vector_memory(subdiv.quadsnorm);
+  memory += vector_memory(subdiv.quadstexcoord);
+  memory += vector_memory(subdiv.positions);
+  memory += vector_memory(subdiv.normals);
+  memory += vector_memory(subdiv.texcoords);
+  return memory;
+}
+
+// Memory of names, counting characters only when allocated on the heap.
+static memory_usage names_memory(const vector<string>& names) {
+  auto memory = vector_memory(names);
+  for (auto& name : names) {
+    if (name.capacity() <= string{}.capacity()) continue;
+    memory.bytes += name.capacity() + 1;
+    memory.slack += name.capacity() - name.size();
+  }
+  return memory;
+}
+
+// Compute scene memory, per element and in total.
+scene_memory compute_scene_memory(const scene_data& scene) {
+  auto memory = scene_memory{};
+  for (auto& shape : scene.shapes)
+    memory.shapes.push_back(compute_memory(shape));
+  for (auto& subdiv : scene.subdivs)
+    memory.subdivs.push_back(compute_memory(subdiv));
+  for (auto& texture : scene.textures)
+    memory.textures.push_back(compute_memory(texture));
+  memory.other += vector_memory(scene.cameras);
+  memory.other += vector_memory(scene.instances);
+  memory.other += vector_memory(scene.environments);
+  memory.other += vector_memory(scene.shapes);
+  memory.other += vector_memory(scene.textures);
+  memory.other += vector_memory(scene.materials);
+  memory.other += vector_memory(scene.subdivs);
+  memory.other += names_memory(scene.camera_names);
+  memory.other += names_memory(scene.texture_names);
+  memory.other += names_memory(scene.material_names);
+  memory.other += names_memory(scene.shape_names);
+  memory.other += names_memory(scene.instance_names);
+  memory.other += names_memory(scene.environment_names);
+  memory.other += names_memory(scene.subdiv_names);
+  memory.total = memory.other;
+  for (auto& shape : memory.shapes) memory.total += shape;
+  for (auto& subdiv : memory.subdivs) memory.total += subdiv;
+  for (auto& texture : memory.textures) memory.total += texture;
+  return memory;
+}
+memory_usage compute_memory(const scene_data& scene) {
+  return compute_scene_memory(scene).total;
+}
+
+// Drop texture mips, moving the texels of the first level back to pixels.
+static void drop_texture_mips(texture_data& texture) {
+  if (texture.mips.empty()) return;
+  auto& mip = texture.mips.front();
+  if (!mip.pixelsf.empty()) {
+    texture.pixelsf = vector<vec4f>((size_t)texture.width * texture.height);
+    for (auto j : range(texture.height)) {
+      for (auto i : range(texture.width)) {
+        texture.pixelsf[j * texture.width + i] =
+            mip.pixelsf[mip_index(mip, i, j)];
+      }
+    }
+  } else {
+    texture.pixelsb = vector<vec4b>((size_t)texture.width * texture.height);
+    for (auto j : range(texture.height)) {
+      for (auto i : range(texture.width)) {
+        texture.pixelsb[j * texture.width + i] =
+            mip.pixelsb[mip_index(mip, i, j)];
+      }
+    }
+  }
+  texture.mips = vector<texture_mip>{};
+}
+
+// Halve a texture with a box filter. Mip levels are dropped.
+static void halve_texture(texture_data& texture) {
+  drop_texture_mips(texture);
+  auto width = max(texture.width / 2, 1), height = max(texture.height / 2, 1);
+  auto lookup = [&](int i, int j) {
+    i = min(i, texture.width - 1), j = min(j, texture.height - 1);
+    return texture.pixelsf.empty()
+               ? byte_to_float(texture.pixelsb[j * texture.width + i])
+               : texture.pixelsf[j * texture.width + i];
+  };
+  auto pixels = vector<vec4f>(width * height);
+  for (auto j : range(height)) {
+    for (auto i : range(width)) {
+      pixels[j * width + i] = (lookup(i * 2, j * 2) + lookup(i * 2 + 1, j * 2) +
+                                  lookup(i * 2, j * 2 + 1) +
+                                  lookup(i * 2 + 1, j * 2 + 1)) /
+                              4;
+    }
+  }
+  if (texture.pixelsf.empty()) {
+    texture.pixelsb = vector<vec4b>(pixels.size());
+    for (auto idx : range(pixels.size()))
+      texture.pixelsb[idx] = float_to_byte(pixels[idx]);
+  } else {
+    texture.pixelsf = std::move(pixels);
+  }
+  texture.width  = width;
+  texture.height = height;
+  texture.cutout = has_cutout_texels(texture);
+}
+
+// Reduce scene memory to fit in a budget. Data is released by assigning new
+// vectors, since clearing or assigning {} keeps the capacity.
+size_t reduce_scene_memory(scene_data& scene, size_t budget) {
+  auto fits = [&]() { return compute_memory(scene).bytes <= budget; };
+  if (fits()) return compute_memory(scene).bytes;
+
+  // free slack
+  for (auto& shape : scene.shapes) {
+    shape.points.shrink_to_fit();
+    shape.lines.shrink_to_fit();
+    shape.triangles.shrink_to_fit();
+    shape.quads.shrink_to_fit();
+    shape.positions.shrink_to_fit();
+    shape.normals.shrink_to_fit();
+    shape.texcoords.shrink_to_fit();
+    shape.colors.shrink_to_fit();
+    shape.radius.shrink_to_fit();
+    shape.tangents.shrink_to_fit();
+  }
+  for (auto& subdiv : scene.subdivs) {
+    subdiv.quadspos.shrink_to_fit();
+    subdiv.quadsnorm.shrink_to_fit();
+    subdiv.quadstexcoord.shrink_to_fit();
+    subdiv.positions.shrink_to_fit();
+    subdiv.normals.shrink_to_fit();
+    subdiv.texcoords.shrink_to_fit();
+  }
+  for (auto& texture : scene.textures) {
+    texture.pixelsf.shrink_to_fit();
+    texture.pixelsb.shrink_to_fit();
+  }
+  if (fits()) return compute_memory(scene).bytes;
+
+  // clear unused data
+  auto used_shapes   = vector<bool>(scene.shapes.size(), false);
+  auto used_textures = vector<bool>(scene.textures.size(), false);
+  auto textured      = vector<bool>(scene.shapes.size(), false);
+  auto normalmapped  = vector<bool>(scene.shapes.size(), false);
+  for (auto& instance : scene.instances) {
+    if (instance.shape == invalidid) continue;
+    used_shapes[instance.shape] = true;
+    if (instance.material == invalidid) continue;
+    auto& material = scene.materials[instance.material];
+    for (auto texture : {material.emission_tex, material.color_tex,
+             material.roughness_tex, material.scattering_tex,
+             material.normal_tex}) {
+      if (texture == invalidid) continue;
+      used_textures[texture]    = true;
+      textured[instance.shape] = true;
+    }
+    if (material.normal_tex != invalidid) normalmapped[instance.shape] = true;
+  }
+  for (auto& environment : scene.environments) {
+    if (environment.emission_tex != invalidid)
+      used_textures[environment.emission_tex] = true;
+  }
+  for (auto& subdiv : scene.subdivs) {
+    if (subdiv.displacement_tex != invalidid)
+      used_textures[subdiv.displacement_tex] = true;
+  }
+  for (auto idx : range(scene.shapes.size())) {
+    auto& shape = scene.shapes[idx];
+    if (!used_shapes[idx]) shape = {};
+    if (!textured[idx]) shape.texcoords = vector<vec2f>{};
+    if (!normalmapped[idx]) shape.tangents = vector<vec4f>{};
+  }
+  for (auto idx : range(scene.textures.size())) {
+    if (!used_textures[idx]) scene.textures[idx] = {};
+  }
+  if (fits()) return compute_memory(scene).bytes;
+
+  // store float textures with values in [0,1] as bytes. Linear textures are
+  // kept as floats: 8-bit linear values band in dark gradients, while sRGB
+  // encoding them would change the values read without as_linear.
+  auto is_ldr = [](const vector<vec4f>& pixels) {
+    for (auto& pixel : pixels) {
+      if (min(pixel) < 0 || max(pixel) > 1) return false;
+    }
+    return true;
+  };
+  auto to_bytes = [](const vector<vec4f>& pixels) {
+    auto bytes = vector<vec4b>(pixels.size());
+    for (auto idx : range(pixels.size()))
+      bytes[idx] = float_to_byte(pixels[idx]);
+    return bytes;
+  };
+  for (auto& texture : scene.textures) {
+    auto& pixelsf = texture.mips.empty() ? texture.pixelsf
+                                         : texture.mips.front().pixelsf;
+    if (texture.linear || pixelsf.empty() || !is_ldr(pixelsf)) continue;
+    texture.pixelsb = to_bytes(texture.pixelsf);
+    texture.pixelsf = vector<vec4f>{};
+    for (auto& mip : texture.mips) {
+      if (mip.pixelsf.empty()) continue;
+      mip.pixelsb = to_bytes(mip.pixelsf);
+      mip.pixelsf = vector<vec4f>{};
+    }
+    texture.cutout = has_cutout_texels(texture);
+  }
+  if (fits()) return compute_memory(scene).bytes;
+
+  // drop texture mips
+  for (auto& texture : scene.textures) drop_texture_mips(texture);
+  if (fits()) return compute_memory(scene).bytes;
+
+  // drop shading normals of triangles and quads
+  for (auto& shape : scene.shapes) {
+    if (!shape.triangles.empty() || !shape.quads.empty())
+      shape.normals = vector<vec3f>{};
+  }
+  if (fits()) return compute_memory(scene).bytes;
+
+  // halve the largest textures
+  while (!fits()) {
+    auto largest = invalidid;
+    auto bytes   = (size_t)0;
+    for (auto idx : range(scene.textures.size())) {
+      auto& texture = scene.textures[idx];
+      if (texture.width <= 1 && texture.height <= 1) continue;
+      auto memory = compute_memory(texture).bytes;
+      if (memory > bytes) largest = (int)idx, bytes = memory;
+    }
+    if (largest == invalidid) break;
+    halve_texture(scene.textures[largest]);
+  }
+  return compute_memory(scene).bytes;
+}
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // EXAMPLE SCENES
 // -----------------------------------------------------------------------------
@@ -90,18 +90,32 @@ struct camera_data {
   float   aperture     = 0;
 };
 
-// Texture data as array of float or byte pixels. Textures can be stored in
-// linear or non linear color space.
-struct texture_data {
+// Texture mip level. Pixels are stored in tiles of 8x8 texels, for cache
+// locality, and padded to a whole number of tiles.
+struct texture_mip {
   int           width   = 0;
   int           height  = 0;
-  bool          linear  = false;
-  bool          nearest = false;
-  bool          clamp   = false;
   vector<vec4f> pixelsf = {};
   vector<vec4b> pixelsb = {};
 };
 
+// Texture data as array of float or byte pixels. Textures can be stored in
+// linear or non linear color space. Mip levels are optional and built with
+// `make_texture_mips()`, that moves the pixels to the first level, leaving
+// the pixel arrays empty. Cutout tells whether some texels are fully
+// transparent, and is set when textures are loaded or built.
+struct texture_data {
+  int                 width   = 0;
+  int                 height  = 0;
+  bool                linear  = false;
+  bool                nearest = false;
+  bool                clamp   = false;
+  vector<vec4f>       pixelsf = {};
+  vector<vec4b>       pixelsb = {};
+  vector<texture_mip> mips    = {};
+  bool                cutout  = false;
+};
+
 // Material type
 enum struct material_type {
   // clang-format off
@@ -240,13 +254,31 @@ vec4f eval_texture(const texture_data& texture, const vec2f& uv, bool as_linear,
 vec4f eval_texture(const scene_data& scene, int texture, const vec2f& uv,
     bool as_linear, bool no_interpolation, bool clamp_to_edge);
 
-// pixel access
+// Evaluates a texture at a level of detail, i.e. a fractional mip level,
+// with trilinear filtering. Falls back to `eval_texture()` without mips.
+vec4f eval_texture_lod(const texture_data& texture, const vec2f& uv, float lod,
+    bool as_linear = false);
+vec4f eval_texture_lod(const scene_data& scene, int texture, const vec2f& uv,
+    float lod, bool as_linear = false);
+
+// pixel access, from the first mip level if mips were built
 vec4f lookup_texture(
     const texture_data& texture, int i, int j, bool as_linear = false);
+vec4f lookup_texture(const texture_data& texture, const texture_mip& mip,
+    int i, int j, bool as_linear = false);
+
+// Build texture mip levels, used for filtered lookups. Non-linear textures
+// are filtered in linear space. The first level is a tiled copy of the
+// pixels, that are released. Textures with mips are left unchanged.
+void make_texture_mips(texture_data& texture);
+void make_texture_mips(scene_data& scene);
 
 // conversion from image
 texture_data image_to_texture(const image_data& image);
 
+// check if some texels are fully transparent, used to set `cutout`
+bool has_cutout_texels(const texture_data& texture);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -315,6 +347,16 @@ vec4f eval_color(const scene_data& scene, const instance_data& instance,
 // Eval material to obtain emission, brdf and opacity.
 material_point eval_material(const scene_data& scene,
     const instance_data& instance, int element, const vec2f& uv);
+// Same as above, but filtering textures over a ray footprint, given as the
+// width of the ray cone at the hit point. Requires texture mips.
+material_point eval_material(const scene_data& scene,
+    const instance_data& instance, int element, const vec2f& uv,
+    float footprint);
+// Eval only the material opacity, as used for alpha-tested intersections.
+float eval_opacity(const scene_data& scene, const instance_data& instance,
+    int element, const vec2f& uv);
+// check if an instance has fully transparent texels, i.e. needs alpha testing
+bool is_alphatested(const scene_data& scene, const instance_data& instance);
 // check if a material has a volume
 bool is_volumetric(const scene_data& scene, const instance_data& instance);
 
@@ -340,6 +382,17 @@ namespace yocto {
 // compute scene bounds
 bbox3f compute_bounds(const scene_data& scene);
 
+// Level-of-detail chains of shapes, found from the shape names "name",
+// "name_lod1", "name_lod2", ... Each chain lists shape indices from the
+// finest to the coarsest level. Shapes without coarser levels are skipped.
+vector<vector<int>> find_shape_lods(const scene_data& scene);
+
+// Switch instances of lod chains to the level matching their screen size.
+// Instances that project to at least lod_pixels pixels use the finest
+// level, and each further level is used when the size halves again.
+void select_shape_lods(scene_data& scene, const vector<vector<int>>& lods,
+    const camera_data& camera, int resolution, float lod_pixels);
+
 // add missing elements
 void add_camera(scene_data& scene);
 void add_sky(scene_data& scene, float sun_angle = pif / 4);
@@ -361,6 +414,40 @@ vector<string> scene_validation(
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+// SCENE MEMORY
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Memory of scene elements, including mip levels for textures.
+memory_usage compute_memory(const texture_data& texture);
+memory_usage compute_memory(const subdiv_data& subdiv);
+
+// Memory of a scene, per element and in total. Other accounts for cameras,
+// instances, materials, environments and names.
+struct scene_memory {
+  vector<memory_usage> shapes   = {};
+  vector<memory_usage> subdivs  = {};
+  vector<memory_usage> textures = {};
+  memory_usage         other    = {};
+  memory_usage         total    = {};
+};
+
+// Compute scene memory, per element and in total.
+scene_memory compute_scene_memory(const scene_data& scene);
+memory_usage compute_memory(const scene_data& scene);
+
+// Reduce scene memory to fit in `budget` bytes. Reductions are tried in
+// order of visual impact, stopping as soon as the scene fits: free slack;
+// clear shapes and textures not used by instances, materials and
+// environments, with tangents and texcoords not used by materials;
+// store non-linear float textures with values in [0,1] as bytes; drop mips;
+// drop shading normals of triangles and quads; halve the largest textures.
+// Returns the scene memory, that is over budget if reductions were not enough.
+size_t reduce_scene_memory(scene_data& scene, size_t budget);
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // SCENE TESSELATION
 // -----------------------------------------------------------------------------
@@ -53,6 +53,7 @@
 #include "yocto_geometry.h"
 #include "yocto_image.h"
 #include "yocto_modelio.h"
+#include "yocto_parallel.h"
 #include "yocto_pbrtio.h"
 #include "yocto_shading.h"
 #include "yocto_shape.h"
@@ -68,61 +69,6 @@ using namespace std::string_literals;
 
 }  // namespace yocto
 
-// -----------------------------------------------------------------------------
-// PARALLEL HELPERS
-// -----------------------------------------------------------------------------
-namespace yocto {
-
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the integer index.
-template <typename T, typename Func>
-inline bool parallel_for(T num, string& error, Func&& func) {
-  auto              futures  = vector<std::future<void>>{};
-  auto              nthreads = std::thread::hardware_concurrency();
-  std::atomic<T>    next_idx(0);
-  std::atomic<bool> has_error(false);
-  std::mutex        error_mutex;
-  for (auto thread_id = 0; thread_id < (int)nthreads; thread_id++) {
-    futures.emplace_back(std::async(std::launch::async,
-        [&func, &next_idx, &has_error, &error_mutex, &error, num]() {
-          auto this_error = string{};
-          while (true) {
-            if (has_error) break;
-            auto idx = next_idx.fetch_add(1);
-            if (idx >= num) break;
-            if (!func(idx, this_error)) {
-              has_error = true;
-              auto _    = std::lock_guard{error_mutex};
-              error     = this_error;
-              break;
-            }
-          }
-        }));
-  }
-  for (auto& f : futures) f.get();
-  return !(bool)has_error;
-}
-
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes a reference to a `T`.
-template <typename T, typename Func>
-inline bool parallel_foreach(vector<T>& values, string& error, Func&& func) {
-  return parallel_for(
-      values.size(), error, [&func, &values](size_t idx, string& error) {
-        return func(values[idx], error);
-      });
-}
-template <typename T, typename Func>
-inline bool parallel_foreach(
-    const vector<T>& values, string& error, Func&& func) {
-  return parallel_for(
-      values.size(), error, [&func, &values](size_t idx, string& error) {
-        return func(values[idx], error);
-      });
-}
-
-}  // namespace yocto
-
 // -----------------------------------------------------------------------------
 // PATH HELPERS
 // -----------------------------------------------------------------------------
@@ -162,9 +108,10 @@ string replace_extension(const string& path, const string& extension) {
   return make_path(path).replace_extension(ext).generic_u8string();
 }
 
-// Create a directory and all missing parent directories if needed
+// Create a directory and all missing parent directories if needed.
+// An empty path is the current directory.
 void make_directory(const string& path) {
-  if (path_exists(path)) return;
+  if (path.empty() || path_exists(path)) return;
   try {
     create_directories(make_path(path));
   } catch (...) {
@@ -172,9 +119,10 @@ void make_directory(const string& path) {
   }
 }
 
-// Create a directory and all missing parent directories if needed
+// Create a directory and all missing parent directories if needed.
+// An empty path is the current directory.
 bool make_directory(const string& path, string& error) {
-  if (path_exists(path)) return true;
+  if (path.empty() || path_exists(path)) return true;
   try {
     create_directories(make_path(path));
     return true;
@@ -714,6 +662,182 @@ bool save_image(
   }
 }
 
+// Converts a float to a half float, rounding to nearest even.
+static uint16_t float_to_half(float value) {
+  auto bits = (uint32_t)0;
+  memcpy(&bits, &value, sizeof(bits));
+  auto sign = (bits >> 16) & 0x8000u;
+  bits &= 0x7fffffffu;
+  if (bits >= 0x47800000u) {
+    // overflow, infinity or nan
+    return (uint16_t)(sign | (bits > 0x7f800000u ? 0x7e00u : 0x7c00u));
+  } else if (bits < 0x38800000u) {
+    // denormals and zero, rounded by a float addition
+    auto magic = 0.5f, denorm = 0.0f;
+    memcpy(&denorm, &bits, sizeof(bits));
+    denorm += magic;
+    memcpy(&bits, &denorm, sizeof(bits));
+    return (uint16_t)(sign | (bits - 0x3f000000u));
+  } else {
+    // normals, rebiased and rounded
+    auto odd = (bits >> 13) & 1u;
+    bits += 0xc8000fffu + odd;
+    return (uint16_t)(sign | (bits >> 13));
+  }
+}
+
+// Opens an image writer, writing the EXR header and the tile offsets. Since
+// tiles are uncompressed, their offsets are known in advance.
+bool open_image_writer(const string& filename, image_writer& writer,
+    int width, int height, int tilesize, string& error) {
+  auto ext = path_extension(filename);
+  if (ext != ".exr" && ext != ".EXR") {
+    error = "unsupported format " + filename;
+    return false;
+  }
+  if (width <= 0 || height <= 0 || tilesize <= 0) {
+    error = "invalid size for " + filename;
+    return false;
+  }
+  writer.filename = filename;
+  writer.width    = width;
+  writer.height   = height;
+  writer.tilesize = tilesize;
+  writer.next     = 0;
+  writer.fs.reset(fopen_utf8(filename, "wb"));
+  if (!writer.fs) {
+    error = "cannot create " + filename;
+    return false;
+  }
+
+  // header
+  auto header     = vector<byte>{};
+  auto write_data = [&header](const auto& value) {
+    header.insert(header.end(), (const byte*)&value,
+        (const byte*)&value + sizeof(value));
+  };
+  auto write_name = [&header](const string& name) {
+    header.insert(header.end(), name.begin(), name.end());
+    header.push_back(0);
+  };
+  auto write_attribute = [&](const string& name, const string& type,
+                             int size) {
+    write_name(name);
+    write_name(type);
+    write_data(size);
+  };
+  write_data((uint32_t)20000630);  // magic number
+  write_data((uint32_t)0x202);     // version 2, tiled
+  write_attribute("channels", "chlist", 4 * 18 + 1);
+  for (auto channel : {"A", "B", "G", "R"}) {
+    write_name(channel);
+    write_data((int32_t)1);  // half
+    write_data((uint32_t)0);
+    write_data((int32_t)1);
+    write_data((int32_t)1);
+  }
+  header.push_back(0);
+  write_attribute("compression", "compression", 1);
+  header.push_back(0);  // no compression
+  write_attribute("dataWindow", "box2i", 16);
+  write_data(vec4i{0, 0, width - 1, height - 1});
+  write_attribute("displayWindow", "box2i", 16);
+  write_data(vec4i{0, 0, width - 1, height - 1});
+  write_attribute("lineOrder", "lineOrder", 1);
+  header.push_back(0);  // increasing y
+  write_attribute("pixelAspectRatio", "float", 4);
+  write_data(1.0f);
+  write_attribute("screenWindowCenter", "v2f", 8);
+  write_data(vec2f{0, 0});
+  write_attribute("screenWindowWidth", "float", 4);
+  write_data(1.0f);
+  write_attribute("tiles", "tiledesc", 9);
+  write_data((uint32_t)tilesize);
+  write_data((uint32_t)tilesize);
+  header.push_back(0);  // one level, round down
+  header.push_back(0);
+
+  // tile offsets, for tiles in row-major order
+  auto ntiles_x = (width + tilesize - 1) / tilesize;
+  auto ntiles_y = (height + tilesize - 1) / tilesize;
+  auto offset   = (uint64_t)header.size() +
+                (uint64_t)ntiles_x * (uint64_t)ntiles_y * sizeof(uint64_t);
+  for (auto tile_y : range(ntiles_y)) {
+    for (auto tile_x : range(ntiles_x)) {
+      write_data(offset);
+      auto size_x = min(tilesize, width - tile_x * tilesize);
+      auto size_y = min(tilesize, height - tile_y * tilesize);
+      offset += 5 * sizeof(int32_t) + (uint64_t)size_x * (uint64_t)size_y *
+                                          4 * sizeof(uint16_t);
+    }
+  }
+
+  if (fwrite(header.data(), 1, header.size(), writer.fs.get()) !=
+      header.size()) {
+    error = "cannot write " + filename;
+    return false;
+  }
+  return true;
+}
+
+// Writes the next image tile.
+bool write_image_tile(image_writer& writer, const vec2i& start,
+    const image_data& tile, string& error) {
+  auto ntiles_x = (writer.width + writer.tilesize - 1) / writer.tilesize;
+  auto ntiles_y = (writer.height + writer.tilesize - 1) / writer.tilesize;
+  auto tile_x = writer.next % ntiles_x, tile_y = writer.next / ntiles_x;
+  if (!writer.fs || writer.next >= ntiles_x * ntiles_y ||
+      start != vec2i{tile_x, tile_y} * writer.tilesize) {
+    error = "tiles out of order in " + writer.filename;
+    return false;
+  }
+  if (tile.width != min(writer.tilesize, writer.width - start.x) ||
+      tile.height != min(writer.tilesize, writer.height - start.y)) {
+    error = "wrong tile size in " + writer.filename;
+    return false;
+  }
+
+  // tile data, stored by scanline with channels in alphabetical order
+  auto chunk      = vector<byte>{};
+  auto write_data = [&chunk](const auto& value) {
+    chunk.insert(chunk.end(), (const byte*)&value,
+        (const byte*)&value + sizeof(value));
+  };
+  auto pixels     = tile.pixels;
+  if (!tile.linear) srgb_to_rgb(pixels, tile.pixels);
+  write_data(vec4i{tile_x, tile_y, 0, 0});
+  write_data((int32_t)(pixels.size() * 4 * sizeof(uint16_t)));
+  for (auto j : range(tile.height)) {
+    for (auto channel : {3, 2, 1, 0}) {
+      for (auto i : range(tile.width)) {
+        write_data(float_to_half(pixels[(size_t)j * tile.width + i][channel]));
+      }
+    }
+  }
+  if (fwrite(chunk.data(), 1, chunk.size(), writer.fs.get()) !=
+      chunk.size()) {
+    error = "cannot write " + writer.filename;
+    return false;
+  }
+  writer.next += 1;
+  return true;
+}
+
+// Closes the image writer.
+bool close_image_writer(image_writer& writer, string& error) {
+  auto ntiles_x = (writer.width + writer.tilesize - 1) / writer.tilesize;
+  auto ntiles_y = (writer.height + writer.tilesize - 1) / writer.tilesize;
+  if (writer.next != ntiles_x * ntiles_y) {
+    error = "missing tiles in " + writer.filename;
+    return false;
+  }
+  if (fclose(writer.fs.release()) != 0) {
+    error = "cannot write " + writer.filename;
+    return false;
+  }
+  return true;
+}
+
 image_data make_image_preset(const string& type_) {
   auto type  = path_basename(type_);
   auto width = 1024, height = 1024;
@@ -860,6 +984,22 @@ void save_image(const string& filename, const image_data& image) {
   if (!save_image(filename, image, error)) throw io_error{error};
 }
 
+void open_image_writer(const string& filename, image_writer& writer,
+    int width, int height, int tilesize) {
+  auto error = string{};
+  if (!open_image_writer(filename, writer, width, height, tilesize, error))
+    throw io_error{error};
+}
+void write_image_tile(
+    image_writer& writer, const vec2i& start, const image_data& tile) {
+  auto error = string{};
+  if (!write_image_tile(writer, start, tile, error)) throw io_error{error};
+}
+void close_image_writer(image_writer& writer) {
+  auto error = string{};
+  if (!close_image_writer(writer, error)) throw io_error{error};
+}
+
 bool make_image_preset(
     const string& filename, image_data& image, string& error) {
   image = make_image_preset(path_basename(filename));
@@ -1792,8 +1932,8 @@ bool make_fvshape_preset(
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-// Loads/saves an image. Chooses hdr or ldr based on file name.
-bool load_texture(
+// Loads the pixels of an image. Chooses hdr or ldr based on file name.
+static bool load_texture_pixels(
     const string& filename, texture_data& texture, string& error) {
   auto read_error = [&]() {
     error = "cannot raed " + filename;
@@ -1881,6 +2021,14 @@ bool load_texture(
   }
 }
 
+// Loads/saves an image. Chooses hdr or ldr based on file name.
+bool load_texture(
+    const string& filename, texture_data& texture, string& error) {
+  if (!load_texture_pixels(filename, texture, error)) return false;
+  texture.cutout = has_cutout_texels(texture);
+  return true;
+}
+
 // Saves an hdr image.
 bool save_texture(
     const string& filename, const texture_data& texture, string& error) {
@@ -2139,12 +2287,13 @@ void add_missing_camera(scene_data& scene) {
 }
 
 // Add missing radius.
+static void add_missing_radius(shape_data& shape, float radius = 0.001f) {
+  if (shape.points.empty() && shape.lines.empty()) return;
+  if (!shape.radius.empty()) return;
+  shape.radius.assign(shape.positions.size(), radius);
+}
 static void add_missing_radius(scene_data& scene, float radius = 0.001f) {
-  for (auto& shape : scene.shapes) {
-    if (shape.points.empty() && shape.lines.empty()) continue;
-    if (!shape.radius.empty()) continue;
-    shape.radius.assign(shape.positions.size(), radius);
-  }
+  for (auto& shape : scene.shapes) add_missing_radius(shape, radius);
 }
 
 // Add missing cameras.
@@ -2169,19 +2318,20 @@ void add_missing_lights(scene_data& scene) {
 }
 
 // Reduce memory usage
+static void trim_memory(shape_data& shape) {
+  shape.points.shrink_to_fit();
+  shape.lines.shrink_to_fit();
+  shape.triangles.shrink_to_fit();
+  shape.quads.shrink_to_fit();
+  shape.positions.shrink_to_fit();
+  shape.normals.shrink_to_fit();
+  shape.texcoords.shrink_to_fit();
+  shape.colors.shrink_to_fit();
+  shape.radius.shrink_to_fit();
+  shape.tangents.shrink_to_fit();
+}
 static void trim_memory(scene_data& scene) {
-  for (auto& shape : scene.shapes) {
-    shape.points.shrink_to_fit();
-    shape.lines.shrink_to_fit();
-    shape.triangles.shrink_to_fit();
-    shape.quads.shrink_to_fit();
-    shape.positions.shrink_to_fit();
-    shape.normals.shrink_to_fit();
-    shape.texcoords.shrink_to_fit();
-    shape.colors.shrink_to_fit();
-    shape.radius.shrink_to_fit();
-    shape.tangents.shrink_to_fit();
-  }
+  for (auto& shape : scene.shapes) trim_memory(shape);
   for (auto& subdiv : scene.subdivs) {
     subdiv.positions.shrink_to_fit();
     subdiv.normals.shrink_to_fit();
@@ -2712,8 +2862,8 @@ bool make_scene_preset(
 namespace yocto {
 
 // Load/save a scene in the builtin JSON format.
-static bool load_json_scene(
-    const string& filename, scene_data& scene, string& error, bool noparallel);
+static bool load_json_scene(const string& filename, scene_data& scene,
+    string& error, const shape_callback& shape_loaded, bool noparallel);
 static bool save_json_scene(const string& filename, const scene_data& scene,
     string& error, bool noparallel);
 
@@ -2762,7 +2912,7 @@ bool load_scene(
     const string& filename, scene_data& scene, string& error, bool noparallel) {
   auto ext = path_extension(filename);
   if (ext == ".json" || ext == ".JSON") {
-    return load_json_scene(filename, scene, error, noparallel);
+    return load_json_scene(filename, scene, error, {}, noparallel);
   } else if (ext == ".obj" || ext == ".OBJ") {
     return load_obj_scene(filename, scene, error, noparallel);
   } else if (ext == ".gltf" || ext == ".GLTF") {
@@ -2807,6 +2957,26 @@ bool save_scene(const string& filename, const scene_data& scene, string& error,
   }
 }
 
+// Load a scene, calling `shape_loaded` as soon as each shape is loaded.
+// Only the JSON format loads shapes progressively. For the other formats, the
+// callbacks are called once the scene is loaded.
+bool load_scene(const string& filename, scene_data& scene, string& error,
+    const shape_callback& shape_loaded, bool noparallel) {
+  auto ext = path_extension(filename);
+  if (ext == ".json" || ext == ".JSON") {
+    return load_json_scene(filename, scene, error, shape_loaded, noparallel);
+  }
+  if (!load_scene(filename, scene, error, noparallel)) return false;
+  if (!shape_loaded) return true;
+  if (noparallel) {
+    for (auto idx : range(scene.shapes.size())) shape_loaded(scene, (int)idx);
+  } else {
+    parallel_for(scene.shapes.size(),
+        [&](size_t idx) { shape_loaded(scene, (int)idx); });
+  }
+  return true;
+}
+
 // Load/save a scene
 scene_data load_scene(const string& filename, bool noparallel) {
   auto error = string{};
@@ -2814,6 +2984,14 @@ scene_data load_scene(const string& filename, bool noparallel) {
   if (!load_scene(filename, scene, error, noparallel)) throw io_error{error};
   return scene;
 }
+scene_data load_scene(const string& filename,
+    const shape_callback& shape_loaded, bool noparallel) {
+  auto error = string{};
+  auto scene = scene_data{};
+  if (!load_scene(filename, scene, error, shape_loaded, noparallel))
+    throw io_error{error};
+  return scene;
+}
 void load_scene(const string& filename, scene_data& scene, bool noparallel) {
   auto error = string{};
   if (!load_scene(filename, scene, error, noparallel)) throw io_error{error};
@@ -3615,18 +3793,31 @@ static bool load_json_scene_version41(const string& filename, json_value& json,
 }
 
 // Load a scene in the builtin JSON format.
-static bool load_json_scene(
-    const string& filename, scene_data& scene, string& error, bool noparallel) {
+static bool load_json_scene(const string& filename, scene_data& scene,
+    string& error, const shape_callback& shape_loaded, bool noparallel) {
   // open file
   auto json = json_value{};
   if (!load_json(filename, json, error)) return false;
 
+  // old versions load all shapes before calling back
+  auto all_shapes_loaded = [&]() {
+    if (!shape_loaded) return true;
+    for (auto idx : range(scene.shapes.size())) shape_loaded(scene, (int)idx);
+    return true;
+  };
+
   // check version
-  if (!json.contains("asset") || !json.at("asset").contains("version"))
-    return load_json_scene_version40(filename, json, scene, error, noparallel);
+  if (!json.contains("asset") || !json.at("asset").contains("version")) {
+    if (!load_json_scene_version40(filename, json, scene, error, noparallel))
+      return false;
+    return all_shapes_loaded();
+  }
   if (json.contains("asset") && json.at("asset").contains("version") &&
-      json.at("asset").at("version") == "4.1")
-    return load_json_scene_version41(filename, json, scene, error, noparallel);
+      json.at("asset").at("version") == "4.1") {
+    if (!load_json_scene_version41(filename, json, scene, error, noparallel))
+      return false;
+    return all_shapes_loaded();
+  }
 
   // parse json value
   auto get_opt = [](const json_value& json, const string& key, auto& value) {
@@ -3635,6 +3826,7 @@ static bool load_json_scene(
 
   // filenames
   auto shape_filenames   = vector<string>{};
+  auto shape_capsules    = vector<bool>{};
   auto texture_filenames = vector<string>{};
   auto subdiv_filenames  = vector<string>{};
 
@@ -3723,11 +3915,14 @@ static bool load_json_scene(
       scene.shape_names.reserve(group.size());
       shape_filenames.reserve(group.size());
       for (auto& element : group) {
-        [[maybe_unused]] auto& shape = scene.shapes.emplace_back();
-        auto&                  name  = scene.shape_names.emplace_back();
-        auto&                  uri   = shape_filenames.emplace_back();
+        [[maybe_unused]] auto& shape    = scene.shapes.emplace_back();
+        auto&                  name     = scene.shape_names.emplace_back();
+        auto&                  uri      = shape_filenames.emplace_back();
+        auto                   capsules = false;
         get_opt(element, "name", name);
         get_opt(element, "uri", uri);
+        get_opt(element, "capsules", capsules);
+        shape_capsules.push_back(capsules);
       }
     }
     if (json.contains("subdivs")) {
@@ -3796,53 +3991,57 @@ static bool load_json_scene(
     return false;
   };
 
-  // load resources
-  if (noparallel) {
-    // load shapes
-    for (auto idx : range(scene.shapes.size())) {
-      if (!load_shape(path_join(dirname, shape_filenames[idx]),
-              scene.shapes[idx], error, true))
-        return dependent_error();
-    }
-    // load subdivs
-    for (auto idx : range(scene.subdivs.size())) {
-      if (!load_subdiv(path_join(dirname, subdiv_filenames[idx]),
-              scene.subdivs[idx], error))
-        return dependent_error();
+  // load resources as a single list of tasks, so that textures load while
+  // shapes are parsed, and shapes are handed to `shape_loaded` as soon as they
+  // are ready; larger files start first to balance the load
+  auto tasks = vector<pair<int, int>>{};  // (kind, index): shape, subdiv, tex
+  for (auto idx : range(scene.shapes.size())) tasks.push_back({0, (int)idx});
+  for (auto idx : range(scene.subdivs.size())) tasks.push_back({1, (int)idx});
+  for (auto idx : range(scene.textures.size())) tasks.push_back({2, (int)idx});
+  auto task_filename = [&](const pair<int, int>& task) {
+    auto& filenames = task.first == 0   ? shape_filenames
+                      : task.first == 1 ? subdiv_filenames
+                                        : texture_filenames;
+    return path_join(dirname, filenames[task.second]);
+  };
+  auto task_sizes = vector<uintmax_t>(tasks.size(), 0);
+  for (auto idx : range(tasks.size())) {
+    auto ec         = std::error_code{};
+    auto size       = file_size(make_path(task_filename(tasks[idx])), ec);
+    task_sizes[idx] = ec ? 0 : size;
+  }
+  auto order = vector<size_t>(tasks.size());
+  for (auto idx : range(order.size())) order[idx] = idx;
+  std::stable_sort(order.begin(), order.end(),
+      [&](size_t a, size_t b) { return task_sizes[a] > task_sizes[b]; });
+  auto load_task = [&](size_t idx, string& error) {
+    auto [kind, element] = tasks[order[idx]];
+    auto filename        = task_filename(tasks[order[idx]]);
+    if (kind == 0) {
+      auto& shape = scene.shapes[element];
+      if (!load_shape(filename, shape, error, true)) return false;
+      // apply shape flags lost when loading
+      shape.capsules = shape_capsules[element];
+      add_missing_radius(shape);
+      trim_memory(shape);
+      if (shape_loaded) shape_loaded(scene, element);
+      return true;
+    } else if (kind == 1) {
+      return load_subdiv(filename, scene.subdivs[element], error);
+    } else {
+      return load_texture(filename, scene.textures[element], error);
     }
-    // load textures
-    for (auto idx : range(scene.textures.size())) {
-      if (!load_texture(path_join(dirname, texture_filenames[idx]),
-              scene.textures[idx], error))
-        return dependent_error();
+  };
+  if (noparallel) {
+    for (auto idx : range(tasks.size())) {
+      if (!load_task(idx, error)) return dependent_error();
     }
   } else {
-    // load shapes
-    if (!parallel_for(
-            scene.shapes.size(), error, [&](size_t idx, string& error) {
-              return load_shape(path_join(dirname, shape_filenames[idx]),
-                  scene.shapes[idx], error, true);
-            }))
-      return dependent_error();
-    // load subdivs
-    if (!parallel_for(
-            scene.subdivs.size(), error, [&](size_t idx, string& error) {
-              return load_subdiv(path_join(dirname, subdiv_filenames[idx]),
-                  scene.subdivs[idx], error);
-            }))
-      return dependent_error();
-    // load textures
-    if (!parallel_for(
-            scene.textures.size(), error, [&](size_t idx, string& error) {
-              return load_texture(path_join(dirname, texture_filenames[idx]),
-                  scene.textures[idx], error);
-            }))
-      return dependent_error();
+    if (!parallel_for(tasks.size(), error, load_task)) return dependent_error();
   }
 
   // fix scene
   add_missing_camera(scene);
-  add_missing_radius(scene);
   trim_memory(scene);
 
   // done
@@ -3992,6 +4191,7 @@ static bool save_json_scene(const string& filename, const scene_data& scene,
       auto& element = append_object(group);
       set_val(element, "name", get_name(scene.shape_names, idx), "");
       set_val(element, "uri", shape_filenames[idx], "");
+      set_val(element, "capsules", shape.capsules, false);
     }
   }
 
@@ -5830,6 +6030,9 @@ static void to_json(json_value& json, const trace_params& value) {
   json["pratio"]         = value.pratio;
   json["denoise"]        = value.denoise;
   json["batch"]          = value.batch;
+  json["tilesize"]       = value.tilesize;
+  json["noise"]          = value.noise;
+  json["mipmaps"]        = value.mipmaps;
 }
 static void from_json(const json_value& json, trace_params& value) {
   value.camera         = json.value("camera", value.camera);
@@ -5849,6 +6052,9 @@ static void from_json(const json_value& json, trace_params& value) {
   value.pratio         = json.value("pratio", value.pratio);
   value.denoise        = json.value("denoise", value.denoise);
   value.batch          = json.value("batch", value.batch);
+  value.tilesize       = json.value("tilesize", value.tilesize);
+  value.noise          = json.value("noise", value.noise);
+  value.mipmaps        = json.value("mipmaps", value.mipmaps);
 }
 
 // Conversion to/from json
@@ -39,6 +39,9 @@
 // INCLUDES
 // -----------------------------------------------------------------------------
 
+#include <cstdio>
+#include <functional>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -87,6 +90,35 @@ image_data load_image(const string& filename);
 void       load_image(const string& filename, image_data& image);
 void       save_image(const string& filename, const image_data& image);
 
+// Image writer that saves an image one tile at a time, so that large images
+// are never fully held in memory. Only EXR is supported, saved as a tiled
+// image with half float channels. Tiles start at multiples of the tile size
+// and are written in row-major order.
+struct image_writer {
+  string filename = "";
+  int    width    = 0;
+  int    height   = 0;
+  int    tilesize = 0;
+  int    next     = 0;  // index of the next tile to write
+  std::unique_ptr<std::FILE, int (*)(std::FILE*)> fs = {nullptr, &std::fclose};
+};
+
+// Opens an image writer, writes a tile starting at pixel `start`, and checks
+// that all tiles were written when closing.
+bool open_image_writer(const string& filename, image_writer& writer,
+    int width, int height, int tilesize, string& error);
+bool write_image_tile(image_writer& writer, const vec2i& start,
+    const image_data& tile, string& error);
+bool close_image_writer(image_writer& writer, string& error);
+
+// Opens an image writer, writes a tile starting at pixel `start`, and checks
+// that all tiles were written when closing.
+void open_image_writer(const string& filename, image_writer& writer,
+    int width, int height, int tilesize);
+void write_image_tile(
+    image_writer& writer, const vec2i& start, const image_data& tile);
+void close_image_writer(image_writer& writer);
+
 // Make presets. Supported mostly in IO.
 image_data make_image_preset(const string& type);
 
@@ -190,6 +222,17 @@ bool load_scene(const string& filename, scene_data& scene, string& error,
 bool save_scene(const string& filename, const scene_data& scene, string& error,
     bool noparallel = false);
 
+// Called with the index of each shape, as soon as it is loaded. Callbacks
+// run concurrently on the loading threads, while the rest of the scene is
+// still loading, so they should only access the shape they are called for.
+using shape_callback = std::function<void(const scene_data& scene, int shape)>;
+
+// Load a scene in the supported formats, calling `shape_loaded` as soon as
+// each shape is loaded, so that per-shape work, like building shape bvhs,
+// overlaps loading. Only the JSON format loads progressively.
+bool load_scene(const string& filename, scene_data& scene, string& error,
+    const shape_callback& shape_loaded, bool noparallel = false);
+
 // Make missing scene directories
 bool make_scene_directories(
     const string& filename, const scene_data& scene, string& error);
@@ -197,6 +240,11 @@ bool make_scene_directories(
 // Add environment
 bool add_environment(scene_data& scene, const string& filename, string& error);
 
+// Load a scene in the supported formats, calling `shape_loaded` as soon as
+// each shape is loaded.
+scene_data load_scene(const string& filename,
+    const shape_callback& shape_loaded, bool noparallel = false);
+
 // Load/save a scene in the supported formats.
 scene_data load_scene(const string& filename, bool noparallel = false);
 void       load_scene(
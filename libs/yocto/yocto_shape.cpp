@@ -33,14 +33,18 @@
 #include "yocto_shape.h"
 
 #include <algorithm>
+#include <atomic>
 #include <deque>
+#include <future>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <thread>
 
 #include "yocto_geometry.h"
 #include "yocto_modelio.h"
 #include "yocto_noise.h"
+#include "yocto_parallel.h"
 #include "yocto_sampling.h"
 
 // -----------------------------------------------------------------------------
@@ -354,6 +358,22 @@ shape_data subdivide_shape(
   return subdivided;
 }
 
+// Shape memory
+memory_usage compute_memory(const shape_data& shape) {
+  auto memory = memory_usage{};
+  memory += vector_memory(shape.points);
+  memory += vector_memory(shape.lines);
+  memory += vector_memory(shape.triangles);
+  memory += vector_memory(shape.quads);
+  memory += vector_memory(shape.positions);
+  memory += vector_memory(shape.normals);
+  memory += vector_memory(shape.texcoords);
+  memory += vector_memory(shape.colors);
+  memory += vector_memory(shape.radius);
+  memory += vector_memory(shape.tangents);
+  return memory;
+}
+
 vector<string> shape_stats(const shape_data& shape, bool verbose) {
   auto format = [](auto num) {
     auto str = std::to_string(num);
@@ -2128,6 +2148,14 @@ static void update_bvh(bvh_tree& bvh, const vector<bbox3f>& bboxes) {
   }
 }
 
+// BVH memory
+memory_usage compute_memory(const bvh_tree& bvh) {
+  auto memory = memory_usage{};
+  memory += vector_memory(bvh.nodes);
+  memory += vector_memory(bvh.primitives);
+  return memory;
+}
+
 // Build shape bvh
 bvh_tree make_points_bvh(const vector<int>& points,
     const vector<vec3f>& positions, const vector<float>& radius) {
@@ -2774,64 +2802,161 @@ static pair<vector<vec3i>, vector<T>> subdivide_triangles_impl(
   return {ttriangles, tvertices};
 }
 
-// Subdivide quads.
+// Batch size used when subdividing in parallel
+const auto subdivide_batch = (size_t)4096;
+
+// Edges of a quad mesh used in subdivision. Edges are numbered in order of
+// first appearance, as in `make_edge_map()`. For each quad, we store the
+// indices of the edges starting at each corner, with -1 for the collapsed
+// edge of triangles.
+struct subdivide_edges {
+  vector<vec2i> edges      = {};
+  vector<int>   nfaces     = {};
+  vector<vec4i> quad_edges = {};
+};
+
+// Compute subdivision edges. Instead of hashing edges, half-edges are
+// bucketed by their smallest vertex, so that each bucket can be sorted
+// to find duplicates in parallel.
+static subdivide_edges make_subdivide_edges(
+    const vector<vec4i>& quads, size_t nverts) {
+  auto nhalfs = quads.size() * 4;
+  auto is_valid = [&](size_t half) {
+    auto& quad = quads[half / 4];
+    return half % 4 != 2 || quad.z != quad.w;
+  };
+  auto half_edge = [&](size_t half) {
+    auto& quad = quads[half / 4];
+    auto  a = quad[(int)(half % 4)], b = quad[(int)((half + 1) % 4)];
+    return a < b ? vec2i{a, b} : vec2i{b, a};
+  };
+
+  // bucket half-edges by their smallest vertex, in order
+  auto offsets = vector<int>(nverts + 1, 0);
+  for (auto half : range(nhalfs)) {
+    if (is_valid(half)) offsets[half_edge(half).x + 1] += 1;
+  }
+  for (auto vert : range(nverts)) offsets[vert + 1] += offsets[vert];
+  auto buckets = vector<int>(offsets.back());
+  auto cursors = vector<int>(offsets.begin(), offsets.end() - 1);
+  for (auto half : range(nhalfs)) {
+    if (is_valid(half)) buckets[cursors[half_edge(half).x]++] = (int)half;
+  }
+
+  // find the first half-edge of each edge, and count its faces, by sorting
+  // each bucket by the other vertex, so that the half-edges of an edge are
+  // adjacent and in order
+  auto first  = vector<int>(nhalfs, -1);
+  auto nfaces = vector<int>(nhalfs, 0);
+  parallel_for_batch(nverts, subdivide_batch, [&](size_t vert) {
+    auto begin = buckets.begin() + offsets[vert];
+    auto end   = buckets.begin() + offsets[vert + 1];
+    std::sort(begin, end, [&](int a, int b) {
+      auto va = half_edge(a).y, vb = half_edge(b).y;
+      return va < vb || (va == vb && a < b);
+    });
+    auto other = -1;
+    for (auto it = begin; it != end; ++it) {
+      if (it == begin || half_edge(*it) != half_edge(*(it - 1))) other = *it;
+      first[*it] = other;
+      nfaces[other] += 1;
+    }
+  });
+
+  // number edges in order of appearance
+  auto index  = vector<int>(nhalfs, -1);
+  auto nedges = 0;
+  for (auto half : range(nhalfs)) {
+    if (first[half] == (int)half) index[half] = nedges++;
+  }
+
+  // collect edges
+  auto sedges = subdivide_edges{};
+  sedges.edges.resize(nedges);
+  sedges.nfaces.resize(nedges);
+  sedges.quad_edges.resize(quads.size());
+  parallel_for_batch(nhalfs, subdivide_batch, [&](size_t half) {
+    if (first[half] == -1) {
+      sedges.quad_edges[half / 4][(int)(half % 4)] = -1;
+      return;
+    }
+    auto edge = index[first[half]];
+    sedges.quad_edges[half / 4][(int)(half % 4)] = edge;
+    if (first[half] == (int)half) {
+      sedges.edges[edge]  = half_edge(half);
+      sedges.nfaces[edge] = nfaces[half];
+    }
+  });
+  return sedges;
+}
+
+// Create subdivided vertices and quads, shared by quad and Catmull-Clark
+// subdivision. Vertices are the original ones, followed by edge and
+// face points.
 template <typename T>
-static pair<vector<vec4i>, vector<T>> subdivide_quads_impl(
-    const vector<vec4i>& quads, const vector<T>& vertices) {
-  // early exit
-  if (quads.empty() || vertices.empty()) return {quads, vertices};
-  // get edges
-  auto emap  = make_edge_map(quads);
-  auto edges = get_edges(emap);
+static pair<vector<vec4i>, vector<T>> split_quads(const vector<vec4i>& quads,
+    const vector<T>& vertices, const subdivide_edges& sedges) {
+  auto nverts = vertices.size(), nedges = sedges.edges.size();
   // create vertices
-  auto tvertices = vector<T>{};
-  tvertices.reserve(vertices.size() + edges.size() + quads.size());
-  for (auto& vertex : vertices) tvertices.push_back(vertex);
-  for (auto& edge : edges)
-    tvertices.push_back((vertices[edge.x] + vertices[edge.y]) / 2);
-  for (auto& quad : quads) {
+  auto tvertices = vector<T>(nverts + nedges + quads.size());
+  parallel_for_batch(nverts, subdivide_batch,
+      [&](size_t vert) { tvertices[vert] = vertices[vert]; });
+  parallel_for_batch(nedges, subdivide_batch, [&](size_t idx) {
+    auto& edge              = sedges.edges[idx];
+    tvertices[nverts + idx] = (vertices[edge.x] + vertices[edge.y]) / 2;
+  });
+  parallel_for_batch(quads.size(), subdivide_batch, [&](size_t idx) {
+    auto& quad = quads[idx];
     if (quad.z != quad.w) {
-      tvertices.push_back((vertices[quad.x] + vertices[quad.y] +
-                              vertices[quad.z] + vertices[quad.w]) /
-                          4);
+      tvertices[nverts + nedges + idx] = (vertices[quad.x] + vertices[quad.y] +
+                                             vertices[quad.z] +
+                                             vertices[quad.w]) /
+                                         4;
     } else {
-      tvertices.push_back(
-          (vertices[quad.x] + vertices[quad.y] + vertices[quad.z]) / 3);
+      tvertices[nverts + nedges + idx] =
+          (vertices[quad.x] + vertices[quad.y] + vertices[quad.z]) / 3;
     }
-  }
+  });
+
   // create quads
-  auto tquads = vector<vec4i>{};
-  tquads.reserve(quads.size() * 4);
-  auto edge_vertex = [&emap, nverts = (int)vertices.size()](const vec2i& edge) {
-    return nverts + edge_index(emap, edge);
-  };
-  auto quad_vertex = [nverts    = (int)vertices.size(),
-                         nedges = (int)edges.size()](size_t quad_id) {
-    return nverts + nedges + (int)quad_id;
-  };
-  for (auto&& [quad_id, quad] : enumerate(quads)) {
+  auto offsets = vector<int>(quads.size() + 1, 0);
+  for (auto&& [idx, quad] : enumerate(quads)) {
+    offsets[idx + 1] = offsets[idx] + (quad.z != quad.w ? 4 : 3);
+  }
+  auto tquads = vector<vec4i>(offsets.back());
+  parallel_for_batch(quads.size(), subdivide_batch, [&](size_t idx) {
+    auto& quad  = quads[idx];
+    auto  edge  = sedges.quad_edges[idx] + (int)nverts;
+    auto  face  = (int)(nverts + nedges + idx);
+    auto  split = tquads.data() + offsets[idx];
     if (quad.z != quad.w) {
-      tquads.push_back({quad.x, edge_vertex({quad.x, quad.y}),
-          quad_vertex(quad_id), edge_vertex({quad.w, quad.x})});
-      tquads.push_back({quad.y, edge_vertex({quad.y, quad.z}),
-          quad_vertex(quad_id), edge_vertex({quad.x, quad.y})});
-      tquads.push_back({quad.z, edge_vertex({quad.z, quad.w}),
-          quad_vertex(quad_id), edge_vertex({quad.y, quad.z})});
-      tquads.push_back({quad.w, edge_vertex({quad.w, quad.x}),
-          quad_vertex(quad_id), edge_vertex({quad.z, quad.w})});
+      split[0] = {quad.x, edge.x, face, edge.w};
+      split[1] = {quad.y, edge.y, face, edge.x};
+      split[2] = {quad.z, edge.z, face, edge.y};
+      split[3] = {quad.w, edge.w, face, edge.z};
     } else {
-      tquads.push_back({quad.x, edge_vertex({quad.x, quad.y}),
-          quad_vertex(quad_id), edge_vertex({quad.z, quad.x})});
-      tquads.push_back({quad.y, edge_vertex({quad.y, quad.z}),
-          quad_vertex(quad_id), edge_vertex({quad.x, quad.y})});
-      tquads.push_back({quad.z, edge_vertex({quad.z, quad.x}),
-          quad_vertex(quad_id), edge_vertex({quad.y, quad.z})});
+      split[0] = {quad.x, edge.x, face, edge.w};
+      split[1] = {quad.y, edge.y, face, edge.x};
+      split[2] = {quad.z, edge.w, face, edge.y};
     }
-  }
+  });
+
   // done
   return {tquads, tvertices};
 }
 
+// Subdivide quads.
+template <typename T>
+static pair<vector<vec4i>, vector<T>> subdivide_quads_impl(
+    const vector<vec4i>& quads, const vector<T>& vertices) {
+  // early exit
+  if (quads.empty() || vertices.empty()) return {quads, vertices};
+  // get edges
+  auto sedges = make_subdivide_edges(quads, vertices.size());
+  // create vertices and quads
+  return split_quads(quads, vertices, sedges);
+}
+
 // Subdivide beziers.
 template <typename T>
 static pair<vector<vec4i>, vector<T>> subdivide_beziers_impl(
@@ -2876,63 +3001,21 @@ static pair<vector<vec4i>, vector<T>> subdivide_catmullclark_impl(
   // early exit
   if (quads.empty() || vertices.empty()) return {quads, vertices};
   // get edges
-  auto emap     = make_edge_map(quads);
-  auto edges    = get_edges(emap);
-  auto boundary = get_boundary(emap);
+  auto sedges = make_subdivide_edges(quads, vertices.size());
 
   // split elements ------------------------------------
-  // create vertices
-  auto tvertices = vector<T>{};
-  tvertices.reserve(vertices.size() + edges.size() + quads.size());
-  for (auto& vertex : vertices) tvertices.push_back(vertex);
-  for (auto& edge : edges)
-    tvertices.push_back((vertices[edge.x] + vertices[edge.y]) / 2);
-  for (auto& quad : quads) {
-    if (quad.z != quad.w) {
-      tvertices.push_back((vertices[quad.x] + vertices[quad.y] +
-                              vertices[quad.z] + vertices[quad.w]) /
-                          4);
-    } else {
-      tvertices.push_back(
-          (vertices[quad.x] + vertices[quad.y] + vertices[quad.z]) / 3);
-    }
-  }
-  // create quads
-  auto tquads = vector<vec4i>{};
-  tquads.reserve(quads.size() * 4);
-  auto edge_vertex = [&emap, nverts = (int)vertices.size()](const vec2i& edge) {
-    return nverts + edge_index(emap, edge);
-  };
-  auto quad_vertex = [nverts    = (int)vertices.size(),
-                         nedges = (int)edges.size()](size_t quad_id) {
-    return nverts + nedges + (int)quad_id;
-  };
-  for (auto&& [quad_id, quad] : enumerate(quads)) {
-    if (quad.z != quad.w) {
-      tquads.push_back({quad.x, edge_vertex({quad.x, quad.y}),
-          quad_vertex(quad_id), edge_vertex({quad.w, quad.x})});
-      tquads.push_back({quad.y, edge_vertex({quad.y, quad.z}),
-          quad_vertex(quad_id), edge_vertex({quad.x, quad.y})});
-      tquads.push_back({quad.z, edge_vertex({quad.z, quad.w}),
-          quad_vertex(quad_id), edge_vertex({quad.y, quad.z})});
-      tquads.push_back({quad.w, edge_vertex({quad.w, quad.x}),
-          quad_vertex(quad_id), edge_vertex({quad.z, quad.w})});
-    } else {
-      tquads.push_back({quad.x, edge_vertex({quad.x, quad.y}),
-          quad_vertex(quad_id), edge_vertex({quad.z, quad.x})});
-      tquads.push_back({quad.y, edge_vertex({quad.y, quad.z}),
-          quad_vertex(quad_id), edge_vertex({quad.x, quad.y})});
-      tquads.push_back({quad.z, edge_vertex({quad.z, quad.x}),
-          quad_vertex(quad_id), edge_vertex({quad.y, quad.z})});
-    }
-  }
+  auto  split     = split_quads(quads, vertices, sedges);
+  auto& tquads    = split.first;
+  auto& tvertices = split.second;
 
   // split boundary
   auto tboundary = vector<vec2i>{};
-  tboundary.reserve(boundary.size());
-  for (auto& edge : boundary) {
-    tboundary.push_back({edge.x, edge_vertex(edge)});
-    tboundary.push_back({edge_vertex(edge), edge.y});
+  for (auto idx : range(sedges.edges.size())) {
+    if (sedges.nfaces[idx] >= 2) continue;
+    auto& edge   = sedges.edges[idx];
+    auto  vertex = (int)(vertices.size() + idx);
+    tboundary.push_back({edge.x, vertex});
+    tboundary.push_back({vertex, edge.y});
   }
 
   // setup creases -----------------------------------
@@ -2970,25 +3053,44 @@ static pair<vector<vec4i>, vector<T>> subdivide_catmullclark_impl(
       acount[vid] += 1;
     }
   }
+
+  // quad centroids are gathered by each vertex in quad order, so that the
+  // result does not depend on the number of threads
+  auto centroids = vector<T>(tquads.size());
+  parallel_for_batch(tquads.size(), subdivide_batch, [&](size_t idx) {
+    auto& quad     = tquads[idx];
+    centroids[idx] = (tvertices[quad.x] + tvertices[quad.y] +
+                         tvertices[quad.z] + tvertices[quad.w]) /
+                     4;
+  });
+  auto offsets = vector<int>(tvertices.size() + 1, 0);
   for (auto& quad : tquads) {
-    auto centroid = (tvertices[quad.x] + tvertices[quad.y] + tvertices[quad.z] +
-                        tvertices[quad.w]) /
-                    4;
+    for (auto vid : {quad.x, quad.y, quad.z, quad.w}) offsets[vid + 1] += 1;
+  }
+  for (auto idx : range(tvertices.size())) offsets[idx + 1] += offsets[idx];
+  auto vert_quads = vector<int>(offsets.back());
+  auto cursors    = vector<int>(offsets.begin(), offsets.end() - 1);
+  for (auto idx : range(tquads.size())) {
+    auto& quad = tquads[idx];
     for (auto vid : {quad.x, quad.y, quad.z, quad.w}) {
-      if (tvert_val[vid] != 2) continue;
-      avert[vid] += centroid;
-      acount[vid] += 1;
+      vert_quads[cursors[vid]++] = (int)idx;
     }
   }
-  for (auto i : range(tvertices.size())) avert[i] /= (float)acount[i];
+  parallel_for_batch(tvertices.size(), subdivide_batch, [&](size_t i) {
+    if (tvert_val[i] == 2) {
+      for (auto idx : range(offsets[i], offsets[i + 1])) {
+        avert[i] += centroids[vert_quads[idx]];
+        acount[i] += 1;
+      }
+    }
+    avert[i] /= (float)acount[i];
 
-  // correction pass ----------------------------------
-  // p = p + (avg_p - p) * (4/avg_count)
-  for (auto i : range(tvertices.size())) {
-    if (tvert_val[i] != 2) continue;
+    // correction pass ----------------------------------
+    // p = p + (avg_p - p) * (4/avg_count)
+    if (tvert_val[i] != 2) return;
     avert[i] = tvertices[i] +
                (avert[i] - tvertices[i]) * (4 / (float)acount[i]);
-  }
+  });
   tvertices = avert;
 
   // done
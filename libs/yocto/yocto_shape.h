@@ -85,6 +85,9 @@ struct shape_data {
   vector<vec4f> colors    = {};
   vector<float> radius    = {};
   vector<vec4f> tangents  = {};
+
+  // render lines as tapered capsules, instead of hair-like ribbons
+  bool capsules = false;
 };
 
 // Interpolate vertex data
@@ -127,6 +130,21 @@ shape_data subdivide_shape(
 // Shape statistics
 vector<string> shape_stats(const shape_data& shape, bool verbose = false);
 
+// Memory allocated for some data, in bytes. Slack is the part of it that is
+// allocated but not used, i.e. vector capacity beyond the vector size.
+struct memory_usage {
+  size_t bytes = 0;
+  size_t slack = 0;
+};
+
+// Memory allocated for a vector, and sum of memory usages
+template <typename T>
+inline memory_usage  vector_memory(const vector<T>& values);
+inline memory_usage& operator+=(memory_usage& usage, const memory_usage& other);
+
+// Shape memory
+memory_usage compute_memory(const shape_data& shape);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -488,6 +506,9 @@ struct bvh_tree {
   vector<int>      primitives = {};
 };
 
+// BVH memory
+memory_usage compute_memory(const bvh_tree& bvh);
+
 // Results of intersect_xxx and overlap_xxx functions that include hit flag,
 // instance id, shape element id, shape element uv and intersection distance.
 // The values are all set for scene intersection. Shape intersection does not
@@ -965,6 +986,26 @@ void make_heightfield(vector<vec4i>& quads, vector<vec3f>& positions,
 //
 // -----------------------------------------------------------------------------
 
+// -----------------------------------------------------------------------------
+// SHAPE DATA AND UTILITIES
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Memory allocated for a vector, and sum of memory usages
+template <typename T>
+inline memory_usage vector_memory(const vector<T>& values) {
+  return {values.capacity() * sizeof(T),
+      (values.capacity() - values.size()) * sizeof(T)};
+}
+inline memory_usage& operator+=(
+    memory_usage& usage, const memory_usage& other) {
+  usage.bytes += other.bytes;
+  usage.slack += other.slack;
+  return usage;
+}
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // SHAPE SUBDIVISION
 // -----------------------------------------------------------------------------
@@ -29,14 +29,17 @@
 #include "yocto_trace.h"
 
 #include <algorithm>
+#include <cstddef>
 #include <cstring>
 #include <future>
 #include <memory>
 #include <stdexcept>
+#include <type_traits>
 #include <utility>
 
 #include "yocto_color.h"
 #include "yocto_geometry.h"
+#include "yocto_parallel.h"
 #include "yocto_sampling.h"
 #include "yocto_shading.h"
 #include "yocto_shape.h"
@@ -46,35 +49,75 @@
 #endif
 
 // -----------------------------------------------------------------------------
-// PARALLEL HELPERS
+// SCRATCH MEMORY
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the two integer indices.
-template <typename T, typename Func>
-inline void parallel_for(T num1, T num2, Func&& func) {
-  auto              futures  = vector<std::future<void>>{};
-  auto              nthreads = std::thread::hardware_concurrency();
-  std::atomic<T>    next_idx(0);
-  std::atomic<bool> has_error(false);
-  for (auto thread_id = 0; thread_id < (int)nthreads; thread_id++) {
-    futures.emplace_back(std::async(
-        std::launch::async, [&func, &next_idx, &has_error, num1, num2]() {
-          try {
-            while (true) {
-              auto j = next_idx.fetch_add(1);
-              if (j >= num2) break;
-              if (has_error) break;
-              for (auto i = (T)0; i < num1; i++) func(i, j);
-            }
-          } catch (...) {
-            has_error = true;
-            throw;
-          }
-        }));
+// Allocation counters
+static std::atomic<size_t> trace_allocations     = 0;
+static std::atomic<size_t> trace_allocated_bytes = 0;
+
+// Record an allocation
+static void count_allocation(size_t bytes) {
+  trace_allocations += 1;
+  trace_allocated_bytes += bytes;
+}
+
+// Get allocation counters
+trace_alloc_stats get_trace_alloc_stats() {
+  return {trace_allocations, trace_allocated_bytes};
+}
+
+// Reset allocation counters
+void reset_trace_alloc_stats() {
+  trace_allocations     = 0;
+  trace_allocated_bytes = 0;
+}
+
+// Resize and fill a buffer, reusing its memory if large enough
+template <typename T>
+static void reset_buffer(vector<T>& buffer, size_t size, const T& value) {
+  if (buffer.capacity() < size) count_allocation(size * sizeof(T));
+  buffer.assign(size, value);
+}
+
+// Minimum size of arena chunks
+const auto trace_arena_chunk = (size_t)1 << 16;
+
+// Allocate and default-initialize an array from the arena. Memory is valid
+// until the next `reset_arena()`.
+template <typename T>
+static T* arena_alloc(trace_arena& arena, size_t count) {
+  static_assert(std::is_trivially_destructible_v<T>,
+      "arena types must be trivially destructible");
+  const auto align  = alignof(std::max_align_t);
+  auto       size   = count * sizeof(T);
+  auto       offset = (arena.used + align - 1) / align * align;
+  if (arena.chunks.empty() || offset + size > arena.chunks.back().size()) {
+    auto chunk_size = max(size, arena.chunks.empty()
+                                    ? trace_arena_chunk
+                                    : arena.chunks.back().size() * 2);
+    arena.chunks.emplace_back(chunk_size);
+    count_allocation(chunk_size);
+    offset = 0;
+  }
+  arena.used = offset + size;
+  auto data  = (T*)(arena.chunks.back().data() + offset);
+  std::uninitialized_default_construct_n(data, count);
+  return data;
+}
+
+// Release all arena memory at once. Chunks are merged, so that once the arena
+// has served its largest workload, it does not allocate anymore.
+static void reset_arena(trace_arena& arena) {
+  if (arena.chunks.size() > 1) {
+    auto size = (size_t)0;
+    for (auto& chunk : arena.chunks) size += chunk.size();
+    arena.chunks.clear();
+    arena.chunks.emplace_back(size);
+    count_allocation(size);
   }
-  for (auto& f : futures) f.get();
+  arena.used = 0;
 }
 
 }  // namespace yocto
@@ -94,14 +137,26 @@ trace_bvh make_trace_bvh(const scene_data& scene, const trace_params& params) {
         make_scene_bvh(scene, params.highqualitybvh, params.noparallel), {}};
   }
 }
+trace_bvh make_trace_bvh(const scene_data& scene, const trace_params& params,
+    vector<shape_bvh>&& shapes) {
+  if (params.embreebvh && embree_supported()) {
+    return make_trace_bvh(scene, params);
+  } else {
+    return {make_scene_bvh(scene, std::move(shapes), params.highqualitybvh,
+                params.noparallel),
+        {}};
+  }
+}
 
 // Ray-intersection shortcuts
+// Fully transparent texels are skipped during traversal with our bvh, while
+// partial opacity is still handled stochastically by the samplers.
 static scene_intersection intersect_scene(const trace_bvh& bvh,
     const scene_data& scene, const ray3f& ray, bool find_any = false) {
   if (bvh.ebvh.ebvh) {
     return intersect_scene_ebvh(bvh.ebvh, scene, ray, find_any);
   } else {
-    return intersect_scene_bvh(bvh.bvh, scene, ray, find_any);
+    return intersect_scene_bvh(bvh.bvh, scene, ray, find_any, true);
   }
 }
 static scene_intersection intersect_instance(const trace_bvh& bvh,
@@ -110,7 +165,7 @@ static scene_intersection intersect_instance(const trace_bvh& bvh,
   if (bvh.ebvh.ebvh) {
     return intersect_instance_ebvh(bvh.ebvh, scene, instance, ray, find_any);
   } else {
-    return intersect_instance_bvh(bvh.bvh, scene, instance, ray, find_any);
+    return intersect_instance_bvh(bvh.bvh, scene, instance, ray, find_any, true);
   }
 }
 
@@ -121,6 +176,24 @@ static scene_intersection intersect_instance(const trace_bvh& bvh,
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+// Ray cones used for texture filtering. Cones start with the angle of a
+// camera pixel and widen with the traveled distance. We ignore surface
+// curvature, which underestimates footprints after rough bounces, but keeps
+// the tracking to one float per path. Returns zero if mipmaps are disabled.
+static float get_cone_spread(
+    const scene_data& scene, const trace_params& params) {
+  if (!params.mipmaps) return 0;
+  auto& camera = scene.cameras[params.camera];
+  if (camera.orthographic) return 0;
+  return camera.film / camera.lens / params.resolution;
+}
+
+// Footprint of a ray cone on a surface
+static float eval_footprint(
+    float cone, const vec3f& normal, const vec3f& outgoing) {
+  return cone / max(abs(dot(normal, outgoing)), 0.01f);
+}
+
 // Convenience functions
 [[maybe_unused]] static vec3f eval_position(
     const scene_data& scene, const scene_intersection& intersection) {
@@ -157,6 +230,11 @@ namespace yocto {
   return eval_material(scene, scene.instances[intersection.instance],
       intersection.element, intersection.uv);
 }
+[[maybe_unused]] static material_point eval_material(const scene_data& scene,
+    const scene_intersection& intersection, float footprint) {
+  return eval_material(scene, scene.instances[intersection.instance],
+      intersection.element, intersection.uv, footprint);
+}
 [[maybe_unused]] static bool is_volumetric(
     const scene_data& scene, const scene_intersection& intersection) {
   return is_volumetric(scene, scene.instances[intersection.instance]);
@@ -362,10 +440,13 @@ static vec3f sample_lights(const scene_data& scene, const trace_lights& lights,
     const vec3f& position, float rl, float rel, const vec2f& ruv) {
   auto  light_id = sample_uniform((int)lights.lights.size(), rl);
   auto& light    = lights.lights[light_id];
+  // reuse the light random number to pick aliases
+  auto ral = clamp(rl * lights.lights.size() - light_id, 0.0f, 1.0f);
   if (light.instance != invalidid) {
     auto& instance  = scene.instances[light.instance];
     auto& shape     = scene.shapes[instance.shape];
-    auto  element   = sample_discrete(light.elements_cdf, rel);
+    auto  element   = sample_discrete_alias(
+        light.elements_prob, light.elements_alias, rel, ral);
     auto  uv        = (!shape.triangles.empty()) ? sample_triangle(ruv) : ruv;
     auto  lposition = eval_position(scene, instance, element, uv);
     return normalize(lposition - position);
@@ -373,7 +454,8 @@ static vec3f sample_lights(const scene_data& scene, const trace_lights& lights,
     auto& environment = scene.environments[light.environment];
     if (environment.emission_tex != invalidid) {
       auto& emission_tex = scene.textures[environment.emission_tex];
-      auto  idx          = sample_discrete(light.elements_cdf, rel);
+      auto  idx          = sample_discrete_alias(
+          light.elements_prob, light.elements_alias, rel, ral);
       auto  uv = vec2f{((idx % emission_tex.width) + 0.5f) / emission_tex.width,
           ((idx / emission_tex.width) + 0.5f) / emission_tex.height};
       return transform_direction(environment.frame,
@@ -449,150 +531,190 @@ struct trace_result {
   vec3f normal   = {0, 0, 0};
 };
 
-// Recursive path tracing.
-static trace_result trace_path(const scene_data& scene, const trace_bvh& bvh,
-    const trace_lights& lights, const ray3f& ray_, rng_state& rng,
-    const trace_params& params) {
-  // initialize
-  auto radiance      = vec3f{0, 0, 0};
-  auto weight        = vec3f{1, 1, 1};
-  auto ray           = ray_;
-  auto volume_stack  = vector<material_point>{};
-  auto max_roughness = 0.0f;
-  auto hit           = false;
-  auto hit_albedo    = vec3f{0, 0, 0};
-  auto hit_normal    = vec3f{0, 0, 0};
-  auto opbounce      = 0;
-
-  // trace  path
-  for (auto bounce = 0; bounce < params.bounces; bounce++) {
-    // intersect next point
-    auto intersection = intersect_scene(bvh, scene, ray);
-    if (!intersection.hit) {
-      if (bounce > 0 || !params.envhidden)
-        radiance += weight * eval_environment(scene, ray.d);
-      break;
-    }
+// Volumes a path is in, innermost last. The stack has a fixed capacity and
+// lives with the path, on the sampler stack or in the arena for wavefront
+// paths, so that paths do not allocate. Samplers enter a volume only from
+// outside of all volumes, so they use one entry.
+const auto trace_max_volumes = 4;
+struct trace_volume_stack {
+  material_point volumes[trace_max_volumes] = {};
+  int            size                       = 0;
+};
 
-    // handle transmission if inside a volume
-    auto in_volume = false;
-    if (!volume_stack.empty()) {
-      auto& vsdf     = volume_stack.back();
-      auto  distance = sample_transmittance(
-           vsdf.density, intersection.distance, rand1f(rng), rand1f(rng));
-      weight *= eval_transmittance(vsdf.density, distance) /
-                sample_transmittance_pdf(
-                    vsdf.density, distance, intersection.distance);
-      in_volume             = distance < intersection.distance;
-      intersection.distance = distance;
-    }
+static void push_volume(
+    trace_volume_stack& stack, const material_point& volume) {
+  if (stack.size < trace_max_volumes) stack.volumes[stack.size++] = volume;
+}
+static void pop_volume(trace_volume_stack& stack) {
+  if (stack.size > 0) stack.size--;
+}
+static const material_point& top_volume(const trace_volume_stack& stack) {
+  return stack.volumes[stack.size - 1];
+}
 
-    // switch between surface and volume
-    if (!in_volume) {
-      // prepare shading point
-      auto outgoing = -ray.d;
-      auto position = eval_shading_position(scene, intersection, outgoing);
-      auto normal   = eval_shading_normal(scene, intersection, outgoing);
-      auto material = eval_material(scene, intersection);
+// State of a path between bounces, shared by `trace_path()` and the
+// wavefront sampler.
+struct trace_path_state {
+  ray3f              ray           = {};
+  vec3f              radiance      = {0, 0, 0};
+  vec3f              weight        = {1, 1, 1};
+  float              max_roughness = 0;
+  bool               hit           = false;
+  vec3f              hit_albedo    = {0, 0, 0};
+  vec3f              hit_normal    = {0, 0, 0};
+  int                bounce        = 0;
+  int                opbounce      = 0;
+  float              cone          = 0;
+  trace_volume_stack volumes       = {};
+  scene_intersection intersection  = {};
+};
 
-      // correct roughness
-      if (params.nocaustics) {
-        max_roughness      = max(material.roughness, max_roughness);
-        material.roughness = max_roughness;
-      }
+// One bounce of a path: shade the path at its last intersection, and sample
+// the next ray. Returns whether the path continues.
+static bool trace_path_bounce(trace_path_state& path,
+    const scene_data& scene, const trace_bvh& bvh, const trace_lights& lights,
+    rng_state& rng, const trace_params& params) {
+  auto& ray          = path.ray;
+  auto& weight       = path.weight;
+  auto  intersection = path.intersection;
+  if (!intersection.hit) {
+    if (path.bounce > 0 || !params.envhidden)
+      path.radiance += weight * eval_environment(scene, ray.d);
+    return false;
+  }
 
-      // handle opacity
-      if (material.opacity < 1 && rand1f(rng) >= material.opacity) {
-        if (opbounce++ > 128) break;
-        ray = {position + ray.d * 1e-2f, ray.d};
-        bounce -= 1;
-        continue;
-      }
+  // handle transmission if inside a volume
+  auto in_volume = false;
+  if (path.volumes.size != 0) {
+    auto& vsdf     = top_volume(path.volumes);
+    auto  distance = sample_transmittance(
+         vsdf.density, intersection.distance, rand1f(rng), rand1f(rng));
+    weight *= eval_transmittance(vsdf.density, distance) /
+              sample_transmittance_pdf(
+                  vsdf.density, distance, intersection.distance);
+    in_volume             = distance < intersection.distance;
+    intersection.distance = distance;
+  }
 
-      // set hit variables
-      if (bounce == 0) {
-        hit        = true;
-        hit_albedo = material.color;
-        hit_normal = normal;
-      }
+  // widen ray cone
+  path.cone += get_cone_spread(scene, params) * intersection.distance;
 
-      // accumulate emission
-      radiance += weight * eval_emission(material, normal, outgoing);
+  // switch between surface and volume
+  if (!in_volume) {
+    // prepare shading point
+    auto outgoing = -ray.d;
+    auto position = eval_shading_position(scene, intersection, outgoing);
+    auto normal   = eval_shading_normal(scene, intersection, outgoing);
+    auto material = eval_material(
+        scene, intersection, eval_footprint(path.cone, normal, outgoing));
 
-      // next direction
-      auto incoming = vec3f{0, 0, 0};
-      if (!is_delta(material)) {
-        if (rand1f(rng) < 0.5f) {
-          incoming = sample_bsdfcos(
-              material, normal, outgoing, rand1f(rng), rand2f(rng));
-        } else {
-          incoming = sample_lights(
-              scene, lights, position, rand1f(rng), rand1f(rng), rand2f(rng));
-        }
-        if (incoming == vec3f{0, 0, 0}) break;
-        weight *=
-            eval_bsdfcos(material, normal, outgoing, incoming) /
-            (0.5f * sample_bsdfcos_pdf(material, normal, outgoing, incoming) +
-                0.5f *
-                    sample_lights_pdf(scene, bvh, lights, position, incoming));
-      } else {
-        incoming = sample_delta(material, normal, outgoing, rand1f(rng));
-        weight *= eval_delta(material, normal, outgoing, incoming) /
-                  sample_delta_pdf(material, normal, outgoing, incoming);
-      }
+    // correct roughness
+    if (params.nocaustics) {
+      path.max_roughness = max(material.roughness, path.max_roughness);
+      material.roughness = path.max_roughness;
+    }
 
-      // update volume stack
-      if (is_volumetric(scene, intersection) &&
-          dot(normal, outgoing) * dot(normal, incoming) < 0) {
-        if (volume_stack.empty()) {
-          auto material = eval_material(scene, intersection);
-          volume_stack.push_back(material);
-        } else {
-          volume_stack.pop_back();
-        }
-      }
+    // handle opacity
+    if (material.opacity < 1 && rand1f(rng) >= material.opacity) {
+      if (path.opbounce++ > 128) return false;
+      ray = {position + ray.d * 1e-2f, ray.d};
+      return true;
+    }
 
-      // setup next iteration
-      ray = {position, incoming};
-    } else {
-      // prepare shading point
-      auto  outgoing = -ray.d;
-      auto  position = ray.o + ray.d * intersection.distance;
-      auto& vsdf     = volume_stack.back();
+    // set hit variables
+    if (path.bounce == 0) {
+      path.hit        = true;
+      path.hit_albedo = material.color;
+      path.hit_normal = normal;
+    }
 
-      // accumulate emission
-      // radiance += weight * eval_volemission(emission, outgoing);
+    // accumulate emission
+    path.radiance += weight * eval_emission(material, normal, outgoing);
 
-      // next direction
-      auto incoming = vec3f{0, 0, 0};
+    // next direction
+    auto incoming = vec3f{0, 0, 0};
+    if (!is_delta(material)) {
       if (rand1f(rng) < 0.5f) {
-        incoming = sample_scattering(vsdf, outgoing, rand1f(rng), rand2f(rng));
+        incoming = sample_bsdfcos(
+            material, normal, outgoing, rand1f(rng), rand2f(rng));
       } else {
         incoming = sample_lights(
             scene, lights, position, rand1f(rng), rand1f(rng), rand2f(rng));
       }
-      if (incoming == vec3f{0, 0, 0}) break;
+      if (incoming == vec3f{0, 0, 0}) return false;
       weight *=
-          eval_scattering(vsdf, outgoing, incoming) /
-          (0.5f * sample_scattering_pdf(vsdf, outgoing, incoming) +
+          eval_bsdfcos(material, normal, outgoing, incoming) /
+          (0.5f * sample_bsdfcos_pdf(material, normal, outgoing, incoming) +
               0.5f * sample_lights_pdf(scene, bvh, lights, position, incoming));
+    } else {
+      incoming = sample_delta(material, normal, outgoing, rand1f(rng));
+      weight *= eval_delta(material, normal, outgoing, incoming) /
+                sample_delta_pdf(material, normal, outgoing, incoming);
+    }
 
-      // setup next iteration
-      ray = {position, incoming};
+    // update volume stack
+    if (is_volumetric(scene, intersection) &&
+        dot(normal, outgoing) * dot(normal, incoming) < 0) {
+      if (path.volumes.size == 0) {
+        push_volume(path.volumes, eval_material(scene, intersection));
+      } else {
+        pop_volume(path.volumes);
+      }
     }
 
-    // check weight
-    if (weight == vec3f{0, 0, 0} || !isfinite(weight)) break;
+    // setup next iteration
+    ray = {position, incoming};
+  } else {
+    // prepare shading point
+    auto  outgoing = -ray.d;
+    auto  position = ray.o + ray.d * intersection.distance;
+    auto& vsdf     = top_volume(path.volumes);
 
-    // russian roulette
-    if (bounce > 3) {
-      auto rr_prob = min((float)0.99, max(weight));
-      if (rand1f(rng) >= rr_prob) break;
-      weight *= 1 / rr_prob;
+    // next direction
+    auto incoming = vec3f{0, 0, 0};
+    if (rand1f(rng) < 0.5f) {
+      incoming = sample_scattering(vsdf, outgoing, rand1f(rng), rand2f(rng));
+    } else {
+      incoming = sample_lights(
+          scene, lights, position, rand1f(rng), rand1f(rng), rand2f(rng));
     }
+    if (incoming == vec3f{0, 0, 0}) return false;
+    weight *=
+        eval_scattering(vsdf, outgoing, incoming) /
+        (0.5f * sample_scattering_pdf(vsdf, outgoing, incoming) +
+            0.5f * sample_lights_pdf(scene, bvh, lights, position, incoming));
+
+    // setup next iteration
+    ray = {position, incoming};
   }
 
-  return {radiance, hit, hit_albedo, hit_normal};
+  // check weight
+  if (weight == vec3f{0, 0, 0} || !isfinite(weight)) return false;
+
+  // russian roulette
+  if (path.bounce > 3) {
+    auto rr_prob = min((float)0.99, max(weight));
+    if (rand1f(rng) >= rr_prob) return false;
+    weight *= 1 / rr_prob;
+  }
+
+  // next bounce
+  path.bounce += 1;
+  return path.bounce < params.bounces;
+}
+
+// Recursive path tracing.
+static trace_result trace_path(const scene_data& scene, const trace_bvh& bvh,
+    const trace_lights& lights, const ray3f& ray_, rng_state& rng,
+    const trace_params& params) {
+  auto path = trace_path_state{};
+  path.ray  = ray_;
+  auto next = params.bounces > 0;
+  while (next) {
+    path.intersection = intersect_scene(bvh, scene, path.ray);
+    next = trace_path_bounce(path, scene, bvh, lights, rng, params);
+  }
+  return {path.radiance, path.hit, path.hit_albedo, path.hit_normal};
 }
 
 // Recursive path tracing.
@@ -603,7 +725,7 @@ static trace_result trace_pathdirect(const scene_data& scene,
   auto radiance      = vec3f{0, 0, 0};
   auto weight        = vec3f{1, 1, 1};
   auto ray           = ray_;
-  auto volume_stack  = vector<material_point>{};
+  auto volume_stack  = trace_volume_stack{};
   auto max_roughness = 0.0f;
   auto hit           = false;
   auto hit_albedo    = vec3f{0, 0, 0};
@@ -611,6 +733,10 @@ static trace_result trace_pathdirect(const scene_data& scene,
   auto next_emission = true;
   auto opbounce      = 0;
 
+  // ray cone, for texture filtering
+  auto spread = get_cone_spread(scene, params);
+  auto cone   = 0.0f;
+
   // trace  path
   for (auto bounce = 0; bounce < params.bounces; bounce++) {
     // intersect next point
@@ -623,8 +749,8 @@ static trace_result trace_pathdirect(const scene_data& scene,
 
     // handle transmission if inside a volume
     auto in_volume = false;
-    if (!volume_stack.empty()) {
-      auto& vsdf     = volume_stack.back();
+    if (volume_stack.size != 0) {
+      auto& vsdf     = top_volume(volume_stack);
       auto  distance = sample_transmittance(
            vsdf.density, intersection.distance, rand1f(rng), rand1f(rng));
       weight *= eval_transmittance(vsdf.density, distance) /
@@ -634,13 +760,17 @@ static trace_result trace_pathdirect(const scene_data& scene,
       intersection.distance = distance;
     }
 
+    // widen ray cone
+    cone += spread * intersection.distance;
+
     // switch between surface and volume
     if (!in_volume) {
       // prepare shading point
       auto outgoing = -ray.d;
       auto position = eval_shading_position(scene, intersection, outgoing);
       auto normal   = eval_shading_normal(scene, intersection, outgoing);
-      auto material = eval_material(scene, intersection);
+      auto material = eval_material(
+        scene, intersection, eval_footprint(cone, normal, outgoing));
 
       // correct roughness
       if (params.nocaustics) {
@@ -718,11 +848,11 @@ static trace_result trace_pathdirect(const scene_data& scene,
       // update volume stack
       if (is_volumetric(scene, intersection) &&
           dot(normal, outgoing) * dot(normal, incoming) < 0) {
-        if (volume_stack.empty()) {
+        if (volume_stack.size == 0) {
           auto material = eval_material(scene, intersection);
-          volume_stack.push_back(material);
+          push_volume(volume_stack, material);
         } else {
-          volume_stack.pop_back();
+          pop_volume(volume_stack);
         }
       }
 
@@ -732,7 +862,7 @@ static trace_result trace_pathdirect(const scene_data& scene,
       // prepare shading point
       auto  outgoing = -ray.d;
       auto  position = ray.o + ray.d * intersection.distance;
-      auto& vsdf     = volume_stack.back();
+      auto& vsdf     = top_volume(volume_stack);
 
       // next direction
       auto incoming = vec3f{0, 0, 0};
@@ -774,7 +904,7 @@ static trace_result trace_pathmis(const scene_data& scene, const trace_bvh& bvh,
   auto radiance      = vec3f{0, 0, 0};
   auto weight        = vec3f{1, 1, 1};
   auto ray           = ray_;
-  auto volume_stack  = vector<material_point>{};
+  auto volume_stack  = trace_volume_stack{};
   auto max_roughness = 0.0f;
   auto hit           = false;
   auto hit_albedo    = vec3f{0, 0, 0};
@@ -789,6 +919,10 @@ static trace_result trace_pathmis(const scene_data& scene, const trace_bvh& bvh,
   auto next_emission     = true;
   auto next_intersection = scene_intersection{};
 
+  // ray cone, for texture filtering
+  auto spread = get_cone_spread(scene, params);
+  auto cone   = 0.0f;
+
   // trace  path
   for (auto bounce = 0; bounce < params.bounces; bounce++) {
     // intersect next point
@@ -802,8 +936,8 @@ static trace_result trace_pathmis(const scene_data& scene, const trace_bvh& bvh,
 
     // handle transmission if inside a volume
     auto in_volume = false;
-    if (!volume_stack.empty()) {
-      auto& vsdf     = volume_stack.back();
+    if (volume_stack.size != 0) {
+      auto& vsdf     = top_volume(volume_stack);
       auto  distance = sample_transmittance(
            vsdf.density, intersection.distance, rand1f(rng), rand1f(rng));
       weight *= eval_transmittance(vsdf.density, distance) /
@@ -813,13 +947,17 @@ static trace_result trace_pathmis(const scene_data& scene, const trace_bvh& bvh,
       intersection.distance = distance;
     }
 
+    // widen ray cone
+    cone += spread * intersection.distance;
+
     // switch between surface and volume
     if (!in_volume) {
       // prepare shading point
       auto outgoing = -ray.d;
       auto position = eval_shading_position(scene, intersection, outgoing);
       auto normal   = eval_shading_normal(scene, intersection, outgoing);
-      auto material = eval_material(scene, intersection);
+      auto material = eval_material(
+        scene, intersection, eval_footprint(cone, normal, outgoing));
 
       // correct roughness
       if (params.nocaustics) {
@@ -900,11 +1038,11 @@ static trace_result trace_pathmis(const scene_data& scene, const trace_bvh& bvh,
       // update volume stack
       if (is_volumetric(scene, intersection) &&
           dot(normal, outgoing) * dot(normal, incoming) < 0) {
-        if (volume_stack.empty()) {
+        if (volume_stack.size == 0) {
           auto material = eval_material(scene, intersection);
-          volume_stack.push_back(material);
+          push_volume(volume_stack, material);
         } else {
-          volume_stack.pop_back();
+          pop_volume(volume_stack);
         }
       }
 
@@ -914,7 +1052,7 @@ static trace_result trace_pathmis(const scene_data& scene, const trace_bvh& bvh,
       // prepare shading point
       auto  outgoing = -ray.d;
       auto  position = ray.o + ray.d * intersection.distance;
-      auto& vsdf     = volume_stack.back();
+      auto& vsdf     = top_volume(volume_stack);
 
       // next direction
       auto incoming = vec3f{0, 0, 0};
@@ -1041,6 +1179,10 @@ static trace_result trace_naive(const scene_data& scene, const trace_bvh& bvh,
   auto hit_normal = vec3f{0, 0, 0};
   auto opbounce   = 0;
 
+  // ray cone, for texture filtering
+  auto spread = get_cone_spread(scene, params);
+  auto cone   = 0.0f;
+
   // trace  path
   for (auto bounce = 0; bounce < params.bounces; bounce++) {
     // intersect next point
@@ -1051,11 +1193,15 @@ static trace_result trace_naive(const scene_data& scene, const trace_bvh& bvh,
       break;
     }
 
+    // widen ray cone
+    cone += spread * intersection.distance;
+
     // prepare shading point
     auto outgoing = -ray.d;
     auto position = eval_shading_position(scene, intersection, outgoing);
     auto normal   = eval_shading_normal(scene, intersection, outgoing);
-    auto material = eval_material(scene, intersection);
+    auto material = eval_material(
+        scene, intersection, eval_footprint(cone, normal, outgoing));
 
     // handle opacity
     if (material.opacity < 1 && rand1f(rng) >= material.opacity) {
@@ -1120,6 +1266,10 @@ static trace_result trace_eyelight(const scene_data& scene,
   auto hit_normal = vec3f{0, 0, 0};
   auto opbounce   = 0;
 
+  // ray cone, for texture filtering
+  auto spread = get_cone_spread(scene, params);
+  auto cone   = 0.0f;
+
   // trace  path
   for (auto bounce = 0; bounce < max(params.bounces, 4); bounce++) {
     // intersect next point
@@ -1130,11 +1280,15 @@ static trace_result trace_eyelight(const scene_data& scene,
       break;
     }
 
+    // widen ray cone
+    cone += spread * intersection.distance;
+
     // prepare shading point
     auto outgoing = -ray.d;
     auto position = eval_shading_position(scene, intersection, outgoing);
     auto normal   = eval_shading_normal(scene, intersection, outgoing);
-    auto material = eval_material(scene, intersection);
+    auto material = eval_material(
+        scene, intersection, eval_footprint(cone, normal, outgoing));
 
     // handle opacity
     if (material.opacity < 1 && rand1f(rng) >= material.opacity) {
@@ -1433,6 +1587,7 @@ static sampler_func get_trace_sampler_func(const trace_params& params) {
     case trace_sampler_type::diagram: return trace_diagram;
     case trace_sampler_type::furnace: return trace_furnace;
     case trace_sampler_type::falsecolor: return trace_falsecolor;
+    case trace_sampler_type::wavefront: return trace_path;
     default: {
       throw std::runtime_error("sampler unknown");
       return nullptr;
@@ -1450,6 +1605,7 @@ bool is_sampler_lit(const trace_params& params) {
     case trace_sampler_type::eyelight: return false;
     case trace_sampler_type::furnace: return true;
     case trace_sampler_type::falsecolor: return false;
+    case trace_sampler_type::wavefront: return true;
     default: {
       throw std::runtime_error("sampler unknown");
       return false;
@@ -1457,20 +1613,14 @@ bool is_sampler_lit(const trace_params& params) {
   }
 }
 
-// Trace a block of samples
-void trace_sample(trace_state& state, const scene_data& scene,
-    const trace_bvh& bvh, const trace_lights& lights, int i, int j, int sample,
-    const trace_params& params) {
-  auto& camera  = scene.cameras[params.camera];
-  auto  sampler = get_trace_sampler_func(params);
-  auto  idx     = state.width * j + i;
-  auto  ray     = sample_camera(camera, {i, j}, {state.width, state.height},
-           rand2f(state.rngs[idx]), rand2f(state.rngs[idx]), params.tentfilter);
-  auto [radiance, hit, albedo, normal] = sampler(
-      scene, bvh, lights, ray, state.rngs[idx], params);
+// Accumulate a sample result in the state buffers. Missed rays show the
+// environment if `showenv` is set.
+template <bool showenv>
+static void accumulate_sample(trace_state& state, int idx, int sample,
+    const vec3f& direction, trace_result result, float clamp) {
+  auto [radiance, hit, albedo, normal] = result;
   if (!isfinite(radiance)) radiance = {0, 0, 0};
-  if (max(radiance) > params.clamp)
-    radiance = radiance * (params.clamp / max(radiance));
+  if (max(radiance) > clamp) radiance = radiance * (clamp / max(radiance));
   auto weight = 1.0f / (sample + 1);
   if (hit) {
     state.image[idx] = lerp(
@@ -1478,56 +1628,262 @@ void trace_sample(trace_state& state, const scene_data& scene,
     state.albedo[idx] = lerp(state.albedo[idx], albedo, weight);
     state.normal[idx] = lerp(state.normal[idx], normal, weight);
     state.hits[idx] += 1;
-  } else if (!params.envhidden && !scene.environments.empty()) {
+  } else if (showenv) {
     state.image[idx] = lerp(
         state.image[idx], {radiance.x, radiance.y, radiance.z, 1}, weight);
     state.albedo[idx] = lerp(state.albedo[idx], {1, 1, 1}, weight);
-    state.normal[idx] = lerp(state.normal[idx], -ray.d, weight);
+    state.normal[idx] = lerp(state.normal[idx], -direction, weight);
     state.hits[idx] += 1;
   } else {
     state.image[idx]  = lerp(state.image[idx], {0, 0, 0, 0}, weight);
     state.albedo[idx] = lerp(state.albedo[idx], {0, 0, 0}, weight);
-    state.normal[idx] = lerp(state.normal[idx], -ray.d, weight);
+    state.normal[idx] = lerp(state.normal[idx], -direction, weight);
+  }
+  if (!state.moments.empty()) {
+    auto lum           = (hit || showenv) ? luminance(radiance) : 0.0f;
+    state.moments[idx] = lerp(state.moments[idx], lum * lum, weight);
+  }
+}
+static void accumulate_sample(trace_state& state, const scene_data& scene,
+    int idx, int sample, const vec3f& direction, const trace_result& result,
+    const trace_params& params) {
+  if (!params.envhidden && !scene.environments.empty()) {
+    accumulate_sample<true>(
+        state, idx, sample, direction, result, params.clamp);
+  } else {
+    accumulate_sample<false>(
+        state, idx, sample, direction, result, params.clamp);
+  }
+}
+
+// Trace a block of samples
+void trace_sample(trace_state& state, const scene_data& scene,
+    const trace_bvh& bvh, const trace_lights& lights, int i, int j, int sample,
+    const trace_params& params) {
+  auto& camera  = scene.cameras[params.camera];
+  auto  sampler = get_trace_sampler_func(params);
+  auto  idx     = state.width * j + i;
+  auto  ray = sample_camera(camera, state.offset + vec2i{i, j}, state.extent,
+       rand2f(state.rngs[idx]), rand2f(state.rngs[idx]), params.tentfilter);
+  auto  result  = sampler(scene, bvh, lights, ray, state.rngs[idx], params);
+  accumulate_sample(state, scene, idx, sample, ray.d, result, params);
+}
+
+// Path state for wavefront path tracing. It holds the loop variables of
+// `trace_path()`, so that paths can be suspended between bounces. As in
+// `trace_path()`, the volume stack holds at most one volume.
+// Trace one sample for all pixels in a tile with wavefront scheduling.
+// Paths are kept in a queue. At each step, all active rays are intersected
+// with the scene, then hits are sorted by material and shaded together, which
+// keeps material and texture data hot in cache. Each path uses the random
+// generator of its pixel, so the result matches `trace_path()`. Queues live in
+// the worker arena, and are sorted with a counting sort, so that no memory is
+// allocated per sample.
+static void trace_wavefront(trace_state& state, trace_arena& arena,
+    const trace_tile& tile, const scene_data& scene, const trace_bvh& bvh,
+    const trace_lights& lights, int sample, const trace_params& params,
+    const std::atomic<bool>* stop = nullptr) {
+  auto& camera = scene.cameras[params.camera];
+
+  // scratch memory
+  reset_arena(arena);
+  auto npaths     = (tile.end.x - tile.start.x) * (tile.end.y - tile.start.y);
+  auto nmaterials = (int)scene.materials.size();
+  auto paths      = arena_alloc<trace_path_state>(arena, npaths);
+  auto pixels     = arena_alloc<int>(arena, npaths);
+  auto camera_ray = arena_alloc<ray3f>(arena, npaths);
+  auto active     = arena_alloc<int>(arena, npaths);
+  auto next       = arena_alloc<int>(arena, npaths);
+  auto offsets    = arena_alloc<int>(arena, nmaterials + 2);
+
+  // generate camera rays
+  auto npath = 0;
+  for (auto j : range(tile.start.y, tile.end.y)) {
+    for (auto i : range(tile.start.x, tile.end.x)) {
+      pixels[npath]     = state.width * j + i;
+      auto& rng         = state.rngs[pixels[npath]];
+      camera_ray[npath] = sample_camera(camera, state.offset + vec2i{i, j},
+          state.extent, rand2f(rng), rand2f(rng), params.tentfilter);
+      paths[npath].ray  = camera_ray[npath];
+      npath += 1;
+    }
+  }
+
+  // path queues
+  auto nactive = params.bounces > 0 ? npaths : 0;
+  for (auto idx : range(nactive)) active[idx] = idx;
+
+  // advance all paths one bounce at a time
+  auto material_of = [&](int idx) {
+    auto& intersection = paths[idx].intersection;
+    return intersection.hit ? scene.instances[intersection.instance].material
+                            : -1;
+  };
+  while (nactive > 0) {
+    if (stop && *stop) return;
+
+    // extend
+    for (auto idx : range(nactive)) {
+      auto& path        = paths[active[idx]];
+      path.intersection = intersect_scene(bvh, scene, path.ray);
+    }
+
+    // sort by material, keeping the queue order within a material
+    std::fill(offsets, offsets + nmaterials + 2, 0);
+    for (auto idx : range(nactive)) offsets[material_of(active[idx]) + 2] += 1;
+    for (auto material : range(1, nmaterials + 2))
+      offsets[material] += offsets[material - 1];
+    for (auto idx : range(nactive))
+      next[offsets[material_of(active[idx]) + 1]++] = active[idx];
+    std::swap(active, next);
+
+    // shade
+    auto nnext = 0;
+    for (auto idx : range(nactive)) {
+      auto path = active[idx];
+      if (trace_path_bounce(
+              paths[path], scene, bvh, lights, state.rngs[pixels[path]], params))
+        next[nnext++] = path;
+    }
+    std::swap(active, next);
+    nactive = nnext;
+  }
+
+  // accumulate
+  for (auto idx : range(npaths)) {
+    auto& path = paths[idx];
+    accumulate_sample(state, scene, pixels[idx], sample, camera_ray[idx].d,
+        {path.radiance, path.hit, path.hit_albedo, path.hit_normal}, params);
   }
 }
 
 // Init a sequence of random number generators.
 trace_state make_trace_state(
     const scene_data& scene, const trace_params& params) {
+  auto state = trace_state{};
+  make_trace_state(state, scene, params);
+  return state;
+}
+void make_trace_state(
+    trace_state& state, const scene_data& scene, const trace_params& params) {
+  make_trace_state(
+      state, scene, params, {0, 0}, get_trace_resolution(scene, params));
+}
+
+// Image size rendered for the given params.
+vec2i get_trace_resolution(
+    const scene_data& scene, const trace_params& params) {
   auto& camera = scene.cameras[params.camera];
-  auto  state  = trace_state{};
   if (camera.aspect >= 1) {
-    state.width  = params.resolution;
-    state.height = (int)round(params.resolution / camera.aspect);
+    return {params.resolution, (int)round(params.resolution / camera.aspect)};
   } else {
-    state.height = params.resolution;
-    state.width  = (int)round(params.resolution * camera.aspect);
+    return {(int)round(params.resolution * camera.aspect), params.resolution};
   }
+}
+
+// Advance a random number generator by `delta` steps in logarithmic time,
+// following the PCG jump-ahead algorithm.
+static void advance_rng(rng_state& rng, uint64_t delta) {
+  auto cur_mult = (uint64_t)6364136223846793005ULL, cur_plus = rng.inc;
+  auto acc_mult = (uint64_t)1, acc_plus = (uint64_t)0;
+  while (delta > 0) {
+    if (delta & 1) {
+      acc_mult *= cur_mult;
+      acc_plus = acc_plus * cur_mult + cur_plus;
+    }
+    cur_plus = (cur_mult + 1) * cur_plus;
+    cur_mult *= cur_mult;
+    delta /= 2;
+  }
+  rng.state = acc_mult * rng.state + acc_plus;
+}
+
+// Initialize state for an image region. Pixel generators are seeded from
+// a sequence over the full image, that is advanced to the start of each row.
+void make_trace_state(trace_state& state, const scene_data& scene,
+    const trace_params& params, const vec2i& start, const vec2i& end) {
+  state.extent  = get_trace_resolution(scene, params);
+  state.offset  = start;
+  state.width   = end.x - start.x;
+  state.height  = end.y - start.y;
   state.samples = 0;
-  state.image.assign(state.width * state.height, {0, 0, 0, 0});
-  state.albedo.assign(state.width * state.height, {0, 0, 0});
-  state.normal.assign(state.width * state.height, {0, 0, 0});
-  state.hits.assign(state.width * state.height, 0);
-  state.rngs.assign(state.width * state.height, {});
-  auto rng_ = make_rng(1301081);
-  for (auto& rng : state.rngs) {
-    rng = make_rng(params.seed, rand1i(rng_, 1 << 31) / 2 + 1);
+  auto size     = (size_t)state.width * (size_t)state.height;
+  reset_buffer(state.image, size, {0, 0, 0, 0});
+  reset_buffer(state.albedo, size, {0, 0, 0});
+  reset_buffer(state.normal, size, {0, 0, 0});
+  reset_buffer(state.hits, size, 0);
+  reset_buffer(state.rngs, size, {});
+  for (auto j : range(state.height)) {
+    auto rng_ = make_rng(1301081);
+    advance_rng(rng_, (uint64_t)state.extent.x * (uint64_t)(start.y + j) +
+                          (uint64_t)start.x);
+    for (auto i : range(state.width)) {
+      state.rngs[state.width * j + i] = make_rng(
+          params.seed, rand1i(rng_, 1 << 31) / 2 + 1);
+    }
   }
   if (params.denoise) {
-    state.denoised.assign(state.width * state.height, {0, 0, 0, 0});
+    reset_buffer(state.denoised, size, {0, 0, 0, 0});
+  } else {
+    state.denoised.clear();
   }
-  return state;
+  if (params.noise > 0) {
+    reset_buffer(state.moments, size, 0.0f);
+  } else {
+    state.moments.clear();
+  }
+  auto tilesize = max(params.tilesize, 1);
+  auto ntiles   = (size_t)((state.width + tilesize - 1) / tilesize) *
+                (size_t)((state.height + tilesize - 1) / tilesize);
+  if (state.tiles.capacity() < ntiles)
+    count_allocation(ntiles * sizeof(trace_tile));
+  state.tiles.clear();
+  for (auto j = 0; j < state.height; j += tilesize) {
+    for (auto i = 0; i < state.width; i += tilesize) {
+      state.tiles.push_back({{i, j},
+          {min(i + tilesize, state.width), min(j + tilesize, state.height)}});
+    }
+  }
+  state.arenas.resize(get_parallel_threads());
+}
+
+// Add a light, reusing the memory of a previous one if present
+static trace_light& add_light(trace_lights& lights, size_t& count) {
+  if (count == lights.lights.size()) {
+    count_allocation(sizeof(trace_light));
+    lights.lights.emplace_back();
+  }
+  auto& light = lights.lights[count++];
+  light.elements_cdf.clear();
+  light.elements_prob.clear();
+  light.elements_alias.clear();
+  return light;
 }
 
-// Forward declaration
-static trace_light& add_light(trace_lights& lights) {
-  return lights.lights.emplace_back();
+// Build the light sampling tables from the element weights, that are stored
+// in the light cdf on input.
+static void make_light_tables(trace_light& light) {
+  auto size = light.elements_cdf.size();
+  reset_buffer(light.elements_prob, size, 0.0f);
+  reset_buffer(light.elements_alias, size, 0);
+  std::copy(light.elements_cdf.begin(), light.elements_cdf.end(),
+      light.elements_prob.begin());
+  make_discrete_alias(light.elements_prob, light.elements_alias);
+  for (auto idx : range((size_t)1, size)) {
+    light.elements_cdf[idx] += light.elements_cdf[idx - 1];
+  }
 }
 
 // Init trace lights
 trace_lights make_trace_lights(
     const scene_data& scene, const trace_params& params) {
   auto lights = trace_lights{};
+  make_trace_lights(lights, scene, params);
+  return lights;
+}
+void make_trace_lights(
+    trace_lights& lights, const scene_data& scene, const trace_params& params) {
+  auto count = (size_t)0;
 
   for (auto handle : range(scene.instances.size())) {
     auto& instance = scene.instances[handle];
@@ -1535,49 +1891,82 @@ trace_lights make_trace_lights(
     if (material.emission == vec3f{0, 0, 0}) continue;
     auto& shape = scene.shapes[instance.shape];
     if (shape.triangles.empty() && shape.quads.empty()) continue;
-    auto& light       = add_light(lights);
+    auto& light       = add_light(lights, count);
     light.instance    = (int)handle;
     light.environment = invalidid;
     if (!shape.triangles.empty()) {
-      light.elements_cdf = vector<float>(shape.triangles.size());
-      for (auto idx : range(light.elements_cdf.size())) {
-        auto& t                 = shape.triangles[idx];
-        light.elements_cdf[idx] = triangle_area(
-            shape.positions[t.x], shape.positions[t.y], shape.positions[t.z]);
-        if (idx != 0) light.elements_cdf[idx] += light.elements_cdf[idx - 1];
-      }
+      reset_buffer(light.elements_cdf, shape.triangles.size(), 0.0f);
+      parallel_for_batch(
+          light.elements_cdf.size(), (size_t)4096, [&](size_t idx) {
+            auto& t                 = shape.triangles[idx];
+            light.elements_cdf[idx] = triangle_area(shape.positions[t.x],
+                shape.positions[t.y], shape.positions[t.z]);
+          });
     }
     if (!shape.quads.empty()) {
-      light.elements_cdf = vector<float>(shape.quads.size());
-      for (auto idx : range(light.elements_cdf.size())) {
-        auto& t                 = shape.quads[idx];
-        light.elements_cdf[idx] = quad_area(shape.positions[t.x],
-            shape.positions[t.y], shape.positions[t.z], shape.positions[t.w]);
-        if (idx != 0) light.elements_cdf[idx] += light.elements_cdf[idx - 1];
-      }
+      reset_buffer(light.elements_cdf, shape.quads.size(), 0.0f);
+      parallel_for_batch(
+          light.elements_cdf.size(), (size_t)4096, [&](size_t idx) {
+            auto& t                 = shape.quads[idx];
+            light.elements_cdf[idx] = quad_area(shape.positions[t.x],
+                shape.positions[t.y], shape.positions[t.z],
+                shape.positions[t.w]);
+          });
     }
+    make_light_tables(light);
   }
   for (auto handle : range(scene.environments.size())) {
     auto& environment = scene.environments[handle];
     if (environment.emission == vec3f{0, 0, 0}) continue;
-    auto& light       = add_light(lights);
+    auto& light       = add_light(lights, count);
     light.instance    = invalidid;
     light.environment = (int)handle;
     if (environment.emission_tex != invalidid) {
       auto& texture      = scene.textures[environment.emission_tex];
-      light.elements_cdf = vector<float>(texture.width * texture.height);
-      for (auto idx : range(light.elements_cdf.size())) {
-        auto ij    = vec2i{(int)idx % texture.width, (int)idx / texture.width};
-        auto th    = (ij.y + 0.5f) * pif / texture.height;
-        auto value = lookup_texture(texture, ij.x, ij.y);
-        light.elements_cdf[idx] = max(value) * sin(th);
-        if (idx != 0) light.elements_cdf[idx] += light.elements_cdf[idx - 1];
-      }
+      reset_buffer(light.elements_cdf,
+          (size_t)texture.width * (size_t)texture.height, 0.0f);
+      parallel_for_batch(
+          light.elements_cdf.size(), (size_t)4096, [&](size_t idx) {
+            auto ij = vec2i{(int)idx % texture.width, (int)idx / texture.width};
+            auto th = (ij.y + 0.5f) * pif / texture.height;
+            auto value = lookup_texture(texture, ij.x, ij.y);
+            light.elements_cdf[idx] = max(value) * sin(th);
+          });
+      make_light_tables(light);
     }
   }
+  lights.lights.resize(count);
+}
 
-  // handle progress
-  return lights;
+// Memory used by the rendering data
+memory_usage compute_memory(const trace_state& state) {
+  auto memory = memory_usage{};
+  memory += vector_memory(state.image);
+  memory += vector_memory(state.albedo);
+  memory += vector_memory(state.normal);
+  memory += vector_memory(state.hits);
+  memory += vector_memory(state.rngs);
+  memory += vector_memory(state.denoised);
+  memory += vector_memory(state.moments);
+  memory += vector_memory(state.tiles);
+  memory += vector_memory(state.arenas);
+  for (auto& arena : state.arenas) {
+    memory += vector_memory(arena.chunks);
+    for (auto& chunk : arena.chunks) memory += vector_memory(chunk);
+  }
+  return memory;
+}
+memory_usage compute_memory(const trace_lights& lights) {
+  auto memory = vector_memory(lights.lights);
+  for (auto& light : lights.lights) {
+    memory += vector_memory(light.elements_cdf);
+    memory += vector_memory(light.elements_prob);
+    memory += vector_memory(light.elements_alias);
+  }
+  return memory;
+}
+memory_usage compute_memory(const trace_bvh& bvh) {
+  return compute_memory(bvh.bvh);
 }
 
 // Progressively computes an image.
@@ -1591,25 +1980,150 @@ image_data trace_image(const scene_data& scene, const trace_params& params) {
   return get_image(state);
 }
 
+// Minimum number of samples before a tile is tested for convergence
+const auto trace_adaptive_min_samples = 16;
+
+// Estimate the relative standard error of the mean of a tile's pixels.
+// We take the maximum over pixels so that small noisy features, like leaves
+// against the sky, keep the whole tile active.
+static float estimate_tile_error(
+    const trace_state& state, const trace_tile& tile) {
+  auto error = 0.0f;
+  for (auto j : range(tile.start.y, tile.end.y)) {
+    for (auto i : range(tile.start.x, tile.end.x)) {
+      auto idx      = state.width * j + i;
+      auto lum      = luminance(xyz(state.image[idx]));
+      auto variance = max(state.moments[idx] - lum * lum, 0.0f);
+      auto stderror = sqrt(variance / tile.samples);
+      error         = max(error, stderror / (lum + 0.01f));
+    }
+  }
+  return error;
+}
+
+// Sample loop over the pixels of a tile. Returns false if stopped.
+using trace_tile_func = bool (*)(trace_state& state, trace_arena& arena,
+    const trace_tile& tile, const scene_data& scene, const trace_bvh& bvh,
+    const trace_lights& lights, const trace_params& params,
+    const std::atomic<bool>* stop);
+
+// Sample loop specialized at compile time on the sampler and on the
+// per-frame flags, so that the per-pixel loop has no indirect calls and no
+// flag checks. Instantiated for all combinations by `get_trace_tile_func()`.
+template <sampler_func sampler, bool tentfilter, bool showenv>
+static bool trace_tile_loop(trace_state& state, trace_arena&,
+    const trace_tile& tile, const scene_data& scene, const trace_bvh& bvh,
+    const trace_lights& lights, const trace_params& params,
+    const std::atomic<bool>* stop) {
+  auto& camera = scene.cameras[params.camera];
+  for (auto j : range(tile.start.y, tile.end.y)) {
+    for (auto i : range(tile.start.x, tile.end.x)) {
+      auto  idx = state.width * j + i;
+      auto& rng = state.rngs[idx];
+      for (auto sample : range(state.samples, state.samples + params.batch)) {
+        if (stop && *stop) return false;
+        auto ray = sample_camera(camera, state.offset + vec2i{i, j},
+            state.extent, rand2f(rng), rand2f(rng), tentfilter);
+        auto result = sampler(scene, bvh, lights, ray, rng, params);
+        accumulate_sample<showenv>(
+            state, idx, sample, ray.d, result, params.clamp);
+      }
+    }
+  }
+  return true;
+}
+
+// Wavefront sample loop
+static bool trace_tile_wavefront(trace_state& state, trace_arena& arena,
+    const trace_tile& tile, const scene_data& scene, const trace_bvh& bvh,
+    const trace_lights& lights, const trace_params& params,
+    const std::atomic<bool>* stop) {
+  for (auto sample : range(state.samples, state.samples + params.batch)) {
+    if (stop && *stop) return false;
+    trace_wavefront(
+        state, arena, tile, scene, bvh, lights, sample, params, stop);
+  }
+  return !(stop && *stop);
+}
+
+// Pick the sample loop specialization for the frame flags
+template <sampler_func sampler>
+static trace_tile_func get_trace_tile_func(bool tentfilter, bool showenv) {
+  if (tentfilter) {
+    return showenv ? trace_tile_loop<sampler, true, true>
+                   : trace_tile_loop<sampler, true, false>;
+  } else {
+    return showenv ? trace_tile_loop<sampler, false, true>
+                   : trace_tile_loop<sampler, false, false>;
+  }
+}
+
+// Resolve the sample loop once per frame
+static trace_tile_func get_trace_tile_func(
+    const scene_data& scene, const trace_params& params) {
+  auto tent    = params.tentfilter;
+  auto showenv = !params.envhidden && !scene.environments.empty();
+  switch (params.sampler) {
+    case trace_sampler_type::path:
+      return get_trace_tile_func<trace_path>(tent, showenv);
+    case trace_sampler_type::pathdirect:
+      return get_trace_tile_func<trace_pathdirect>(tent, showenv);
+    case trace_sampler_type::pathmis:
+      return get_trace_tile_func<trace_pathmis>(tent, showenv);
+    case trace_sampler_type::pathtest:
+      return get_trace_tile_func<trace_pathtest>(tent, showenv);
+    case trace_sampler_type::naive:
+      return get_trace_tile_func<trace_naive>(tent, showenv);
+    case trace_sampler_type::eyelight:
+      return get_trace_tile_func<trace_eyelight>(tent, showenv);
+    case trace_sampler_type::diagram:
+      return get_trace_tile_func<trace_diagram>(tent, showenv);
+    case trace_sampler_type::furnace:
+      return get_trace_tile_func<trace_furnace>(tent, showenv);
+    case trace_sampler_type::falsecolor:
+      return get_trace_tile_func<trace_falsecolor>(tent, showenv);
+    case trace_sampler_type::wavefront: return trace_tile_wavefront;
+    default: {
+      throw std::runtime_error("sampler unknown");
+      return nullptr;
+    }
+  }
+}
+
+// Trace a batch of samples for all pixels in a tile and update its
+// convergence estimate.
+static void trace_tile_samples(trace_state& state, trace_arena& arena,
+    trace_tile& tile, trace_tile_func tile_func, const scene_data& scene,
+    const trace_bvh& bvh, const trace_lights& lights,
+    const trace_params& params, const std::atomic<bool>* stop = nullptr) {
+  if (tile.converged) return;
+  if (!tile_func(state, arena, tile, scene, bvh, lights, params, stop)) return;
+  tile.samples += params.batch;
+  if (!state.moments.empty() && tile.samples >= trace_adaptive_min_samples) {
+    tile.converged = estimate_tile_error(state, tile) < params.noise;
+  }
+}
+
 // Progressively compute an image by calling trace_samples multiple times.
+// Work is split in tiles that are handed out dynamically to threads, so that
+// fast tiles, or tiles that converged, do not stall the others.
 void trace_samples(trace_state& state, const scene_data& scene,
     const trace_bvh& bvh, const trace_lights& lights,
     const trace_params& params) {
   if (state.samples >= params.samples) return;
+  auto tile_func = get_trace_tile_func(scene, params);
+  if (state.arenas.empty()) state.arenas.resize(get_parallel_threads());
   if (params.noparallel) {
-    for (auto j : range(state.height)) {
-      for (auto i : range(state.width)) {
-        for (auto sample : range(state.samples, state.samples + params.batch)) {
-          trace_sample(state, scene, bvh, lights, i, j, sample, params);
-        }
-      }
+    for (auto& tile : state.tiles) {
+      trace_tile_samples(state, state.arenas[0], tile, tile_func, scene, bvh,
+          lights, params);
     }
   } else {
-    parallel_for(state.width, state.height, [&](int i, int j) {
-      for (auto sample : range(state.samples, state.samples + params.batch)) {
-        trace_sample(state, scene, bvh, lights, i, j, sample, params);
-      }
-    });
+    parallel_for_workers(state.tiles.size(), (int)state.arenas.size(),
+        [&](size_t idx, int worker) {
+          trace_tile_samples(state, state.arenas[worker], state.tiles[idx],
+              tile_func, scene, bvh, lights, params);
+        });
   }
   state.samples += params.batch;
   if (params.denoise && !state.denoised.empty()) {
@@ -1618,6 +2132,13 @@ void trace_samples(trace_state& state, const scene_data& scene,
   }
 }
 
+// Number of tiles that are still sampled
+int get_active_tiles(const trace_state& state) {
+  auto active = 0;
+  for (auto& tile : state.tiles) active += tile.converged ? 0 : 1;
+  return active;
+}
+
 // Trace context
 trace_context make_trace_context(const trace_params& params) {
   return {{}, false, false};
@@ -1632,12 +2153,13 @@ void trace_start(trace_context& context, trace_state& state,
   context.done   = false;
   context.worker = std::async(std::launch::async, [&]() {
     if (context.stop) return;
-    parallel_for(state.width, state.height, [&](int i, int j) {
-      for (auto sample : range(state.samples, state.samples + params.batch)) {
-        if (context.stop) return;
-        trace_sample(state, scene, bvh, lights, i, j, sample, params);
-      }
-    });
+    auto tile_func = get_trace_tile_func(scene, params);
+    if (state.arenas.empty()) state.arenas.resize(get_parallel_threads());
+    parallel_for_workers(state.tiles.size(), (int)state.arenas.size(),
+        [&](size_t idx, int worker) {
+          trace_tile_samples(state, state.arenas[worker], state.tiles[idx],
+              tile_func, scene, bvh, lights, params, &context.stop);
+        });
     state.samples += params.batch;
     if (context.stop) return;
     if (params.denoise && !state.denoised.empty()) {
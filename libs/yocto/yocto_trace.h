@@ -78,6 +78,7 @@ enum struct trace_sampler_type {
   diagram,     // diagram rendering
   furnace,     // furnace test
   falsecolor,  // false color rendering
+  wavefront,   // path tracing with wavefront scheduling
 };
 // Type of false color visualization
 enum struct trace_falsecolor_type {
@@ -110,6 +111,9 @@ struct trace_params {
   int                   pratio         = 8;
   bool                  denoise        = false;
   int                   batch          = 1;
+  int                   tilesize       = 32;
+  float                 noise          = 0;
+  bool                  mipmaps        = false;
 };
 
 // Progressively computes an image.
@@ -123,10 +127,13 @@ image_data trace_image(const scene_data& scene, const trace_params& params);
 namespace yocto {
 
 // Scene lights used during rendering. These are created automatically.
+// Elements are sampled with an alias table, while the cdf is used for pdfs.
 struct trace_light {
-  int           instance     = invalidid;
-  int           environment  = invalidid;
-  vector<float> elements_cdf = {};
+  int           instance       = invalidid;
+  int           environment    = invalidid;
+  vector<float> elements_cdf   = {};
+  vector<float> elements_prob  = {};
+  vector<int>   elements_alias = {};
 };
 
 // Scene lights
@@ -143,29 +150,85 @@ struct trace_bvh {
 // Check is a sampler requires lights
 bool is_sampler_lit(const trace_params& params);
 
-// Trace state
+// Image tile traced as a unit of work. Tiles stop sampling once their noise
+// estimate falls below `trace_params::noise`.
+struct trace_tile {
+  vec2i start     = {0, 0};
+  vec2i end       = {0, 0};
+  int   samples   = 0;
+  bool  converged = false;
+};
+
+// Per-thread scratch arena for temporary sampling data. Memory is handed out
+// linearly and recycled all at once, so that after warm-up, sampling does not
+// touch the heap.
+struct trace_arena {
+  vector<vector<byte>> chunks = {};
+  size_t               used   = 0;  // bytes used in the last chunk
+};
+
+// Trace state. The state may cover only a region of the image, starting at
+// `offset` in an image of size `extent`.
 struct trace_state {
-  int               width    = 0;
-  int               height   = 0;
-  int               samples  = 0;
-  vector<vec4f>     image    = {};
-  vector<vec3f>     albedo   = {};
-  vector<vec3f>     normal   = {};
-  vector<int>       hits     = {};
-  vector<rng_state> rngs     = {};
-  vector<vec4f>     denoised = {};
+  int                 width    = 0;
+  int                 height   = 0;
+  int                 samples  = 0;
+  vec2i               offset   = {0, 0};
+  vec2i               extent   = {0, 0};
+  vector<vec4f>       image    = {};
+  vector<vec3f>       albedo   = {};
+  vector<vec3f>       normal   = {};
+  vector<int>         hits     = {};
+  vector<rng_state>   rngs     = {};
+  vector<vec4f>       denoised = {};
+  vector<float>       moments  = {};  // luminance second moment, if adaptive
+  vector<trace_tile>  tiles    = {};
+  vector<trace_arena> arenas   = {};  // one per worker thread
 };
 
-// Initialize state.
+// Initialize state. The in-place version reuses the state memory, which makes
+// restarts allocation-free when the resolution does not grow.
 trace_state make_trace_state(
     const scene_data& scene, const trace_params& params);
+void make_trace_state(
+    trace_state& state, const scene_data& scene, const trace_params& params);
 
-// Initialize lights.
+// Initialize state for the image region from `start` to `end` pixels. Regions
+// render the same pixels as full images, so that large images can be rendered
+// tile by tile, with memory bounded by the tile size.
+void make_trace_state(trace_state& state, const scene_data& scene,
+    const trace_params& params, const vec2i& start, const vec2i& end);
+
+// Image size rendered for the given params.
+vec2i get_trace_resolution(const scene_data& scene, const trace_params& params);
+
+// Initialize lights. The in-place version reuses the lights memory.
 trace_lights make_trace_lights(
     const scene_data& scene, const trace_params& params);
+void make_trace_lights(
+    trace_lights& lights, const scene_data& scene, const trace_params& params);
+
+// Memory used by the rendering data. Embree bvhs are not accounted for,
+// since their memory is owned by the Embree device.
+memory_usage compute_memory(const trace_state& state);
+memory_usage compute_memory(const trace_lights& lights);
+memory_usage compute_memory(const trace_bvh& bvh);
+
+// Allocation counters for state, lights and arenas, used for benchmarking.
+// Counters are global and cumulative.
+struct trace_alloc_stats {
+  size_t allocations = 0;
+  size_t bytes       = 0;
+};
+trace_alloc_stats get_trace_alloc_stats();
+void              reset_trace_alloc_stats();
 
 // Build the bvh acceleration structure.
 trace_bvh make_trace_bvh(const scene_data& scene, const trace_params& params);
+// Build the bvh reusing shape bvhs that are already built, for example while
+// the scene was loading. Embree bvhs are built from scratch.
+trace_bvh make_trace_bvh(const scene_data& scene, const trace_params& params,
+    vector<shape_bvh>&& shapes);
 
 // Progressively computes an image.
 void trace_samples(trace_state& state, const scene_data& scene,
@@ -175,6 +238,9 @@ void trace_sample(trace_state& state, const scene_data& scene,
     const trace_bvh& bvh, const trace_lights& lights, int i, int j, int sample,
     const trace_params& params);
 
+// Number of tiles that are still sampled, i.e. not converged.
+int get_active_tiles(const trace_state& state);
+
 // Get resulting render, denoised if requested
 image_data get_image(const trace_state& state);
 void       get_image(image_data& image, const trace_state& state);
@@ -233,7 +299,8 @@ namespace yocto {
 
 // trace sampler names
 inline const auto trace_sampler_names = vector<string>{"path", "pathdirect",
-    "pathmis", "pathtest", "naive", "eyelight", "furnace", "falsecolor"};
+    "pathmis", "pathtest", "naive", "eyelight", "diagram", "furnace",
+    "falsecolor", "wavefront"};
 
 // false color names
 inline const auto trace_falsecolor_names = vector<string>{"position", "normal",
@@ -251,7 +318,8 @@ inline const auto trace_sampler_labels =
         {trace_sampler_type::eyelight, "eyelight"},
         {trace_sampler_type::diagram, "diagram"},
         {trace_sampler_type::furnace, "furnace"},
-        {trace_sampler_type::falsecolor, "falsecolor"}};
+        {trace_sampler_type::falsecolor, "falsecolor"},
+        {trace_sampler_type::wavefront, "wavefront"}};
 
 // false color labels
 inline const auto trace_falsecolor_labels =